@@ -0,0 +1,997 @@
+#include <stddef.h>
+#include "doseCore.h"
+
+/*	File Name: doseCore.c
+	Date: 18/10/2026
+	Purpose: Hardware independent dosing core, see doseCore.h. Every function works only on the struct doseCore
+			 it is given and the schedule pool it was started with, so any number of cores can run side by side
+	Required Headers: stddef.h, doseCore.h
+*/
+
+/* Global Variable Declarations*/
+const struct doseSchedule doseCoreEmptySchedule = {"", 0, 0, {{0, 0, 0, 0, 0, 0}}}; /*Used by every core with no doses, never written*/
+
+/* Function Prototypes*/
+void doseCoreCheckDoses(struct doseCore *, struct clockTime *, struct doseAction *, int *);
+void doseCoreCheckBoost(struct doseCore *, struct clockTime *, int, struct doseAction *, int *);
+void doseCoreUpdateNextDose(struct doseCore *, struct clockTime *);
+void doseCoreStartNewDay(struct doseCore *, unsigned int);
+long doseCoreBudgetTime(struct clockTime *);
+void doseCoreExpireBudget(struct doseBudget *, long);
+int doseCoreBudgetAllows(struct doseBudget *, int, long);
+void doseCoreRecordBudget(struct doseBudget *, int, long);
+void doseCoreAddAction(struct doseAction *, int *, int, int, int);
+void doseCoreSetStatus(struct doseCore *, int, int);
+struct doseSchedule * doseCoreOwnSchedule(struct doseCore *);
+struct doseSchedule * doseCoreShadow(struct doseCore *);
+void doseCorePublish(struct doseCore *, const struct doseSchedule *);
+struct doseSchedule * doseCoreFindTemplate(struct doseCore *, const char *);
+int doseCoreCheckDose(const struct dose *);
+void doseCoreForecastAdd(struct doseBudget *, struct doseForecast *, struct forecastDelivery *, long, int,
+	void (*)(const struct forecastDelivery *, void *), void *);
+
+
+/* Function Name: doseCorePoolInit
+	Purpose: Empties a pool of schedules, before any core is started with it
+	Params: (struct doseSchedule *) pool - Schedules to share between cores
+			(int) poolSize - Number of schedules
+	Returns: (void)
+*/
+void doseCorePoolInit(struct doseSchedule * pool, int poolSize)
+{
+	int i;
+
+	for(i = 0; i < poolSize; i++)
+	{
+		pool[i].name[0] = '\0';
+		pool[i].references = 0;
+		pool[i].scheduledDoses = 0;
+	}
+}
+
+/* Function Name: doseCoreInit
+	Purpose: Starts a core with no patient set up, full dose boosts and an empty schedule and dose budget
+	Params: (struct doseCore *) core - Core to start
+			(struct doseSchedule *) pool - Pool the core takes its schedules from, shared with other cores
+			(int) poolSize - Number of schedules in the pool
+	Returns: (void)
+*/
+void doseCoreInit(struct doseCore * core, struct doseSchedule * pool, int poolSize)
+{
+	core->pool = pool;
+	core->poolSize = poolSize;
+	core->schedule = &doseCoreEmptySchedule;
+	core->scheduleDay = 0;
+	core->boostIntensity = 0;
+	core->boostError = 0;
+	core->previousSwitchStatus = 0;
+	core->deliveryEvents = 0;
+	core->scheduleVersion = 0;
+	doseCoreReset(core);
+}
+
+/* Function Name: doseCoreReset
+	Purpose: Clears the schedule, the boosts given and the dose budget for a new patient. Templates are kept
+	Params: (struct doseCore *) core - Core to reset
+	Returns: (void)
+*/
+void doseCoreReset(struct doseCore * core)
+{
+	doseCorePublish(core, &doseCoreEmptySchedule);
+	core->boostsGiven = 0;
+	core->nextDoseTime = NO_DOSE_DUE;
+	core->nextDoseIndex = NO_DOSE;
+	core->scheduleChanged = 1;
+	core->scheduleVersion++;
+	core->statusCount[0] = 0;
+	core->statusCount[1] = 0;
+	core->statusCount[2] = 0;
+	core->lastBoostTime = NO_BOOST;
+	doseCoreClearBudget(core);
+	core->budgetWithheld = 0;
+}
+
+/* Function Name: doseCoreClearBudget
+	Purpose: Forgets every delivery counted by the dose budget, leaving the schedule and boosts alone
+	Params: (struct doseCore *) core - Core to change
+	Returns: (void)
+*/
+void doseCoreClearBudget(struct doseCore * core)
+{
+	core->budget.head = 0;
+	core->budget.shortTail = 0;
+	core->budget.longTail = 0;
+	core->budget.shortUnits = 0;
+	core->budget.longUnits = 0;
+}
+
+/* Function Name: doseCoreTick
+	Purpose: Checks the schedule and the boost switch, once a second while delivery is not suspended
+	Params: (struct doseCore *) core - Core to run
+			(struct clockTime *) now - Current time
+			(int) boostSwitch - 1 if the boost switch is pressed
+			(struct doseAction *) actions - Receives up to CORE_MAX_ACTIONS actions, in the order to carry them out
+	Returns: (int) Number of actions
+*/
+int doseCoreTick(struct doseCore * core, struct clockTime * now, int boostSwitch, struct doseAction * actions)
+{
+	int count = 0;
+
+	doseCoreCheckDoses(core, now, actions, &count);
+	doseCoreCheckBoost(core, now, boostSwitch, actions, &count);
+
+	return count;
+}
+
+/* Function Name: doseCoreCheckDoses
+	Purpose: Delivers the doses due this second. Only the cached time of the next dose is compared each second,
+			 the schedule is searched again only when a dose falls due or it changes
+	Params: (struct doseCore *) core - Core to run
+			(struct clockTime *) now - Current time
+			(struct doseAction *) actions - Action list
+			(int *) count - Number of actions in the list
+	Returns: (void)
+*/
+void doseCoreCheckDoses(struct doseCore * core, struct clockTime * now, struct doseAction * actions, int * count)
+{
+	int i;
+	long currentTime;
+	long time;
+	const struct dose * scheduled;
+
+	if(now->days != core->scheduleDay)
+	{
+		doseCoreStartNewDay(core, now->days);
+		doseCoreAddAction(actions, count, CORE_NEW_DAY, 0, 0);
+	}
+
+	currentTime = doseCoreSecondsOfDay(now->hours, now->mins, now->secs);
+
+	if(core->scheduleChanged || currentTime > core->nextDoseTime)
+	{
+		doseCoreUpdateNextDose(core, now);
+	}
+
+	if(currentTime != core->nextDoseTime)
+	{
+		return;
+	}
+
+	time = doseCoreBudgetTime(now);
+
+	for(i = 0; i < core->schedule->scheduledDoses; i++)
+	{
+		scheduled = &core->schedule->doses[i];
+
+		if(core->status[i] == 0 && doseCoreDueOnDay(scheduled, now->days)
+			&& doseCoreSecondsOfDay(scheduled->hours, scheduled->mins, scheduled->secs) == currentTime)
+		{
+			if(doseCoreBudgetAllows(&core->budget, scheduled->intensity, time))
+			{
+				doseCoreRecordBudget(&core->budget, scheduled->intensity, time);
+				doseCoreSetStatus(core, i, 1); /*Delivered*/
+				core->deliveredAt[i] = *now;
+				core->deliveryEvents++;
+				doseCoreAddAction(actions, count, CORE_DELIVER_DOSE, i, scheduled->intensity);
+			}
+			else
+			{
+				doseCoreSetStatus(core, i, 2); /*Withheld*/
+				core->budgetWithheld++;
+				doseCoreAddAction(actions, count, CORE_WITHHELD, i, scheduled->intensity);
+			}
+		}
+	}
+
+	core->scheduleChanged = 1;
+}
+
+/* Function Name: doseCoreCheckBoost
+	Purpose: Delivers a boost while the switch is pressed, unless the limit is reached or the switch has been
+			 held across two checks, in which case it is treated as stuck until released
+	Params: (struct doseCore *) core - Core to run
+			(struct clockTime *) now - Current time
+			(int) boostSwitch - 1 if the boost switch is pressed
+			(struct doseAction *) actions - Action list
+			(int *) count - Number of actions in the list
+	Returns: (void)
+*/
+void doseCoreCheckBoost(struct doseCore * core, struct clockTime * now, int boostSwitch, struct doseAction * actions, int * count)
+{
+	long time;
+
+	if(boostSwitch == 0)
+	{
+		core->previousSwitchStatus = 0;
+
+		if(core->boostError == 1)
+		{
+			core->boostError = 0;
+			doseCoreAddAction(actions, count, CORE_BOOST_CLEARED, MAX_DOSES, 0);
+		}
+
+		return;
+	}
+
+	if(core->previousSwitchStatus == 1 && core->boostError == 0)
+	{
+		core->boostError = 1;
+		doseCoreAddAction(actions, count, CORE_BOOST_STUCK, MAX_DOSES, 0);
+	}
+
+	core->previousSwitchStatus = 1;
+
+	if(core->boostsGiven >= MAX_BOOSTS || core->boostError == 1)
+	{
+		return;
+	}
+
+	time = doseCoreBudgetTime(now);
+
+	if(doseCoreBudgetAllows(&core->budget, core->boostIntensity, time) == 0)
+	{
+		core->budgetWithheld++;
+		doseCoreAddAction(actions, count, CORE_WITHHELD, MAX_DOSES, core->boostIntensity);
+		return;
+	}
+
+	doseCoreRecordBudget(&core->budget, core->boostIntensity, time);
+	core->boostTimes[core->boostsGiven] = *now;
+	core->boostsGiven++;
+	core->deliveryEvents++;
+	core->lastBoostTime = time;
+	doseCoreAddAction(actions, count, CORE_DELIVER_BOOST, MAX_DOSES, core->boostIntensity);
+}
+
+/* Function Name: doseCoreAddAction
+	Purpose: Appends an action to the list returned by doseCoreTick
+	Params: (struct doseAction *) actions - Action list
+			(int *) count - Number of actions in the list
+			(int) type, (int) index, (int) intensity - The action
+	Returns: (void)
+*/
+void doseCoreAddAction(struct doseAction * actions, int * count, int type, int index, int intensity)
+{
+	if(*count < CORE_MAX_ACTIONS)
+	{
+		actions[*count].type = type;
+		actions[*count].index = index;
+		actions[*count].intensity = intensity;
+		(*count)++;
+	}
+}
+
+/* Function Name: doseCoreSetStatus
+	Purpose: Changes the status of a dose, keeping the count of doses in each status
+	Params: (struct doseCore *) core - Core the dose belongs to
+			(int) index - Index of the dose to change
+			(int) status - New status
+	Returns: (void)
+*/
+void doseCoreSetStatus(struct doseCore * core, int index, int status)
+{
+	core->statusCount[core->status[index]]--;
+	core->statusCount[status]++;
+	core->status[index] = status;
+	core->scheduleVersion++;
+}
+
+/* Function Name: doseCoreOwnSchedule
+	Purpose: Gets a schedule the core can name. A schedule shared with other cores or held as a template is
+			 first copied to a free schedule in the pool, which the core then uses instead
+	Params: (struct doseCore *) core - Core about to name its schedule
+	Returns: (struct doseSchedule *) The core's own schedule, NULL if the pool has no free schedule to copy to
+*/
+struct doseSchedule * doseCoreOwnSchedule(struct doseCore * core)
+{
+	struct doseSchedule * own;
+
+	if(core->schedule != &doseCoreEmptySchedule)
+	{
+		own = &core->pool[core->schedule - core->pool];
+
+		if(own->references == 1 && own->name[0] == '\0')
+		{
+			return own;
+		}
+	}
+
+	own = doseCoreShadow(core);
+
+	if(own != NULL)
+	{
+		doseCorePublish(core, own);
+	}
+
+	return own;
+}
+
+/* Function Name: doseCoreShadow
+	Purpose: Copies the schedule in use to a free schedule in the pool, for an edit to be made to before it is
+			 published. The schedule in use is never written, so the tick, a forecast or anything else reading
+			 it sees the schedule either before or after an edit, never a dose part way through being changed
+	Params: (struct doseCore *) core - Core about to change its schedule
+	Returns: (struct doseSchedule *) The copy, NULL if the pool has no free schedule
+*/
+struct doseSchedule * doseCoreShadow(struct doseCore * core)
+{
+	struct doseSchedule * shadow;
+	int i;
+
+	for(i = 0; i < core->poolSize && core->pool[i].references != 0; i++)
+	{
+	}
+
+	if(i == core->poolSize)
+	{
+		return NULL;
+	}
+
+	shadow = &core->pool[i];
+	*shadow = *core->schedule;
+	shadow->name[0] = '\0';
+	shadow->references = 1;
+
+	return shadow;
+}
+
+/* Function Name: doseCorePublish
+	Purpose: Swaps the core onto another schedule, whose reference the caller has already taken, then lets go of
+			 the old one, freeing it if no other core or template holds it. The swap is a single pointer store
+	Params: (struct doseCore *) core - Core to change
+			(const struct doseSchedule *) schedule - Schedule to use, a shadow, a template or the empty schedule
+	Returns: (void)
+*/
+void doseCorePublish(struct doseCore * core, const struct doseSchedule * schedule)
+{
+	const struct doseSchedule * old = core->schedule;
+
+	core->schedule = schedule;
+
+	if(old != &doseCoreEmptySchedule)
+	{
+		core->pool[old - core->pool].references--;
+	}
+}
+
+/* Function Name: doseCoreFindTemplate
+	Purpose: Looks a template up by name in the core's pool
+	Params: (struct doseCore *) core - Core whose pool to search
+			(const char *) name - Template name, only the first TEMPLATE_NAME_LENGTH - 1 characters are compared
+	Returns: (struct doseSchedule *) The template, NULL if there is none by that name
+*/
+struct doseSchedule * doseCoreFindTemplate(struct doseCore * core, const char * name)
+{
+	int i;
+	int c;
+
+	for(i = 0; i < core->poolSize; i++)
+	{
+		for(c = 0; c < TEMPLATE_NAME_LENGTH - 1 && core->pool[i].name[c] == name[c] && name[c] != '\0'; c++)
+		{
+		}
+
+		if(core->pool[i].name[0] != '\0' && core->pool[i].name[c] == '\0' && (name[c] == '\0' || c == TEMPLATE_NAME_LENGTH - 1))
+		{
+			return &core->pool[i];
+		}
+	}
+
+	return NULL;
+}
+
+/* Function Name: doseCoreSaveTemplate
+	Purpose: Keeps the core's schedule as a template other cores can use, replacing any template of that name.
+			 The core goes on using it, so its next edit makes it a copy of its own again
+	Params: (struct doseCore *) core - Core whose schedule to keep
+			(const char *) name - Template name, cut short to TEMPLATE_NAME_LENGTH - 1 characters
+	Returns: (int) CORE_OK, CORE_NO_TEMPLATE if the name is empty or CORE_NO_SCHEDULE if the pool is full
+*/
+int doseCoreSaveTemplate(struct doseCore * core, const char * name)
+{
+	struct doseSchedule * saved;
+	int c;
+
+	if(name[0] == '\0')
+	{
+		return CORE_NO_TEMPLATE;
+	}
+
+	saved = doseCoreOwnSchedule(core);
+
+	if(saved == NULL)
+	{
+		return CORE_NO_SCHEDULE;
+	}
+
+	doseCoreDeleteTemplate(core, name);
+
+	for(c = 0; c < TEMPLATE_NAME_LENGTH - 1 && name[c] != '\0'; c++)
+	{
+		saved->name[c] = name[c];
+	}
+
+	saved->name[c] = '\0';
+	saved->references++;
+
+	return CORE_OK;
+}
+
+/* Function Name: doseCoreUseTemplate
+	Purpose: Replaces the core's schedule with a template, with every dose pending
+	Params: (struct doseCore *) core - Core to change
+			(const char *) name - Template name
+	Returns: (int) CORE_OK, or CORE_NO_TEMPLATE
+*/
+int doseCoreUseTemplate(struct doseCore * core, const char * name)
+{
+	struct doseSchedule * named = doseCoreFindTemplate(core, name);
+	int i;
+
+	if(named == NULL)
+	{
+		return CORE_NO_TEMPLATE;
+	}
+
+	named->references++;
+	doseCorePublish(core, named);
+
+	for(i = 0; i < named->scheduledDoses; i++)
+	{
+		core->status[i] = 0;
+	}
+
+	core->statusCount[0] = named->scheduledDoses;
+	core->statusCount[1] = 0;
+	core->statusCount[2] = 0;
+	core->scheduleChanged = 1;
+	core->scheduleVersion++;
+
+	return CORE_OK;
+}
+
+/* Function Name: doseCoreDeleteTemplate
+	Purpose: Removes a template's name. Cores using it keep their schedule, which is freed once none is left
+	Params: (struct doseCore *) core - Core whose pool holds the template
+			(const char *) name - Template name
+	Returns: (int) CORE_OK, or CORE_NO_TEMPLATE
+*/
+int doseCoreDeleteTemplate(struct doseCore * core, const char * name)
+{
+	struct doseSchedule * named = doseCoreFindTemplate(core, name);
+
+	if(named == NULL)
+	{
+		return CORE_NO_TEMPLATE;
+	}
+
+	named->name[0] = '\0';
+	named->references--;
+
+	return CORE_OK;
+}
+
+/* Function Name: doseCoreSetDose
+	Purpose: Adds a dose to the schedule or replaces one, after checking it. The dose is stored as pending
+	Params: (struct doseCore *) core - Core to change
+			(int) index - Index of the dose to replace, -1 to add a dose
+			(struct dose *) newDose - Dose to store, startDay is days since start up
+	Returns: (int) Index of the dose, or CORE_FULL, CORE_INVALID_DOSE, CORE_INVALID_TIME, CORE_INVALID_INTENSITY,
+			 CORE_INVALID_REPEAT or CORE_NO_SCHEDULE
+*/
+int doseCoreSetDose(struct doseCore * core, int index, struct dose * newDose)
+{
+	struct doseSchedule * shadow;
+	int result;
+
+	if(index == -1 && core->schedule->scheduledDoses >= MAX_DOSES)
+	{
+		return CORE_FULL;
+	}
+
+	if(index < -1 || index >= core->schedule->scheduledDoses)
+	{
+		return CORE_INVALID_DOSE;
+	}
+
+	result = doseCoreCheckDose(newDose);
+
+	if(result != CORE_OK)
+	{
+		return result;
+	}
+
+	shadow = doseCoreShadow(core);
+
+	if(shadow == NULL)
+	{
+		return CORE_NO_SCHEDULE;
+	}
+
+	if(index == -1)
+	{
+		index = shadow->scheduledDoses;
+		shadow->scheduledDoses++;
+	}
+	else
+	{
+		core->statusCount[core->status[index]]--;
+	}
+
+	shadow->doses[index] = *newDose;
+	doseCorePublish(core, shadow);
+	core->status[index] = 0; /*Pending*/
+	core->statusCount[0]++;
+	core->scheduleChanged = 1;
+	core->scheduleVersion++;
+
+	return index;
+}
+
+/* Function Name: doseCoreCheckDose
+	Purpose: Checks a dose's time, intensity and repeat
+	Params: (const struct dose *) checked - Dose to check
+	Returns: (int) CORE_OK, or CORE_INVALID_TIME, CORE_INVALID_INTENSITY or CORE_INVALID_REPEAT
+*/
+int doseCoreCheckDose(const struct dose * checked)
+{
+	if(checked->hours < 0 || checked->hours > 23 || checked->mins < 0 || checked->mins > 59 || checked->secs < 0 || checked->secs > 59)
+	{
+		return CORE_INVALID_TIME;
+	}
+
+	if(checked->intensity != 0 && checked->intensity != 1)
+	{
+		return CORE_INVALID_INTENSITY;
+	}
+
+	if(checked->repeatDays < 0 || checked->repeatDays > MAX_REPEAT_DAYS)
+	{
+		return CORE_INVALID_REPEAT;
+	}
+
+	return CORE_OK;
+}
+
+/* Function Name: doseCoreRemoveDose
+	Purpose: Removes a dose from the schedule, keeping the order of the rest
+	Params: (struct doseCore *) core - Core to change
+			(int) index - Index of the dose to remove
+	Returns: (int) CORE_OK, or CORE_INVALID_DOSE or CORE_NO_SCHEDULE
+*/
+int doseCoreRemoveDose(struct doseCore * core, int index)
+{
+	struct doseSchedule * shadow;
+	int i;
+
+	if(index < 0 || index >= core->schedule->scheduledDoses)
+	{
+		return CORE_INVALID_DOSE;
+	}
+
+	shadow = doseCoreShadow(core);
+
+	if(shadow == NULL)
+	{
+		return CORE_NO_SCHEDULE;
+	}
+
+	for(i = index; i < shadow->scheduledDoses - 1; i++)
+	{
+		shadow->doses[i] = shadow->doses[i + 1];
+	}
+
+	shadow->scheduledDoses--;
+	doseCorePublish(core, shadow);
+	core->statusCount[core->status[index]]--;
+
+	for(i = index; i < shadow->scheduledDoses; i++)
+	{
+		core->status[i] = core->status[i + 1];
+		core->deliveredAt[i] = core->deliveredAt[i + 1];
+	}
+
+	core->scheduleChanged = 1;
+	core->scheduleVersion++;
+
+	return CORE_OK;
+}
+
+/* Function Name: doseCoreClockChanged
+	Purpose: Tells the core the clock has been set, so the next dose is worked out again
+	Params: (struct doseCore *) core - Core to change
+	Returns: (void)
+*/
+void doseCoreClockChanged(struct doseCore * core)
+{
+	core->scheduleChanged = 1;
+}
+
+/* Function Name: doseCoreUpdateNextDose
+	Purpose: Finds the earliest pending dose due later today, storing its time in nextDoseTime
+	Params: (struct doseCore *) core - Core to update
+			(struct clockTime *) now - Current time
+	Returns: (void)
+*/
+void doseCoreUpdateNextDose(struct doseCore * core, struct clockTime * now)
+{
+	int i;
+	long currentTime;
+	long doseTime;
+	const struct dose * scheduled;
+
+	currentTime = doseCoreSecondsOfDay(now->hours, now->mins, now->secs);
+	core->nextDoseTime = NO_DOSE_DUE;
+	core->nextDoseIndex = NO_DOSE;
+
+	for(i = 0; i < core->schedule->scheduledDoses; i++)
+	{
+		scheduled = &core->schedule->doses[i];
+
+		if(core->status[i] == 0 && doseCoreDueOnDay(scheduled, now->days))
+		{
+			doseTime = doseCoreSecondsOfDay(scheduled->hours, scheduled->mins, scheduled->secs);
+
+			if(doseTime >= currentTime && doseTime < core->nextDoseTime)
+			{
+				core->nextDoseTime = doseTime;
+				core->nextDoseIndex = i;
+			}
+		}
+	}
+
+	core->scheduleChanged = 0;
+}
+
+/* Function Name: doseCoreStartNewDay
+	Purpose: Returns repeating doses to pending at the start of a day. Single doses keep their status
+	Params: (struct doseCore *) core - Core to update
+			(unsigned int) day - Days since start up
+	Returns: (void)
+*/
+void doseCoreStartNewDay(struct doseCore * core, unsigned int day)
+{
+	int i;
+
+	for(i = 0; i < core->schedule->scheduledDoses; i++)
+	{
+		if(core->schedule->doses[i].repeatDays > 0 && core->status[i] != 0)
+		{
+			doseCoreSetStatus(core, i, 0);
+		}
+	}
+
+	core->scheduleDay = day;
+	core->scheduleChanged = 1;
+}
+
+/* Function Name: doseCoreNextDose
+	Purpose: Reports the next pending dose today. The cached answer is used unless the schedule has changed
+	Params: (struct doseCore *) core - Core to read
+			(struct clockTime *) now - Current time
+			(long *) doseTime - Receives the dose's seconds since midnight, NO_DOSE_DUE if none
+	Returns: (int) Index of the dose, or NO_DOSE
+*/
+int doseCoreNextDose(struct doseCore * core, struct clockTime * now, long * doseTime)
+{
+	if(core->scheduleChanged || doseCoreSecondsOfDay(now->hours, now->mins, now->secs) > core->nextDoseTime)
+	{
+		doseCoreUpdateNextDose(core, now);
+	}
+
+	*doseTime = core->nextDoseTime;
+	return core->nextDoseIndex;
+}
+
+/* Function Name: doseCoreSinceBoost
+	Purpose: Time since the last boost was delivered
+	Params: (struct doseCore *) core - Core to read
+			(struct clockTime *) now - Current time
+	Returns: (long) Seconds since the last boost, NO_BOOST if none has been given
+*/
+long doseCoreSinceBoost(struct doseCore * core, struct clockTime * now)
+{
+	if(core->lastBoostTime == NO_BOOST)
+	{
+		return NO_BOOST;
+	}
+
+	return doseCoreBudgetTime(now) - core->lastBoostTime;
+}
+
+/* Function Name: doseCoreForecast
+	Purpose: Works out every delivery from now to the end of the forecast, in order, leaving the core unchanged.
+			 The doses are sorted by time of day once, then each day's pending doses are run through a copy of
+			 the dose budget, so a forecast costs a few steps for each dose on each day. A boost being tried out
+			 is given now, after any dose due this second, as doseCoreTick would
+	Params: (const struct doseCore *) core - Core to forecast
+			(struct clockTime *) now - Current time
+			(struct doseForecast *) forecast - days and the what if fields, receives the totals
+			(void (*)(const struct forecastDelivery *, void *)) visit - Called with each delivery in turn, NULL if
+				only the totals are wanted
+			(void *) context - Passed to visit
+	Returns: (int) CORE_OK or CORE_INVALID_DAYS, or for the dose being tried out CORE_FULL, CORE_INVALID_TIME,
+			 CORE_INVALID_INTENSITY or CORE_INVALID_REPEAT. CORE_INVALID_INTENSITY also for the boost
+*/
+int doseCoreForecast(const struct doseCore * core, struct clockTime * now, struct doseForecast * forecast,
+	void (*visit)(const struct forecastDelivery *, void *), void * context)
+{
+	struct doseBudget budget = core->budget;
+	struct forecastDelivery delivery;
+	const struct dose * doses[MAX_DOSES + 1];
+	long times[MAX_DOSES + 1];
+	int order[MAX_DOSES + 1];
+	int count = core->schedule->scheduledDoses;
+	int boostPending = (forecast->boostIntensity >= 0);
+	long currentTime;
+	long startUp; /*Clock, in seconds since day 0, when the budget's time base began*/
+	int pending;
+	int day;
+	int i;
+	int j;
+
+	if(forecast->days < 1 || forecast->days > FORECAST_MAX_DAYS)
+	{
+		return CORE_INVALID_DAYS;
+	}
+
+	if(boostPending && forecast->boostIntensity != 0 && forecast->boostIntensity != 1)
+	{
+		return CORE_INVALID_INTENSITY;
+	}
+
+	if(forecast->extraDose != NULL)
+	{
+		if(count >= MAX_DOSES)
+		{
+			return CORE_FULL;
+		}
+
+		i = doseCoreCheckDose(forecast->extraDose);
+
+		if(i != CORE_OK)
+		{
+			return i;
+		}
+	}
+
+	/*Sort by time of day, doses at the same time keeping the order the schedule is checked in*/
+	for(i = 0; i <= count; i++)
+	{
+		doses[i] = (i < count) ? &core->schedule->doses[i] : forecast->extraDose;
+
+		if(doses[i] == NULL)
+		{
+			break;
+		}
+
+		times[i] = doseCoreSecondsOfDay(doses[i]->hours, doses[i]->mins, doses[i]->secs);
+
+		for(j = i; j > 0 && times[order[j - 1]] > times[i]; j--)
+		{
+			order[j] = order[j - 1];
+		}
+
+		order[j] = i;
+	}
+
+	count = i;
+	currentTime = doseCoreSecondsOfDay(now->hours, now->mins, now->secs);
+	startUp = ((long) now->days * 86400L) + currentTime - doseCoreBudgetTime(now);
+	forecast->delivered = 0;
+	forecast->withheld = 0;
+	forecast->units = 0;
+
+	for(day = 0; day < forecast->days; day++)
+	{
+		delivery.day = now->days + (unsigned int) day;
+
+		for(j = 0; j <= count; j++)
+		{
+			i = (j < count) ? order[j] : -1;
+
+			if(boostPending && (i == -1 || day > 0 || times[i] > currentTime))
+			{
+				delivery.time = currentTime;
+				delivery.index = MAX_DOSES;
+				delivery.intensity = forecast->boostIntensity;
+				doseCoreForecastAdd(&budget, forecast, &delivery, startUp, core->boostsGiven >= MAX_BOOSTS || core->boostError == 1, visit, context);
+				boostPending = 0;
+			}
+
+			if(i == -1 || (day == 0 && times[i] < currentTime) || doseCoreDueOnDay(doses[i], delivery.day) == 0)
+			{
+				continue;
+			}
+
+			/*Repeating doses return to pending each day, the dose being tried out has not been given*/
+			if(i >= core->schedule->scheduledDoses)
+			{
+				pending = 1;
+			}
+			else if(day == 0 && core->scheduleDay == now->days)
+			{
+				pending = (core->status[i] == 0);
+			}
+			else
+			{
+				pending = (doses[i]->repeatDays > 0 || core->status[i] == 0);
+			}
+
+			if(pending)
+			{
+				delivery.time = times[i];
+				delivery.index = i;
+				delivery.intensity = doses[i]->intensity;
+				doseCoreForecastAdd(&budget, forecast, &delivery, startUp, 0, visit, context);
+			}
+		}
+
+		forecast->dayUnits[day] = forecast->units;
+	}
+
+	return CORE_OK;
+}
+
+/* Function Name: doseCoreForecastAdd
+	Purpose: Runs one forecast delivery through the dose budget, adds it to the totals and passes it on
+	Params: (struct doseBudget *) budget - The forecast's copy of the dose budget
+			(struct doseForecast *) forecast - Totals
+			(struct forecastDelivery *) delivery - Day, time, index and intensity, receives withheld and units
+			(long) startUp - Clock, in seconds since day 0, at start up, to put the delivery on the budget's time base
+			(int) refused - 1 if the delivery would not be made whatever the budget
+			(void (*)(const struct forecastDelivery *, void *)) visit - Called with the delivery, may be NULL
+			(void *) context - Passed to visit
+	Returns: (void)
+*/
+void doseCoreForecastAdd(struct doseBudget * budget, struct doseForecast * forecast, struct forecastDelivery * delivery,
+	long startUp, int refused, void (*visit)(const struct forecastDelivery *, void *), void * context)
+{
+	long time = ((long) delivery->day * 86400L) + delivery->time - startUp;
+
+	if(refused == 0 && doseCoreBudgetAllows(budget, delivery->intensity, time))
+	{
+		doseCoreRecordBudget(budget, delivery->intensity, time);
+		delivery->withheld = 0;
+		forecast->delivered++;
+		forecast->units += (delivery->intensity == 1) ? 1 : 2;
+	}
+	else
+	{
+		delivery->withheld = 1;
+		forecast->withheld++;
+	}
+
+	delivery->units = forecast->units;
+
+	if(visit != NULL)
+	{
+		visit(delivery, context);
+	}
+}
+
+/* Function Name: doseCoreSecondsOfDay
+	Purpose: Converts a time of day to seconds since midnight
+	Params: (int) timeHours, (int) timeMins, (int) timeSecs - Time of day
+	Returns: (long) Seconds since midnight
+*/
+long doseCoreSecondsOfDay(int timeHours, int timeMins, int timeSecs)
+{
+	return ((long) timeHours * 3600L) + ((long) timeMins * 60L) + timeSecs;
+}
+
+/* Function Name: doseCoreDueOnDay
+	Purpose: Checks whether a dose falls on the given day
+	Params: (const struct dose *) scheduledDose - Pointer to the dose
+			(unsigned int) day - Days since start up
+	Returns: (int) 1 if the dose falls on that day, 0 otherwise
+*/
+int doseCoreDueOnDay(const struct dose * scheduledDose, unsigned int day)
+{
+	if(day < scheduledDose->startDay)
+	{
+		return 0;
+	}
+
+	if(scheduledDose->repeatDays == 0)
+	{
+		return day == scheduledDose->startDay;
+	}
+
+	return ((day - scheduledDose->startDay) % scheduledDose->repeatDays) == 0;
+}
+
+/* Function Name: doseCorePulseDelay
+	Purpose: Motor position for a delivery
+	Params: (int) intensity - 1 for a half dose, 0 for a full dose
+	Returns: (int) Pulse width in E clock cycles
+*/
+int doseCorePulseDelay(int intensity)
+{
+	return (intensity == 1) ? PULSE_HALF_DOSE : PULSE_FULL_DOSE;
+}
+
+/* Function Name: doseCoreBudgetUsed
+	Purpose: Reports how much of each dose budget window is used
+	Params: (struct doseCore *) core - Core to read
+			(struct clockTime *) now - Current time
+			(int *) shortUnits, (int *) longUnits - Receive the half doses counted in each window
+	Returns: (void)
+*/
+void doseCoreBudgetUsed(struct doseCore * core, struct clockTime * now, int * shortUnits, int * longUnits)
+{
+	doseCoreExpireBudget(&core->budget, doseCoreBudgetTime(now));
+	*shortUnits = core->budget.shortUnits;
+	*longUnits = core->budget.longUnits;
+}
+
+/* Function Name: doseCoreBudgetTime
+	Purpose: Time base of the dose budget and boosts. This is the time since start up, which setting the clock
+			 does not change, so moving the clock back can not reopen a window nor moving it on close one early
+	Params: (struct clockTime *) now - Pointer to the time
+	Returns: (long) Seconds since start up
+*/
+long doseCoreBudgetTime(struct clockTime * now)
+{
+	return now->upTime;
+}
+
+/* Function Name: doseCoreExpireBudget
+	Purpose: Removes deliveries older than each window from that window's total
+	Params: (struct doseBudget *) budget - Budget to update
+			(long) time - Current time in seconds since start up
+	Returns: (void)
+*/
+void doseCoreExpireBudget(struct doseBudget * budget, long time)
+{
+	while(budget->shortTail != budget->head && budget->ring[budget->shortTail].time <= time - BUDGET_SHORT_SECS)
+	{
+		budget->shortUnits -= budget->ring[budget->shortTail].units;
+		budget->shortTail = (budget->shortTail + 1) & (BUDGET_RING_SIZE - 1);
+	}
+
+	while(budget->longTail != budget->head && budget->ring[budget->longTail].time <= time - BUDGET_LONG_SECS)
+	{
+		budget->longUnits -= budget->ring[budget->longTail].units;
+		budget->longTail = (budget->longTail + 1) & (BUDGET_RING_SIZE - 1);
+	}
+}
+
+/* Function Name: doseCoreBudgetAllows
+	Purpose: Checks whether a delivery fits in both dose budget windows
+	Params: (struct doseBudget *) budget - Budget to check
+			(int) intensity - 1 for a half dose, 0 for a full dose
+			(long) time - Current time in seconds since start up
+	Returns: (int) 1 if the delivery is allowed, 0 if it must be withheld
+*/
+int doseCoreBudgetAllows(struct doseBudget * budget, int intensity, long time)
+{
+	int units = (intensity == 1) ? 1 : 2;
+
+	doseCoreExpireBudget(budget, time);
+
+	if(((budget->head + 1) & (BUDGET_RING_SIZE - 1)) == budget->longTail)
+	{
+		return 0; /*Cannot happen while BUDGET_RING_SIZE is more than BUDGET_LONG_UNITS, but never overwrite*/
+	}
+
+	return (budget->shortUnits + units <= BUDGET_SHORT_UNITS) && (budget->longUnits + units <= BUDGET_LONG_UNITS);
+}
+
+/* Function Name: doseCoreRecordBudget
+	Purpose: Adds a delivery to the dose budget, after doseCoreBudgetAllows has accepted it
+	Params: (struct doseBudget *) budget - Budget to update
+			(int) intensity - 1 for a half dose, 0 for a full dose
+			(long) time - Current time in seconds since start up
+	Returns: (void)
+*/
+void doseCoreRecordBudget(struct doseBudget * budget, int intensity, long time)
+{
+	int units = (intensity == 1) ? 1 : 2;
+
+	budget->ring[budget->head].time = time;
+	budget->ring[budget->head].units = units;
+	budget->head = (budget->head + 1) & (BUDGET_RING_SIZE - 1);
+	budget->shortUnits += units;
+	budget->longUnits += units;
+}
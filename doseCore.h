@@ -0,0 +1,196 @@
+/*	File Name: doseCore.h
+	Date: 18/10/2026
+	Purpose: Hardware independent dosing core - the dose schedule, boosts, dose budget and motor positions,
+			 with all of their state held in a struct doseCore. The core never touches a register or a global.
+			 Once a second the owner passes in the time and the boost switch, and gets back the deliveries and
+			 alarms to act on. Schedules live in a pool the owner provides, which any number of cores can
+			 share, so patients on the same named template share one copy of it. doseCoreForecast works out
+			 the deliveries over the coming days, with or without a change being tried out. Used by
+			 scheduleDose.c on the board and natively, and wrapped for C++ by doseCore.hpp
+	Required Headers: none
+*/
+
+#ifndef DOSE_CORE_H
+#define DOSE_CORE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MAX_DOSES 10
+#define MAX_BOOSTS 3
+#define MAX_REPEAT_DAYS 28
+#define NO_DOSE_DUE 86400L /*Never matches a time of day*/
+#define NO_DOSE -1
+#define NO_BOOST -1L
+#define BUDGET_SHORT_SECS 14400L /*4 hour window*/
+#define BUDGET_SHORT_UNITS 6 /*Half doses allowed in the short window*/
+#define BUDGET_LONG_SECS 86400L /*24 hour window*/
+#define BUDGET_LONG_UNITS 20 /*Half doses allowed in the long window*/
+#define BUDGET_RING_SIZE 32 /*Must be a power of two and more than BUDGET_LONG_UNITS*/
+#define TEMPLATE_NAME_LENGTH 12 /*Including the terminator, longer names are cut short*/
+#define FORECAST_MAX_DAYS 28
+
+/* Motor pulse widths, in E clock cycles */
+#define PULSE_REST 800 /*Left*/
+#define PULSE_HALF_DOSE 2500 /*Middle*/
+#define PULSE_FULL_DOSE 4800 /*Right*/
+
+/* Actions returned by doseCoreTick */
+#define CORE_DELIVER_DOSE 1 /*Turn the motor for dose index*/
+#define CORE_DELIVER_BOOST 2 /*Turn the motor for a boost*/
+#define CORE_WITHHELD 3 /*A dose (index) or boost (index MAX_DOSES) was withheld by the dose budget*/
+#define CORE_BOOST_STUCK 4 /*The boost switch has been held across two checks*/
+#define CORE_BOOST_CLEARED 5 /*The boost switch has been released after being stuck*/
+#define CORE_NEW_DAY 6 /*Repeating doses have returned to pending*/
+#define CORE_MAX_ACTIONS (MAX_DOSES + 3)
+
+/* Results of the schedule editing functions */
+#define CORE_OK 0
+#define CORE_FULL -1
+#define CORE_INVALID_TIME -2
+#define CORE_INVALID_INTENSITY -3
+#define CORE_INVALID_REPEAT -4
+#define CORE_INVALID_DOSE -5
+#define CORE_NO_SCHEDULE -6 /*Every schedule in the pool is in use*/
+#define CORE_NO_TEMPLATE -7
+#define CORE_INVALID_DAYS -8 /*Forecast not 1 to FORECAST_MAX_DAYS days long*/
+
+/* Structure Declarations*/
+/* A dose is one event per day it falls on. Rather than a copy per day, each dose holds the day it first
+	falls on and the number of days between repeats (0 for a single dose), so a schedule of any length
+	needs one entry per distinct event */
+struct dose
+{
+	int hours;
+	int mins;
+	int secs;
+	int intensity; /*1 half dose, 0 full dose*/
+	unsigned int startDay;
+	int repeatDays;
+};
+
+/* A schedule is only read by the cores using it. Templates are schedules with a name, and a core editing a
+	schedule it shares first copies it to a free one in the pool (copy on write). Patients on the same
+	regimen share one schedule and each core keeps only the status of its doses, so the pool needs a
+	schedule per template plus one per patient whose schedule has been edited. Every edit is made to a copy
+	and published by swapping the core's schedule pointer, so the pool also needs one free schedule while
+	an edit is being made */
+struct doseSchedule
+{
+	char name[TEMPLATE_NAME_LENGTH]; /*Empty unless the schedule is a template*/
+	int references; /*Cores using it, plus one while it is a template. Free when 0*/
+	int scheduledDoses;
+	struct dose doses[MAX_DOSES];
+};
+
+/* Consistent copy of the clock */
+struct clockTime
+{
+	unsigned int days;
+	int hours;
+	int mins;
+	int secs;
+	int millis; /*0-999, 0 where the time is only known to the second*/
+	long upTime; /*Seconds since start up, counted from the ticks and never set, the time base of the dose budget*/
+};
+
+/* Cumulative dose budget. Every delivery, scheduled or boost, is kept in a ring with its time and size in
+	half doses. Each window keeps the total inside it and the oldest delivery still counted, and moves past
+	deliveries as they age out, so a check only touches the entries which have just expired */
+struct budgetEntry
+{
+	long time; /*Seconds since start up*/
+	int units;
+};
+
+struct doseBudget
+{
+	struct budgetEntry ring[BUDGET_RING_SIZE];
+	int head;
+	int shortTail; /*Oldest delivery in each window*/
+	int longTail;
+	int shortUnits; /*Half doses in each window*/
+	int longUnits;
+};
+
+struct doseAction
+{
+	int type;
+	int index; /*Dose index, MAX_DOSES for a boost*/
+	int intensity;
+};
+
+struct doseCore
+{
+	const struct doseSchedule * schedule; /*Schedule in use, shared and read only unless it is the core's own*/
+	struct doseSchedule * pool; /*Schedules shared with other cores*/
+	int poolSize;
+	int status[MAX_DOSES]; /*Of each scheduled dose: 0 pending, 1 delivered, 2 withheld by the dose budget*/
+	struct clockTime deliveredAt[MAX_DOSES]; /*Clock when each delivered dose was delivered*/
+	struct clockTime boostTimes[MAX_BOOSTS]; /*Clock when each boost was delivered*/
+	int boostsGiven;
+	int boostIntensity; /*1 half dose, 0 full dose*/
+	int boostError;
+	int previousSwitchStatus;
+	int deliveryEvents;
+	long nextDoseTime; /*Seconds since midnight of the next pending dose today*/
+	int nextDoseIndex; /*Dose due at nextDoseTime, NO_DOSE if none*/
+	int scheduleChanged; /*Set when nextDoseTime must be worked out again*/
+	unsigned int scheduleDay; /*Day the dose statuses belong to*/
+	unsigned int scheduleVersion; /*Changes whenever a dose is added, changed, removed or changes status*/
+	int statusCount[3]; /*Doses pending, delivered and withheld, kept as statuses change*/
+	long lastBoostTime; /*Seconds since start up of the last boost, NO_BOOST if none*/
+	struct doseBudget budget;
+	int budgetWithheld;
+};
+
+/* Forecast of the deliveries over the coming days, worked out from each dose's start day and repeat and a copy
+	of the dose budget rather than by running the schedule a second at a time. The what if fields try out a
+	change without making it */
+struct forecastDelivery
+{
+	unsigned int day; /*Days since start up*/
+	long time; /*Seconds since midnight*/
+	int index; /*Dose index, MAX_DOSES for a boost. A dose being tried out has the index it would be added at*/
+	int intensity;
+	int withheld; /*1 if the dose budget would withhold it, or for a boost the boost limit or a stuck switch*/
+	int units; /*Half doses delivered from now up to and including this delivery*/
+};
+
+struct doseForecast
+{
+	int days; /*Days to look ahead, the rest of today being the first*/
+	const struct dose * extraDose; /*What if this dose was added, NULL for none*/
+	int boostIntensity; /*What if the boost switch was pressed now at this intensity, -1 for none*/
+	int delivered; /*Results*/
+	int withheld;
+	int units; /*Half doses delivered*/
+	int dayUnits[FORECAST_MAX_DAYS]; /*Half doses delivered by the end of each day, the cumulative dose curve*/
+};
+
+/* Function Prototypes*/
+void doseCorePoolInit(struct doseSchedule *, int);
+void doseCoreInit(struct doseCore *, struct doseSchedule *, int);
+void doseCoreReset(struct doseCore *);
+void doseCoreClearBudget(struct doseCore *);
+int doseCoreTick(struct doseCore *, struct clockTime *, int, struct doseAction *);
+int doseCoreSetDose(struct doseCore *, int, struct dose *);
+int doseCoreRemoveDose(struct doseCore *, int);
+void doseCoreClockChanged(struct doseCore *);
+void doseCoreBudgetUsed(struct doseCore *, struct clockTime *, int *, int *);
+int doseCorePulseDelay(int);
+long doseCoreSecondsOfDay(int, int, int);
+int doseCoreDueOnDay(const struct dose *, unsigned int);
+int doseCoreNextDose(struct doseCore *, struct clockTime *, long *);
+long doseCoreSinceBoost(struct doseCore *, struct clockTime *);
+int doseCoreSaveTemplate(struct doseCore *, const char *);
+int doseCoreUseTemplate(struct doseCore *, const char *);
+int doseCoreDeleteTemplate(struct doseCore *, const char *);
+int doseCoreForecast(const struct doseCore *, struct clockTime *, struct doseForecast *, void (*)(const struct forecastDelivery *, void *), void *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,304 @@
+/*	File Name: doseCore.hpp
+	Date: 18/10/2026
+	Purpose: C++ wrapper around the dosing core (doseCore.h), for host tools and tests which want typed times
+			 and exceptions rather than a struct and result codes. Cores made with a SchedulePool share its
+			 templates, other cores keep a schedule of their own. Core::forecast tries out changes without making
+			 them. Header only, link with doseCore.c
+	Required Headers: array, chrono, cstddef, stdexcept, utility, doseCore.h
+*/
+
+#ifndef DOSE_CORE_HPP
+#define DOSE_CORE_HPP
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+#include "doseCore.h"
+
+namespace dosing
+{
+	typedef std::chrono::duration<int, std::ratio<86400> > Days;
+
+	enum class Intensity
+	{
+		Full = 0,
+		Half = 1
+	};
+
+	/* Deliveries and alarms from one tick. Fixed size, so a tick never allocates */
+	class Actions
+	{
+	public:
+		Actions() : count(0) {}
+
+		std::size_t size() const { return count; }
+		bool empty() const { return count == 0; }
+		const doseAction & operator[](std::size_t i) const { return actions[i]; }
+		const doseAction * begin() const { return actions.data(); }
+		const doseAction * end() const { return actions.data() + count; }
+
+	private:
+		friend class Core;
+		std::array<doseAction, CORE_MAX_ACTIONS> actions;
+		std::size_t count;
+	};
+
+	/* Deliveries worked out by Core::forecast, in order. Fixed size, so a forecast never allocates */
+	class Forecast
+	{
+	public:
+		Forecast() : count(0) {}
+
+		std::size_t size() const { return count; }
+		bool empty() const { return count == 0; }
+		const forecastDelivery & operator[](std::size_t i) const { return deliveries[i]; }
+		const forecastDelivery * begin() const { return deliveries.data(); }
+		const forecastDelivery * end() const { return deliveries.data() + count; }
+
+		int delivered() const { return summary.delivered; }
+		int withheld() const { return summary.withheld; }
+		int units() const { return summary.units; } /*Half doses given*/
+
+		/* Half doses given by the end of the given day of the forecast, the first being today */
+		int unitsBy(Days day) const { return summary.dayUnits[day.count()]; }
+
+	private:
+		friend class Core;
+
+		static void add(const forecastDelivery * delivery, void * context)
+		{
+			Forecast * forecast = static_cast<Forecast *>(context);
+			forecast->deliveries[forecast->count++] = *delivery;
+		}
+
+		std::array<forecastDelivery, FORECAST_MAX_DAYS * (MAX_DOSES + 1) + 1> deliveries; /*Every dose every day and a boost*/
+		std::size_t count;
+		doseForecast summary;
+	};
+
+	/* Schedules shared by the cores made with it, enough for every template plus each patient whose
+		schedule differs from its template, and one free for the copy an edit is made to. Must outlive
+		the cores */
+	template<std::size_t Size> class SchedulePool
+	{
+	public:
+		SchedulePool() { doseCorePoolInit(schedules.data(), static_cast<int>(Size)); }
+
+		doseSchedule * data() { return schedules.data(); }
+		std::size_t size() const { return Size; }
+
+	private:
+		SchedulePool(const SchedulePool &);
+		SchedulePool & operator=(const SchedulePool &);
+		std::array<doseSchedule, Size> schedules;
+	};
+
+	class Core
+	{
+	public:
+		/* Holds delivery off for as long as it lives, as emergency mode does on the board */
+		class Suspend
+		{
+		public:
+			explicit Suspend(Core & core) : owner(core) { owner.suspended++; }
+			~Suspend() { owner.suspended--; }
+
+		private:
+			Suspend(const Suspend &);
+			Suspend & operator=(const Suspend &);
+			Core & owner;
+		};
+
+		Core() : suspended(0), clockMoved(0)
+		{
+			doseCorePoolInit(ownSchedule, 2);
+			doseCoreInit(&state, ownSchedule, 2);
+		}
+
+		template<std::size_t Size> explicit Core(SchedulePool<Size> & pool) : suspended(0), clockMoved(0)
+		{
+			doseCoreInit(&state, pool.data(), static_cast<int>(Size));
+		}
+
+		~Core() { doseCoreReset(&state); } /*Gives the schedule back to the pool*/
+
+		/* Runs one second of the schedule. sinceStartUp is the clock, boost the switch */
+		Actions tick(std::chrono::seconds sinceStartUp, bool boost)
+		{
+			Actions result;
+			clockTime now = toClock(sinceStartUp);
+
+			if(suspended == 0)
+			{
+				int count = doseCoreTick(&state, &now, boost ? 1 : 0, result.actions.data());
+				result.count = static_cast<std::size_t>(count);
+			}
+
+			return result;
+		}
+
+		/* Adds a dose at timeOfDay, first falling firstDay days after start up. Returns its index */
+		int addDose(std::chrono::seconds timeOfDay, Intensity intensity, Days repeat = Days(0), Days firstDay = Days(0))
+		{
+			return setDose(-1, timeOfDay, intensity, repeat, firstDay);
+		}
+
+		int replaceDose(int index, std::chrono::seconds timeOfDay, Intensity intensity, Days repeat = Days(0),
+			Days firstDay = Days(0))
+		{
+			return setDose(index, timeOfDay, intensity, repeat, firstDay);
+		}
+
+		void removeDose(int index)
+		{
+			check(doseCoreRemoveDose(&state, index));
+		}
+
+		/* Keeps the schedule as a template for other cores on the same pool, replacing any of that name */
+		void saveTemplate(const char * name) { check(doseCoreSaveTemplate(&state, name)); }
+
+		/* Shares a template's schedule, every dose pending, until this core edits it */
+		void useTemplate(const char * name) { check(doseCoreUseTemplate(&state, name)); }
+
+		void dropTemplate(const char * name) { check(doseCoreDeleteTemplate(&state, name)); }
+
+		/* The clock was set, moving it by moved. The dose budget keeps to the time since start up */
+		void clockChanged(std::chrono::seconds moved = std::chrono::seconds(0))
+		{
+			clockMoved += moved;
+			doseCoreClockChanged(&state);
+		}
+		void reset() { doseCoreReset(&state); }
+
+		int scheduledDoses() const { return state.schedule->scheduledDoses; }
+		const dose & operator[](int index) const { return state.schedule->doses[index]; }
+		int status(int index) const { return state.status[index]; }
+		const char * templateName() const { return state.schedule->name; }
+		int deliveries() const { return state.deliveryEvents; }
+		int boostsGiven() const { return state.boostsGiven; }
+		int withheld() const { return state.budgetWithheld; }
+
+		/* Deliveries over the coming days, the rest of today being the first. Nothing is changed */
+		Forecast forecast(std::chrono::seconds sinceStartUp, Days days) const
+		{
+			return makeForecast(sinceStartUp, days, NULL, -1);
+		}
+
+		/* As forecast, as if the boost switch was pressed now at intensity */
+		Forecast forecastWithBoost(std::chrono::seconds sinceStartUp, Days days, Intensity intensity) const
+		{
+			return makeForecast(sinceStartUp, days, NULL, static_cast<int>(intensity));
+		}
+
+		/* As forecast, as if the dose was added */
+		Forecast forecastWithDose(std::chrono::seconds sinceStartUp, Days days, std::chrono::seconds timeOfDay,
+			Intensity intensity, Days repeat = Days(0), Days firstDay = Days(0)) const
+		{
+			dose extraDose = toDose(timeOfDay, intensity, repeat, firstDay);
+			return makeForecast(sinceStartUp, days, &extraDose, -1);
+		}
+
+		/* Half doses counted in the 4 hour and 24 hour budget windows at now */
+		std::pair<int, int> budgetUsed(std::chrono::seconds sinceStartUp)
+		{
+			clockTime now = toClock(sinceStartUp);
+			int shortUnits = 0;
+			int longUnits = 0;
+
+			doseCoreBudgetUsed(&state, &now, &shortUnits, &longUnits);
+			return std::make_pair(shortUnits, longUnits);
+		}
+
+		/* The C structure, for code which shares it with the firmware */
+		doseCore & raw() { return state; }
+
+	private:
+		Core(const Core &);
+		Core & operator=(const Core &);
+
+		clockTime toClock(std::chrono::seconds sinceStartUp) const
+		{
+			long total = static_cast<long>(sinceStartUp.count());
+			clockTime now;
+
+			now.days = static_cast<unsigned int>(total / 86400L);
+			now.hours = static_cast<int>(total % 86400L / 3600L);
+			now.mins = static_cast<int>(total % 3600L / 60L);
+			now.secs = static_cast<int>(total % 60L);
+			now.millis = 0;
+			now.upTime = total - clockMoved.count();
+			return now;
+		}
+
+		static int check(int result)
+		{
+			switch(result)
+			{
+			case CORE_FULL:
+				throw std::length_error("dose schedule is full");
+			case CORE_INVALID_TIME:
+				throw std::invalid_argument("dose time must be within one day");
+			case CORE_INVALID_INTENSITY:
+				throw std::invalid_argument("dose intensity must be half or full");
+			case CORE_INVALID_REPEAT:
+				throw std::invalid_argument("dose repeat is out of range");
+			case CORE_INVALID_DOSE:
+				throw std::out_of_range("no such dose");
+			case CORE_NO_SCHEDULE:
+				throw std::length_error("schedule pool is full");
+			case CORE_NO_TEMPLATE:
+				throw std::out_of_range("no such template");
+			case CORE_INVALID_DAYS:
+				throw std::out_of_range("forecast is too long");
+			default:
+				return result;
+			}
+		}
+
+		static dose toDose(std::chrono::seconds timeOfDay, Intensity intensity, Days repeat, Days firstDay)
+		{
+			long secs = static_cast<long>(timeOfDay.count());
+			dose newDose;
+
+			if(secs < 0 || secs >= 86400L || firstDay.count() < 0)
+			{
+				throw std::invalid_argument("dose time must be within one day");
+			}
+
+			newDose.hours = static_cast<int>(secs / 3600L);
+			newDose.mins = static_cast<int>(secs % 3600L / 60L);
+			newDose.secs = static_cast<int>(secs % 60L);
+			newDose.intensity = static_cast<int>(intensity);
+			newDose.repeatDays = repeat.count();
+			newDose.startDay = static_cast<unsigned int>(firstDay.count());
+			return newDose;
+		}
+
+		int setDose(int index, std::chrono::seconds timeOfDay, Intensity intensity, Days repeat, Days firstDay)
+		{
+			dose newDose = toDose(timeOfDay, intensity, repeat, firstDay);
+			return check(doseCoreSetDose(&state, index, &newDose));
+		}
+
+		Forecast makeForecast(std::chrono::seconds sinceStartUp, Days days, const dose * extraDose, int boostIntensity) const
+		{
+			Forecast result;
+			clockTime now = toClock(sinceStartUp);
+
+			result.summary.days = days.count();
+			result.summary.extraDose = extraDose;
+			result.summary.boostIntensity = boostIntensity;
+			check(doseCoreForecast(&state, &now, &result.summary, Forecast::add, &result));
+			return result;
+		}
+
+		doseCore state;
+		doseSchedule ownSchedule[2]; /*Pool of a core made without one, its schedule and the copy an edit is made to*/
+		int suspended;
+		std::chrono::seconds clockMoved; /*Total the clock has been set forward, less back, so sinceStartUp less this is the time since start up*/
+	};
+}
+
+#endif
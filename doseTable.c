@@ -0,0 +1,322 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include "doseCore.h"
+#include "doseTable.h"
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DOSE_TABLE_X86
+#include <immintrin.h>
+#endif
+
+/*	File Name: doseTable.c
+	Date: 18/10/2026
+	Purpose: Struct of arrays dose table, see doseTable.h. The SSE2 and AVX2 kernels are compiled for their
+			 instruction set whatever the build flags, and doseTableMatch uses the widest the processor has
+	Required Headers: stdlib.h, stdint.h, doseCore.h, doseTable.h (immintrin.h on x86)
+*/
+
+#define DOSE_TABLE_ALIGN 32 /*Bytes in an AVX2 vector*/
+#define DOSE_TABLE_LANES 8 /*Keys in an AVX2 vector, capacity is a multiple of this*/
+
+/* Global Variable Declarations*/
+int doseTableSelected = -1; /*Kernel doseTableMatch uses, chosen on first use*/
+const char * doseTableKernelNames[DOSE_TABLE_KERNELS] = {"scalar", "SSE2", "AVX2"};
+
+/* Function Prototypes*/
+int doseTableMatchScalar(const struct doseTable *, uint32_t, int *);
+#ifdef DOSE_TABLE_X86
+int doseTableMatchSse2(const struct doseTable *, uint32_t, int *) __attribute__((target("sse2")));
+int doseTableMatchAvx2(const struct doseTable *, uint32_t, int *) __attribute__((target("avx2")));
+#endif
+
+
+/* Function Name: doseTableInit
+	Purpose: Allocates an empty table
+	Params: (struct doseTable *) table - Table to set up
+			(int) capacity - Most doses it will hold
+	Returns: (int) 1 if it was allocated, 0 otherwise
+*/
+int doseTableInit(struct doseTable * table, int capacity)
+{
+	void * due = NULL;
+	int i;
+
+	capacity = ((capacity > 0) ? capacity + DOSE_TABLE_LANES - 1 : DOSE_TABLE_LANES) / DOSE_TABLE_LANES * DOSE_TABLE_LANES;
+	table->count = 0;
+	table->capacity = capacity;
+	table->repeatDays = malloc((size_t) capacity * sizeof(uint16_t));
+	table->flags = malloc((size_t) capacity);
+
+	if(posix_memalign(&due, DOSE_TABLE_ALIGN, (size_t) capacity * sizeof(uint32_t)) != 0)
+	{
+		due = NULL;
+	}
+
+	table->due = due;
+
+	if(table->due == NULL || table->repeatDays == NULL || table->flags == NULL)
+	{
+		doseTableFree(table);
+		return 0;
+	}
+
+	for(i = 0; i < capacity; i++)
+	{
+		table->due[i] = DOSE_TABLE_NEVER; /*Padding never matches*/
+	}
+
+	return 1;
+}
+
+/* Function Name: doseTableFree
+	Purpose: Frees a table's arrays
+	Params: (struct doseTable *) table - Table to free
+	Returns: (void)
+*/
+void doseTableFree(struct doseTable * table)
+{
+	free(table->due);
+	free(table->repeatDays);
+	free(table->flags);
+	table->due = NULL;
+	table->repeatDays = NULL;
+	table->flags = NULL;
+	table->count = 0;
+	table->capacity = 0;
+}
+
+/* Function Name: doseTableAdd
+	Purpose: Adds a dose, working out its first delivery at or after a time
+	Params: (struct doseTable *) table - Table to add to
+			(const struct dose *) added - Dose, startDay is days since start up
+			(uint32_t) from - DOSE_TABLE_KEY of the earliest delivery to count, deliveries before it are past
+	Returns: (int) Index of the dose, -1 if the table is full
+*/
+int doseTableAdd(struct doseTable * table, const struct dose * added, uint32_t from)
+{
+	unsigned long fromDay = from >> 17;
+	long secs = doseCoreSecondsOfDay(added->hours, added->mins, added->secs);
+	unsigned long day = added->startDay;
+	int index = table->count;
+
+	if(index >= table->capacity)
+	{
+		return -1;
+	}
+
+	if(day < fromDay && added->repeatDays > 0)
+	{
+		day = fromDay + (added->repeatDays - (fromDay - day) % added->repeatDays) % added->repeatDays;
+	}
+
+	if(day == fromDay && (uint32_t) secs < (from & 0x1FFFF))
+	{
+		day += (added->repeatDays > 0) ? (unsigned long) added->repeatDays : DOSE_TABLE_MAX_DAY + 1; /*Single doses have passed*/
+	}
+
+	table->due[index] = (day < fromDay || day > DOSE_TABLE_MAX_DAY) ? DOSE_TABLE_NEVER : DOSE_TABLE_KEY(day, secs);
+	table->repeatDays[index] = (uint16_t) added->repeatDays;
+	table->flags[index] = (added->intensity == 1) ? DOSE_TABLE_HALF : 0;
+	table->count++;
+
+	return index;
+}
+
+/* Function Name: doseTableAdvance
+	Purpose: Moves a dose on to its next delivery, once the one it was due for has been made
+	Params: (struct doseTable *) table - Table to update
+			(int) index - Dose
+	Returns: (void)
+*/
+void doseTableAdvance(struct doseTable * table, int index)
+{
+	unsigned long day = (table->due[index] >> 17) + table->repeatDays[index];
+
+	if(table->repeatDays[index] == 0 || day > DOSE_TABLE_MAX_DAY)
+	{
+		table->due[index] = DOSE_TABLE_NEVER;
+	}
+	else
+	{
+		table->due[index] = DOSE_TABLE_KEY(day, table->due[index] & 0x1FFFF);
+	}
+}
+
+/* Function Name: doseTableMatch
+	Purpose: Finds the doses due at a time, with the widest kernel the processor supports
+	Params: (const struct doseTable *) table - Table to search
+			(uint32_t) now - DOSE_TABLE_KEY of the time
+			(int *) matches - Receives the index of each dose due, in order. Room for the table's count
+	Returns: (int) Number of doses due
+*/
+int doseTableMatch(const struct doseTable * table, uint32_t now, int * matches)
+{
+	return doseTableMatchWith(doseTableKernel(), table, now, matches);
+}
+
+/* Function Name: doseTableMatchWith
+	Purpose: Finds the doses due at a time with a given kernel, so the kernels can be compared
+	Params: (int) kernel - DOSE_TABLE_ kernel, scalar is used if the processor does not support it
+			(const struct doseTable *) table - Table to search
+			(uint32_t) now - DOSE_TABLE_KEY of the time
+			(int *) matches - Receives the index of each dose due, in order
+	Returns: (int) Number of doses due
+*/
+int doseTableMatchWith(int kernel, const struct doseTable * table, uint32_t now, int * matches)
+{
+#ifdef DOSE_TABLE_X86
+	if(kernel == DOSE_TABLE_AVX2 && doseTableKernel() == DOSE_TABLE_AVX2)
+	{
+		return doseTableMatchAvx2(table, now, matches);
+	}
+
+	if(kernel != DOSE_TABLE_SCALAR && doseTableKernel() >= DOSE_TABLE_SSE2) /*An i386 processor may not have SSE2*/
+	{
+		return doseTableMatchSse2(table, now, matches);
+	}
+#endif
+
+	return doseTableMatchScalar(table, now, matches);
+}
+
+/* Function Name: doseTableKernel
+	Purpose: Picks the widest kernel the processor supports, the first time it is called
+	Params: none
+	Returns: (int) DOSE_TABLE_ kernel
+*/
+int doseTableKernel()
+{
+	if(doseTableSelected < 0)
+	{
+		doseTableSelected = DOSE_TABLE_SCALAR;
+#ifdef DOSE_TABLE_X86
+		__builtin_cpu_init();
+		doseTableSelected = __builtin_cpu_supports("avx2") ? DOSE_TABLE_AVX2 : __builtin_cpu_supports("sse2") ? DOSE_TABLE_SSE2 : DOSE_TABLE_SCALAR;
+#endif
+	}
+
+	return doseTableSelected;
+}
+
+/* Function Name: doseTableKernelName
+	Purpose: Names a kernel, for reports
+	Params: (int) kernel - DOSE_TABLE_ kernel
+	Returns: (const char *) Name
+*/
+const char * doseTableKernelName(int kernel)
+{
+	return doseTableKernelNames[kernel];
+}
+
+/* Function Name: doseTableMatchScalar
+	Purpose: Finds the doses due at a time a key at a time
+	Params: (const struct doseTable *) table - Table to search
+			(uint32_t) now - DOSE_TABLE_KEY of the time
+			(int *) matches - Receives the index of each dose due
+	Returns: (int) Number of doses due
+*/
+int doseTableMatchScalar(const struct doseTable * table, uint32_t now, int * matches)
+{
+	int count = 0;
+	int i;
+
+	for(i = 0; i < table->count; i++)
+	{
+		if(table->due[i] == now)
+		{
+			matches[count++] = i;
+		}
+	}
+
+	return count;
+}
+
+#ifdef DOSE_TABLE_X86
+/* Function Name: doseTableMatchSse2
+	Purpose: Finds the doses due at a time, comparing 4 keys an instruction
+	Params: (const struct doseTable *) table - Table to search
+			(uint32_t) now - DOSE_TABLE_KEY of the time
+			(int *) matches - Receives the index of each dose due
+	Returns: (int) Number of doses due
+*/
+int doseTableMatchSse2(const struct doseTable * table, uint32_t now, int * matches)
+{
+	__m128i key = _mm_set1_epi32((int) now);
+	__m128i equal;
+	int count = 0;
+	int mask;
+	int i;
+
+	for(i = 0; i < table->count; i += 8)
+	{
+		/*Two vectors a step, most steps have no match and cost one test*/
+		equal = _mm_or_si128(_mm_cmpeq_epi32(_mm_load_si128((const __m128i *) (table->due + i)), key),
+			_mm_cmpeq_epi32(_mm_load_si128((const __m128i *) (table->due + i + 4)), key));
+
+		if(_mm_movemask_epi8(equal) == 0)
+		{
+			continue;
+		}
+
+		mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_load_si128((const __m128i *) (table->due + i)), key)))
+			| (_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_load_si128((const __m128i *) (table->due + i + 4)), key))) << 4);
+
+		while(mask != 0)
+		{
+			matches[count++] = i + __builtin_ctz((unsigned int) mask);
+			mask &= mask - 1;
+		}
+	}
+
+	return count;
+}
+
+/* Function Name: doseTableMatchAvx2
+	Purpose: Finds the doses due at a time, comparing 8 keys an instruction
+	Params: (const struct doseTable *) table - Table to search
+			(uint32_t) now - DOSE_TABLE_KEY of the time
+			(int *) matches - Receives the index of each dose due
+	Returns: (int) Number of doses due
+*/
+int doseTableMatchAvx2(const struct doseTable * table, uint32_t now, int * matches)
+{
+	__m256i key = _mm256_set1_epi32((int) now);
+	__m256i equal;
+	int count = 0;
+	int mask;
+	int i = 0;
+
+	/*Two vectors a step while there are two left, as in the SSE2 kernel*/
+	for(; i + 16 <= table->capacity && i < table->count; i += 16)
+	{
+		equal = _mm256_or_si256(_mm256_cmpeq_epi32(_mm256_load_si256((const __m256i *) (table->due + i)), key),
+			_mm256_cmpeq_epi32(_mm256_load_si256((const __m256i *) (table->due + i + 8)), key));
+
+		if(_mm256_testz_si256(equal, equal))
+		{
+			continue;
+		}
+
+		mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_load_si256((const __m256i *) (table->due + i)), key)))
+			| (_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_load_si256((const __m256i *) (table->due + i + 8)), key))) << 8);
+
+		while(mask != 0)
+		{
+			matches[count++] = i + __builtin_ctz((unsigned int) mask);
+			mask &= mask - 1;
+		}
+	}
+
+	for(; i < table->count; i += 8)
+	{
+		mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_load_si256((const __m256i *) (table->due + i)), key)));
+
+		while(mask != 0)
+		{
+			matches[count++] = i + __builtin_ctz((unsigned int) mask);
+			mask &= mask - 1;
+		}
+	}
+
+	return count;
+}
+#endif
@@ -0,0 +1,52 @@
+/*	File Name: doseTable.h
+	Date: 18/10/2026
+	Purpose: Struct of arrays dose table for host tools which check thousands of doses at once, such as a ward
+			 of patients or a bulk check of generated schedules. Each dose's next delivery is packed into one 32
+			 bit key of day and second, so finding the doses due at a time is a compare of every key against
+			 one value, done 4 or 8 at a time with SSE2 or AVX2 where the host has them. The board keeps the
+			 struct dose schedule in doseCore.c. Host only, link with doseCore.c
+	Required Headers: stdint.h, doseCore.h
+*/
+
+#ifndef DOSE_TABLE_H
+#define DOSE_TABLE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DOSE_TABLE_KEY(day, secs) (((uint32_t) (day) << 17) | (uint32_t) (secs)) /*A day has fewer than 2^17 seconds*/
+#define DOSE_TABLE_NEVER 0xFFFFFFFFUL /*Key of a dose with no delivery left*/
+#define DOSE_TABLE_MAX_DAY 0x7FFE /*Last day a key can hold*/
+#define DOSE_TABLE_HALF 0x01 /*flags - half dose*/
+#define DOSE_TABLE_SCALAR 0 /*Kernels*/
+#define DOSE_TABLE_SSE2 1
+#define DOSE_TABLE_AVX2 2
+#define DOSE_TABLE_KERNELS 3
+
+/* Structure Declarations*/
+/* Arrays are 32 byte aligned and padded to a whole number of AVX2 vectors with keys that never match */
+struct doseTable
+{
+	uint32_t * due; /*DOSE_TABLE_KEY of each dose's next delivery, DOSE_TABLE_NEVER if it has none*/
+	uint16_t * repeatDays; /*0 for a single dose*/
+	uint8_t * flags;
+	int count;
+	int capacity;
+};
+
+/* Function Prototypes*/
+int doseTableInit(struct doseTable *, int);
+void doseTableFree(struct doseTable *);
+int doseTableAdd(struct doseTable *, const struct dose *, uint32_t);
+void doseTableAdvance(struct doseTable *, int);
+int doseTableMatch(const struct doseTable *, uint32_t, int *);
+int doseTableMatchWith(int, const struct doseTable *, uint32_t, int *);
+int doseTableKernel(void);
+const char * doseTableKernelName(int);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
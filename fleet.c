@@ -0,0 +1,615 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "fleet.h"
+#include "doseCore.h"
+
+/*	File Name: fleet.c
+	Date: 18/10/2026
+	Purpose: Fleet simulator for the native build. Generates dosing regimens and patients on them with boost
+			 presses, runs every patient's dosing core a second at a time for days of virtual time, then
+			 summarises the doses expected and delivered, boosts, withheld deliveries and motor turns across the
+			 fleet. Each patient is a struct doseCore of its own, so every patient runs in the one process. The
+			 regimens are templates in a schedule pool shared by every core: a patient uses their regimen's
+			 template, and a patient with a dose added to it is given a copy of their own. One worker thread per
+			 core hands out patients from a work stealing pool: every worker owns a range of patient numbers and
+			 takes from the front of it, and a worker that runs out steals the back half of the largest
+			 remaining range. The pool is only changed while the fleet is set up, so the workers only read it
+	Usage: scheduleDose -fleet instances [-workers n] [-days n] [-seed n]
+			-workers - Worker threads (default one per online processor)
+			-days - Virtual days to run each patient for (default 2, at most FLEET_MAX_DAYS)
+			-seed - Seed for the generated patients, a fleet is repeatable for the same seed and size
+	Required Headers: stdio.h, stdlib.h, string.h, time.h, unistd.h, pthread.h, fleet.h, doseCore.h
+*/
+
+#define FLEET_MAX_WORKERS 256
+#define FLEET_MAX_DAYS 7 /*Longest run a patient is simulated for*/
+#define FLEET_REGIMENS 16 /*Templates the patients are shared between*/
+#define FLEET_OWN_DOSE 4 /*One patient in this many has a dose of their own added to their regimen*/
+#define FLEET_MAX_REPEAT 3
+#define FLEET_MAX_PRESSES 6
+#define FLEET_FIRST_SLOT 60 /*Doses go in ten minute slots from 10:00...*/
+#define FLEET_SLOTS 84 /*...to 23:50*/
+#define FLEET_START_HOURS 8 /*Clock is set to 08:00:00*/
+#define FLEET_END_MARGIN 3600L /*Runs stop an hour before the clock reaches 08:00 on the last day*/
+#define FLEET_SECS_PER_DAY 86400L
+
+/* Structure Declarations*/
+struct fleetQueue /*Patients owned by a worker. The next and end numbers share one word so a thief can split the
+					range with a single compare and swap. Padded to its own cache line*/
+{
+	volatile unsigned long long range;
+	int stolen;
+	char padding[64 - sizeof(unsigned long long) - sizeof(int)];
+};
+
+struct fleetPatient /*One simulated patient, only written by the worker running them once the fleet is set up*/
+{
+	struct doseCore core;
+	long presses[FLEET_MAX_PRESSES]; /*Seconds into the run the boost switch is pressed, in order*/
+	int boostPresses;
+	int expectedDoses;
+	int halfTurns; /*Deliveries the motor turned to each dose position for*/
+	int fullTurns;
+	int worker;
+	int completed;
+};
+
+/* Global Variable Declarations*/
+struct fleetQueue * fleetQueues = NULL;
+struct fleetPatient * fleetPatients = NULL;
+struct doseSchedule * fleetPool = NULL;
+int fleetPoolSize = 0;
+int fleetWorkers = 0;
+int fleetDays = 0;
+
+/* Function Prototypes*/
+void * fleetWorker(void *);
+int fleetTake(int);
+int fleetSteal(int);
+int fleetSetUp(int, unsigned long);
+int fleetRegimen(struct doseCore *, int, unsigned long);
+int fleetPatientSetUp(struct fleetPatient *, int, unsigned long);
+void fleetRunPatient(struct fleetPatient *);
+unsigned long fleetRandom(unsigned long *);
+void fleetReport(int, double);
+
+
+/* Function Name: simFleet
+	Purpose: Runs a fleet of generated patients on all the workers and prints the summary
+	Params: (int) instances - Number of patients
+			(int) workers - Worker threads, 0 for one per online processor
+			(int) days - Virtual days to run each patient for
+			(unsigned long) seed - Seed for the generated patients
+	Returns: (int) 0 if every patient ran to the end, 1 otherwise
+*/
+int simFleet(int instances, int workers, int days, unsigned long seed)
+{
+	pthread_t threads[FLEET_MAX_WORKERS];
+	struct timespec start, end;
+	unsigned long long first, last;
+	int worker;
+	int started;
+	int failed = 0;
+
+	if(workers <= 0)
+	{
+		workers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	}
+
+	if(workers > FLEET_MAX_WORKERS)
+	{
+		workers = FLEET_MAX_WORKERS;
+	}
+
+	if(workers > instances)
+	{
+		workers = instances;
+	}
+
+	if(days < 1 || days > FLEET_MAX_DAYS)
+	{
+		fprintf(stderr, "Days should only be 1-%d\n", FLEET_MAX_DAYS);
+		return 1;
+	}
+
+	/*A schedule per regimen and per patient with a dose of their own, and one free for each edit*/
+	fleetPoolSize = FLEET_REGIMENS + instances + 1;
+	fleetPool = (struct doseSchedule *) malloc(sizeof(struct doseSchedule) * fleetPoolSize);
+	fleetPatients = (struct fleetPatient *) calloc(instances, sizeof(struct fleetPatient));
+
+	if(fleetPool == NULL || fleetPatients == NULL
+		|| posix_memalign((void **) &fleetQueues, 64, sizeof(struct fleetQueue) * workers) != 0)
+	{
+		perror("fleet");
+		return 1;
+	}
+
+	fleetWorkers = workers;
+	fleetDays = days;
+
+	if(fleetSetUp(instances, seed))
+	{
+		fprintf(stderr, "The schedule pool is full\n");
+		return 1;
+	}
+
+	for(worker = 0; worker < workers; worker++)
+	{
+		first = (unsigned long long) instances * worker / workers;
+		last = (unsigned long long) instances * (worker + 1) / workers;
+		fleetQueues[worker].range = first | (last << 32);
+		fleetQueues[worker].stolen = 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/*A worker which can not be started leaves its range to be stolen by the others*/
+	for(started = 0; started < workers; started++)
+	{
+		if(pthread_create(&threads[started], NULL, fleetWorker, &fleetQueues[started]) != 0)
+		{
+			perror("pthread_create");
+			break;
+		}
+	}
+
+	if(started == 0)
+	{
+		fleetWorker(&fleetQueues[0]);
+	}
+
+	for(worker = 0; worker < started; worker++)
+	{
+		pthread_join(threads[worker], NULL);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	fleetReport(instances, (double) (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+	for(worker = 0; worker < instances; worker++)
+	{
+		if(fleetPatients[worker].completed == 0)
+		{
+			failed = 1;
+		}
+	}
+
+	free(fleetQueues);
+	free(fleetPatients);
+	free(fleetPool);
+
+	return failed;
+}
+
+/* Function Name: fleetWorker
+	Purpose: Runs patients from the worker's own range until it is empty, then steals from the others until
+			 every range is empty
+	Params: (void *) queue - The worker's own queue
+	Returns: (void *) NULL
+*/
+void * fleetWorker(void * queue)
+{
+	int worker = (int) ((struct fleetQueue *) queue - fleetQueues);
+	int index;
+
+	for(;;)
+	{
+		index = fleetTake(worker);
+
+		if(index < 0)
+		{
+			index = fleetSteal(worker);
+		}
+
+		if(index < 0)
+		{
+			return NULL;
+		}
+
+		fleetPatients[index].worker = worker;
+		fleetRunPatient(&fleetPatients[index]);
+	}
+}
+
+/* Function Name: fleetTake
+	Purpose: Takes the next patient from the front of the worker's own range
+	Params: (int) worker - Worker number
+	Returns: (int) Patient number, -1 if the range is empty
+*/
+int fleetTake(int worker)
+{
+	unsigned long long range;
+	unsigned long long next, end;
+
+	for(;;)
+	{
+		range = __atomic_load_n(&fleetQueues[worker].range, __ATOMIC_ACQUIRE);
+		next = range & 0xFFFFFFFFULL;
+		end = range >> 32;
+
+		if(next >= end)
+		{
+			return -1;
+		}
+
+		if(__sync_bool_compare_and_swap(&fleetQueues[worker].range, range, (next + 1) | (end << 32)))
+		{
+			return (int) next;
+		}
+	}
+}
+
+/* Function Name: fleetSteal
+	Purpose: Moves the back half of the largest remaining range to the worker's own (empty) range and takes the
+			 first patient of it
+	Params: (int) worker - Worker number
+	Returns: (int) Patient number, -1 if every range is empty
+*/
+int fleetSteal(int worker)
+{
+	unsigned long long range, own;
+	unsigned long long next, end, split;
+	unsigned long long largest;
+	int victim;
+	int i;
+
+	for(;;)
+	{
+		victim = -1;
+		largest = 0;
+
+		for(i = 0; i < fleetWorkers; i++)
+		{
+			range = __atomic_load_n(&fleetQueues[i].range, __ATOMIC_ACQUIRE);
+			next = range & 0xFFFFFFFFULL;
+			end = range >> 32;
+
+			if(i != worker && end > next && end - next > largest)
+			{
+				largest = end - next;
+				victim = i;
+			}
+		}
+
+		if(victim < 0)
+		{
+			return -1;
+		}
+
+		range = __atomic_load_n(&fleetQueues[victim].range, __ATOMIC_ACQUIRE);
+		next = range & 0xFFFFFFFFULL;
+		end = range >> 32;
+
+		if(next >= end)
+		{
+			continue;
+		}
+
+		split = end - (end - next + 1) / 2;
+
+		if(__sync_bool_compare_and_swap(&fleetQueues[victim].range, range, next | (split << 32)))
+		{
+			/*Nobody steals from an empty range, so the worker's own range only changes here*/
+			own = __atomic_load_n(&fleetQueues[worker].range, __ATOMIC_ACQUIRE);
+			__sync_bool_compare_and_swap(&fleetQueues[worker].range, own, (split + 1) | (end << 32));
+			fleetQueues[worker].stolen++;
+
+			return (int) split;
+		}
+	}
+}
+
+/* Function Name: fleetSetUp
+	Purpose: Saves every regimen as a template in the shared pool, then starts every patient's core on one
+	Params: (int) instances - Number of patients
+			(unsigned long) seed - Seed for the generated regimens and patients
+	Returns: (int) 0, or 1 if the pool ran out of schedules
+*/
+int fleetSetUp(int instances, unsigned long seed)
+{
+	struct doseCore builder;
+	char name[TEMPLATE_NAME_LENGTH];
+	int regimen;
+	int index;
+
+	doseCorePoolInit(fleetPool, fleetPoolSize);
+	doseCoreInit(&builder, fleetPool, fleetPoolSize);
+
+	for(regimen = 0; regimen < FLEET_REGIMENS; regimen++)
+	{
+		sprintf(name, "regimen-%d", regimen);
+
+		if(fleetRegimen(&builder, regimen, seed) || doseCoreSaveTemplate(&builder, name) != CORE_OK)
+		{
+			return 1;
+		}
+
+		doseCoreReset(&builder); /*The template keeps the schedule*/
+	}
+
+	for(index = 0; index < instances; index++)
+	{
+		if(fleetPatientSetUp(&fleetPatients[index], index, seed))
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Function Name: fleetRegimen
+	Purpose: Schedules a regimen on a core: up to MAX_DOSES - 1 doses, leaving room for a patient's own, in
+			 distinct ten minute slots in the first half of the slot, with random repeats and start days
+	Params: (struct doseCore *) builder - Core with an empty schedule
+			(int) regimen - Regimen number
+			(unsigned long) seed - Seed for the generated regimens
+	Returns: (int) 0, or 1 if the pool ran out of schedules
+*/
+int fleetRegimen(struct doseCore * builder, int regimen, unsigned long seed)
+{
+	unsigned long state = ~(seed * 1000003UL + (unsigned long) regimen);
+	int slots[FLEET_SLOTS];
+	struct dose added;
+	long doseSecs;
+	int doses;
+	int i, slot, swap;
+
+	for(i = 0; i < FLEET_SLOTS; i++)
+	{
+		slots[i] = i;
+	}
+
+	doses = 1 + (int) (fleetRandom(&state) % (MAX_DOSES - 1));
+
+	for(i = 0; i < doses; i++)
+	{
+		slot = i + (int) (fleetRandom(&state) % (FLEET_SLOTS - i));
+		swap = slots[i];
+		slots[i] = slots[slot];
+		slots[slot] = swap;
+
+		doseSecs = (FLEET_FIRST_SLOT + slots[i]) * 600L + (long) (fleetRandom(&state) % 300);
+		added.hours = (int) (doseSecs / 3600);
+		added.mins = (int) ((doseSecs / 60) % 60);
+		added.secs = (int) (doseSecs % 60);
+		added.intensity = (int) (fleetRandom(&state) & 1);
+		added.repeatDays = (int) (fleetRandom(&state) % (FLEET_MAX_REPEAT + 1));
+		added.startDay = (unsigned int) (fleetRandom(&state) % 2);
+
+		if(doseCoreSetDose(builder, -1, &added) < 0)
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Function Name: fleetPatientSetUp
+	Purpose: Starts a patient's core on a regimen, with their boost intensity, some boost presses and, for some
+			 patients, a dose of their own in the second half of a ten minute slot. Counts the scheduled doses
+			 which fall due before the end of the run
+	Params: (struct fleetPatient *) patient - Patient to set up
+			(int) index - Patient number
+			(unsigned long) seed - Seed for the generated patients
+	Returns: (int) 0, or 1 if the pool ran out of schedules
+*/
+int fleetPatientSetUp(struct fleetPatient * patient, int index, unsigned long seed)
+{
+	unsigned long state = seed * 1000003UL + (unsigned long) index;
+	char name[TEMPLATE_NAME_LENGTH];
+	struct dose added;
+	long doseSecs, endSecs, press;
+	unsigned int day;
+	int i, j;
+
+	doseCoreInit(&patient->core, fleetPool, fleetPoolSize);
+	sprintf(name, "regimen-%d", (int) (fleetRandom(&state) % FLEET_REGIMENS));
+	doseCoreUseTemplate(&patient->core, name);
+	patient->core.boostIntensity = (int) (fleetRandom(&state) & 1);
+
+	if(fleetRandom(&state) % FLEET_OWN_DOSE == 0)
+	{
+		doseSecs = (FLEET_FIRST_SLOT + (long) (fleetRandom(&state) % FLEET_SLOTS)) * 600L + 300L + (long) (fleetRandom(&state) % 300);
+		added.hours = (int) (doseSecs / 3600);
+		added.mins = (int) ((doseSecs / 60) % 60);
+		added.secs = (int) (doseSecs % 60);
+		added.intensity = (int) (fleetRandom(&state) & 1);
+		added.repeatDays = (int) (fleetRandom(&state) % (FLEET_MAX_REPEAT + 1));
+		added.startDay = (unsigned int) (fleetRandom(&state) % 2);
+
+		if(doseCoreSetDose(&patient->core, -1, &added) < 0)
+		{
+			return 1;
+		}
+	}
+
+	patient->expectedDoses = 0;
+
+	for(i = 0; i < patient->core.schedule->scheduledDoses; i++)
+	{
+		for(day = 0; day < (unsigned int) fleetDays; day++)
+		{
+			patient->expectedDoses += doseCoreDueOnDay(&patient->core.schedule->doses[i], day);
+		}
+	}
+
+	/*Presses are kept in order, so the run only looks at the next one*/
+	endSecs = fleetDays * FLEET_SECS_PER_DAY - FLEET_END_MARGIN;
+	patient->boostPresses = (int) (fleetRandom(&state) % (FLEET_MAX_PRESSES + 1));
+
+	for(i = 0; i < patient->boostPresses; i++)
+	{
+		press = FLEET_END_MARGIN + (long) (fleetRandom(&state) % (unsigned long) (endSecs - 2 * FLEET_END_MARGIN));
+
+		for(j = i; j > 0 && patient->presses[j - 1] > press; j--)
+		{
+			patient->presses[j] = patient->presses[j - 1];
+		}
+
+		patient->presses[j] = press;
+	}
+
+	return 0;
+}
+
+/* Function Name: fleetRunPatient
+	Purpose: Ticks a patient's core once a virtual second from 08:00:00 on the first day to the end of the run,
+			 pressing the boost switch for the second of each press, and counts the motor turns it asks for
+	Params: (struct fleetPatient *) patient - Patient to run
+	Returns: (void)
+*/
+void fleetRunPatient(struct fleetPatient * patient)
+{
+	struct doseAction actions[CORE_MAX_ACTIONS];
+	struct clockTime now;
+	long endSecs = fleetDays * FLEET_SECS_PER_DAY - FLEET_END_MARGIN;
+	int press = 0;
+	int count;
+	int i;
+
+	now.days = 0;
+	now.hours = FLEET_START_HOURS;
+	now.mins = 0;
+	now.secs = 0;
+	now.millis = 0;
+
+	for(now.upTime = 0; now.upTime < endSecs; now.upTime++)
+	{
+		count = doseCoreTick(&patient->core, &now, press < patient->boostPresses && patient->presses[press] == now.upTime, actions);
+
+		while(press < patient->boostPresses && patient->presses[press] <= now.upTime)
+		{
+			press++;
+		}
+
+		for(i = 0; i < count; i++)
+		{
+			if(actions[i].type == CORE_DELIVER_DOSE || actions[i].type == CORE_DELIVER_BOOST)
+			{
+				if(doseCorePulseDelay(actions[i].intensity) == PULSE_HALF_DOSE)
+				{
+					patient->halfTurns++;
+				}
+				else
+				{
+					patient->fullTurns++;
+				}
+			}
+		}
+
+		if(++now.secs == 60)
+		{
+			now.secs = 0;
+
+			if(++now.mins == 60)
+			{
+				now.mins = 0;
+
+				if(++now.hours == 24)
+				{
+					now.hours = 0;
+					now.days++;
+				}
+			}
+		}
+	}
+
+	patient->completed = 1;
+}
+
+/* Function Name: fleetRandom
+	Purpose: Linear congruential generator, each patient has its own state so a fleet is repeatable
+	Params: (unsigned long *) state - Generator state
+	Returns: (unsigned long) Random number 0-32767
+*/
+unsigned long fleetRandom(unsigned long * state)
+{
+	*state = *state * 1103515245UL + 12345UL;
+
+	return (*state >> 16) & 0x7FFF;
+}
+
+/* Function Name: fleetReport
+	Purpose: Prints the summary of the fleet
+	Params: (int) instances - Number of patients
+			(double) wallSeconds - Wall time taken
+	Returns: (void)
+*/
+void fleetReport(int instances, double wallSeconds)
+{
+	struct fleetPatient * patient;
+	long expected = 0, delivered = 0, presses = 0, boosts = 0, withheld = 0, halfTurns = 0, fullTurns = 0;
+	long missed, shortPatients = 0;
+	int perWorker[FLEET_MAX_WORKERS];
+	int completed = 0;
+	int sharing = 0;
+	int schedules = 0;
+	int shown = 0;
+	int i;
+
+	memset(perWorker, 0, sizeof(perWorker));
+
+	for(i = 0; i < fleetPoolSize; i++)
+	{
+		schedules += (fleetPool[i].references != 0);
+	}
+
+	for(i = 0; i < instances; i++)
+	{
+		patient = &fleetPatients[i];
+
+		if(patient->completed == 0)
+		{
+			continue;
+		}
+
+		completed++;
+		perWorker[patient->worker]++;
+		sharing += (patient->core.schedule->name[0] != '\0');
+		expected += patient->expectedDoses;
+		delivered += patient->core.deliveryEvents - patient->core.boostsGiven;
+		presses += patient->boostPresses;
+		boosts += patient->core.boostsGiven;
+		withheld += patient->core.budgetWithheld;
+		halfTurns += patient->halfTurns;
+		fullTurns += patient->fullTurns;
+
+		missed = patient->expectedDoses - (patient->core.deliveryEvents - patient->core.boostsGiven);
+
+		if(missed != 0)
+		{
+			shortPatients++;
+
+			if(shown++ < 5)
+			{
+				fprintf(stderr, "Patient %d: %d doses expected, %d delivered, %d deliveries withheld\n", i, patient->expectedDoses,
+					patient->core.deliveryEvents - patient->core.boostsGiven, patient->core.budgetWithheld);
+			}
+		}
+	}
+
+	fprintf(stderr, "\nFleet of %d patients over %d days on %d workers: %d completed in %.2fs, %.1f patients/s, %.0f virtual days/s\n",
+		instances, fleetDays, fleetWorkers, completed, wallSeconds, completed / wallSeconds,
+		completed * (fleetDays - (double) FLEET_END_MARGIN / FLEET_SECS_PER_DAY) / wallSeconds);
+	fprintf(stderr, "Doses: %ld expected, %ld delivered, %ld patients differ\n", expected, delivered, shortPatients);
+	fprintf(stderr, "Dose budget: %ld doses and boosts withheld\n", withheld);
+	fprintf(stderr, "Boosts: %ld presses, %ld given\n", presses, boosts);
+	fprintf(stderr, "Motor: %ld turns to the half dose position, %ld to the full dose position\n", halfTurns, fullTurns);
+	fprintf(stderr, "Schedules: %d patients on %d shared regimens, %d with their own, %d schedules (%lu bytes) in the pool\n",
+		sharing, FLEET_REGIMENS, completed - sharing, schedules, (unsigned long) (schedules * sizeof(struct doseSchedule)));
+	fprintf(stderr, "Patients per worker (ranges stolen):");
+
+	for(i = 0; i < fleetWorkers; i++)
+	{
+		fprintf(stderr, " %d (%d)", perWorker[i], fleetQueues[i].stolen);
+	}
+
+	fprintf(stderr, "\n");
+}
@@ -0,0 +1,13 @@
+/*	File Name: fleet.h
+	Date: 18/10/2026
+	Purpose: Declarations shared between the native simulator (simulator.c) and the fleet driver (fleet.c)
+	Required Headers: none
+*/
+
+#ifndef FLEET_H
+#define FLEET_H
+
+/* Fleet driver, started from the simulator's command line */
+int simFleet(int, int, int, unsigned long);
+
+#endif
@@ -0,0 +1,755 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+
+/*	File Name: hostMonitor.c
+	Date: 18/10/2026
+	Purpose: Linux daemon which follows the telemetry stream of many drug delivery units at once. Units are either
+			 serial devices given by path or native builds of scheduleDose started on pseudo-terminals, and are
+			 all serviced from a single epoll loop. Keeps the latest schedule, delivery and alarm state of
+			 every unit and prints a ward summary at a fixed interval.
+	Build: gcc -O2 -o hostMonitor hostMonitor.c
+	Usage: hostMonitor [-report secs] [-configure] [device ...] [-spawn count command [args ...]]
+			-report - Seconds between ward summaries (default 5)
+			-configure - Type the initial clock and patient set up into each unit when it connects
+			-spawn - Start count copies of command, each on its own pseudo-terminal, e.g.
+					 hostMonitor -configure -spawn 200 ./scheduleDose -telemetry 1
+	Required Headers: stdio.h, stdlib.h, string.h, errno.h, fcntl.h, signal.h, time.h, unistd.h, termios.h,
+					  sys/epoll.h, sys/wait.h
+*/
+
+#define MAX_DOSES 10
+#define TELEMETRY_FLAG 0x7E
+#define TELEMETRY_ESCAPE 0x7D
+#define FRAME_MAX 64
+#define LATENCY_WINDOW 16
+#define READ_SIZE 4096
+#define MAX_EVENTS 64
+
+/* Structure Declarations*/
+struct unit
+{
+	int fd;
+	pid_t pid;
+	char name[64];
+	int number;
+	int connected;
+	int configured;
+
+	/* Frame decoder */
+	unsigned char frame[FRAME_MAX];
+	int frameLength;
+	int escaped;
+	int overflow;
+
+	/* Aggregated state, as last reported by the unit */
+	int haveKeyframe;
+	long clock;
+	int nextDoseIndex;
+	long nextDoseTime;
+	int deliveryCount;
+	int lastDelivery;
+	int boostsGiven;
+	int flags;
+	int pulseDelay;
+	int doseCount;
+	long doseTimes[MAX_DOSES];
+	int doseFlags[MAX_DOSES];
+
+	/* Statistics */
+	unsigned long bytes;
+	unsigned long frames;
+	unsigned long badFrames;
+	unsigned long deliveries;
+	unsigned long alarms;
+	double offsets[LATENCY_WINDOW];
+	int offsetCount;
+	double latencySum;
+	double latencyMax;
+	unsigned long latencySamples;
+};
+
+/* Global Variable Declarations*/
+struct unit *units = NULL;
+int unitCount = 0;
+int unitCapacity = 0;
+int configureUnits = 0;
+volatile sig_atomic_t stopRequested = 0;
+
+/* Function Prototypes*/
+int main(int, char **);
+void stopSignal(int);
+double hostSeconds(void);
+struct unit *addUnit(const char *);
+int openDevice(struct unit *, const char *);
+int spawnUnit(struct unit *, char **);
+void configureUnit(struct unit *);
+void closeUnit(struct unit *, int);
+void readUnit(struct unit *, int);
+void decodeByte(struct unit *, unsigned char, double);
+void decodeFrame(struct unit *, double);
+void decodeSchedule(struct unit *, unsigned char *, int);
+void recordLatency(struct unit *, double);
+void printReport(void);
+
+/* Function Name: main
+	Purpose: Opens or spawns every unit and services them until interrupted
+	Params: (int) argc - Number of arguments
+			(char **) argv - Argument strings
+	Returns: (int) 0 on success, 1 on error
+*/
+int main(int argc, char ** argv)
+{
+	int epollFd;
+	int i;
+	int j;
+	int count;
+	int spawnCount = 0;
+	char **spawnCommand = NULL;
+	double reportInterval = 5.0;
+	double nextReport;
+	double now;
+	struct epoll_event event;
+	struct epoll_event events[MAX_EVENTS];
+	struct unit *newUnit;
+	char name[64];
+
+	signal(SIGINT, stopSignal);
+	signal(SIGTERM, stopSignal);
+	signal(SIGPIPE, SIG_IGN);
+
+	epollFd = epoll_create1(0);
+
+	if(epollFd < 0)
+	{
+		perror("epoll_create1");
+		return 1;
+	}
+
+	for(i = 1; i < argc; i++)
+	{
+		if(strcmp(argv[i], "-report") == 0 && i + 1 < argc)
+		{
+			reportInterval = atof(argv[++i]);
+		}
+		else if(strcmp(argv[i], "-configure") == 0)
+		{
+			configureUnits = 1;
+		}
+		else if(strcmp(argv[i], "-spawn") == 0 && i + 2 < argc)
+		{
+			spawnCount = atoi(argv[i + 1]);
+			spawnCommand = &argv[i + 2];
+			break;
+		}
+		else if(argv[i][0] == '-')
+		{
+			fprintf(stderr, "Usage: %s [-report secs] [-configure] [device ...] [-spawn count command [args ...]]\n", argv[0]);
+			return 1;
+		}
+		else
+		{
+			newUnit = addUnit(argv[i]);
+
+			if(openDevice(newUnit, argv[i]) != 0)
+			{
+				return 1;
+			}
+		}
+	}
+
+	for(i = 0; i < spawnCount; i++)
+	{
+		snprintf(name, sizeof(name), "unit%03d", i + 1);
+		newUnit = addUnit(name);
+
+		if(spawnUnit(newUnit, spawnCommand) != 0)
+		{
+			return 1;
+		}
+	}
+
+	if(unitCount == 0)
+	{
+		fprintf(stderr, "No units to monitor\n");
+		return 1;
+	}
+
+	for(i = 0; i < unitCount; i++)
+	{
+		event.events = EPOLLIN;
+		event.data.u32 = (unsigned int) i;
+
+		if(epoll_ctl(epollFd, EPOLL_CTL_ADD, units[i].fd, &event) != 0)
+		{
+			perror("epoll_ctl");
+			return 1;
+		}
+	}
+
+	nextReport = hostSeconds() + reportInterval;
+
+	while(stopRequested == 0)
+	{
+		now = hostSeconds();
+		count = epoll_wait(epollFd, events, MAX_EVENTS, nextReport > now ? (int) ((nextReport - now) * 1000.0) + 1 : 0);
+
+		if(count < 0 && errno != EINTR)
+		{
+			perror("epoll_wait");
+			break;
+		}
+
+		for(j = 0; j < count; j++)
+		{
+			readUnit(&units[events[j].data.u32], epollFd);
+		}
+
+		if(hostSeconds() >= nextReport)
+		{
+			printReport();
+			nextReport += reportInterval;
+		}
+	}
+
+	for(i = 0; i < unitCount; i++)
+	{
+		closeUnit(&units[i], epollFd);
+	}
+
+	printReport();
+
+	return 0;
+}
+
+/* Function Name: stopSignal
+	Purpose: Requests a clean shutdown
+	Params: (int) signalNumber - Signal received
+	Returns: (void)
+*/
+void stopSignal(int signalNumber)
+{
+	(void) signalNumber;
+
+	stopRequested = 1;
+}
+
+/* Function Name: hostSeconds
+	Purpose: Reads the host monotonic clock
+	Params: none
+	Returns: (double) Seconds since an arbitrary fixed point
+*/
+double hostSeconds()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+/* Function Name: addUnit
+	Purpose: Adds an empty unit to the unit table
+	Params: (const char *) name - Name used in reports
+	Returns: (struct unit *) Pointer to the new unit
+*/
+struct unit *addUnit(const char * name)
+{
+	struct unit *newUnit;
+
+	if(unitCount == unitCapacity)
+	{
+		unitCapacity = unitCapacity ? unitCapacity * 2 : 16;
+		units = realloc(units, sizeof(struct unit) * unitCapacity);
+
+		if(units == NULL)
+		{
+			perror("realloc");
+			exit(1);
+		}
+	}
+
+	newUnit = &units[unitCount++];
+	memset(newUnit, 0, sizeof(struct unit));
+	strncpy(newUnit->name, name, sizeof(newUnit->name) - 1);
+	newUnit->fd = -1;
+	newUnit->number = unitCount;
+	newUnit->nextDoseIndex = 0xFF;
+
+	return newUnit;
+}
+
+/* Function Name: openDevice
+	Purpose: Opens an existing serial device or pseudo-terminal in raw, non-blocking mode
+	Params: (struct unit *) target - Unit to attach the device to
+			(const char *) path - Device path
+	Returns: (int) 0 on success, -1 on failure
+*/
+int openDevice(struct unit * target, const char * path)
+{
+	struct termios settings;
+
+	target->fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+	if(target->fd < 0)
+	{
+		perror(path);
+		return -1;
+	}
+
+	if(tcgetattr(target->fd, &settings) == 0)
+	{
+		cfmakeraw(&settings);
+		tcsetattr(target->fd, TCSANOW, &settings);
+	}
+
+	target->connected = 1;
+
+	return 0;
+}
+
+/* Function Name: spawnUnit
+	Purpose: Starts a unit on a new pseudo-terminal. The unit's side is raw so the binary frames pass unaltered
+	Params: (struct unit *) target - Unit to attach the pseudo-terminal to
+			(char **) command - Command and arguments, terminated by NULL
+	Returns: (int) 0 on success, -1 on failure
+*/
+int spawnUnit(struct unit * target, char ** command)
+{
+	int slaveFd;
+	struct termios settings;
+
+	target->fd = posix_openpt(O_RDWR | O_NOCTTY);
+
+	if(target->fd < 0 || grantpt(target->fd) != 0 || unlockpt(target->fd) != 0)
+	{
+		perror("posix_openpt");
+		return -1;
+	}
+
+	target->pid = fork();
+
+	if(target->pid < 0)
+	{
+		perror("fork");
+		return -1;
+	}
+
+	if(target->pid == 0)
+	{
+		setsid();
+		slaveFd = open(ptsname(target->fd), O_RDWR);
+
+		if(slaveFd < 0)
+		{
+			_exit(127);
+		}
+
+		if(tcgetattr(slaveFd, &settings) == 0)
+		{
+			cfmakeraw(&settings);
+			tcsetattr(slaveFd, TCSANOW, &settings);
+		}
+
+		dup2(slaveFd, STDIN_FILENO);
+		dup2(slaveFd, STDOUT_FILENO);
+		close(slaveFd);
+		close(target->fd);
+		execvp(command[0], command);
+		_exit(127);
+	}
+
+	fcntl(target->fd, F_SETFL, fcntl(target->fd, F_GETFL) | O_NONBLOCK);
+	target->connected = 1;
+
+	return 0;
+}
+
+/* Function Name: configureUnit
+	Purpose: Answers the initial configuration prompts with the host's time of day and a generated patient.
+			 Sent once the unit has printed something, so a spawned unit is known to have its terminal open
+	Params: (struct unit *) target - Unit to configure
+	Returns: (void)
+*/
+void configureUnit(struct unit * target)
+{
+	char script[128];
+	time_t wallClock;
+	struct tm *localClock;
+	int length;
+
+	wallClock = time(NULL);
+	localClock = localtime(&wallClock);
+	length = snprintf(script, sizeof(script), "%02d\r%02d\r%02d\rUnit\r%d\r%d\rb\r",
+		localClock->tm_hour, localClock->tm_min, localClock->tm_sec, target->number, target->number);
+	target->configured = 1;
+
+	if(write(target->fd, script, (size_t) length) != length)
+	{
+		fprintf(stderr, "%s: configuration was not fully sent\n", target->name);
+	}
+}
+
+/* Function Name: closeUnit
+	Purpose: Stops following a unit, stopping it as well if it was spawned
+	Params: (struct unit *) target - Unit to close
+			(int) epollFd - Epoll instance the unit is registered with
+	Returns: (void)
+*/
+void closeUnit(struct unit * target, int epollFd)
+{
+	if(target->fd >= 0)
+	{
+		epoll_ctl(epollFd, EPOLL_CTL_DEL, target->fd, NULL);
+		close(target->fd);
+		target->fd = -1;
+	}
+
+	if(target->pid > 0)
+	{
+		kill(target->pid, SIGTERM);
+		waitpid(target->pid, NULL, 0);
+		target->pid = 0;
+	}
+
+	target->connected = 0;
+}
+
+/* Function Name: readUnit
+	Purpose: Reads everything waiting on a unit and feeds it through the frame decoder
+	Params: (struct unit *) target - Unit which is readable
+			(int) epollFd - Epoll instance the unit is registered with
+	Returns: (void)
+*/
+void readUnit(struct unit * target, int epollFd)
+{
+	unsigned char buffer[READ_SIZE];
+	ssize_t length;
+	ssize_t i;
+	double now;
+
+	for(;;)
+	{
+		length = read(target->fd, buffer, sizeof(buffer));
+
+		if(length > 0)
+		{
+			now = hostSeconds();
+			target->bytes += (unsigned long) length;
+
+			for(i = 0; i < length; i++)
+			{
+				decodeByte(target, buffer[i], now);
+			}
+
+			if(configureUnits && target->configured == 0)
+			{
+				configureUnit(target);
+			}
+		}
+		else if(length < 0 && (errno == EAGAIN || errno == EINTR))
+		{
+			return;
+		}
+		else
+		{
+			printf("%s: disconnected\n", target->name);
+			closeUnit(target, epollFd);
+			return;
+		}
+	}
+}
+
+/* Function Name: decodeByte
+	Purpose: Collects the bytes between two frame flags, removing the byte stuffing. Terminal text between
+			 frames is collected as well and is thrown away when its checksum fails
+	Params: (struct unit *) target - Unit the byte came from
+			(unsigned char) value - Byte received
+			(double) now - Host time the byte was received
+	Returns: (void)
+*/
+void decodeByte(struct unit * target, unsigned char value, double now)
+{
+	if(value == TELEMETRY_FLAG)
+	{
+		if(target->frameLength > 0 && target->overflow == 0 && target->escaped == 0)
+		{
+			decodeFrame(target, now);
+		}
+
+		target->frameLength = 0;
+		target->escaped = 0;
+		target->overflow = 0;
+		return;
+	}
+
+	if(value == TELEMETRY_ESCAPE)
+	{
+		target->escaped = 1;
+		return;
+	}
+
+	if(target->escaped)
+	{
+		value ^= 0x20;
+		target->escaped = 0;
+	}
+
+	if(target->frameLength == FRAME_MAX)
+	{
+		target->overflow = 1;
+		return;
+	}
+
+	target->frame[target->frameLength++] = value;
+}
+
+/* Function Name: decodeFrame
+	Purpose: Checks a complete frame and applies it to the unit's state, reporting deliveries and alarms
+	Params: (struct unit *) target - Unit the frame came from
+			(double) now - Host time the frame was received
+	Returns: (void)
+*/
+void decodeFrame(struct unit * target, double now)
+{
+	unsigned char *frame = target->frame;
+	unsigned char checksum = 0;
+	unsigned char mask;
+	int position = 2;
+	int needed = 3;
+	int i;
+	long clockDelta;
+	int previousCount;
+	int previousFlags;
+
+	for(i = 0; i < target->frameLength; i++)
+	{
+		checksum += frame[i];
+	}
+
+	if(checksum != 0 || target->frameLength < 3)
+	{
+		if(target->frameLength < FRAME_MAX && (frame[0] == 'K' || frame[0] == 'D' || frame[0] == 'S'))
+		{
+			target->badFrames++;
+		}
+
+		return;
+	}
+
+	if(frame[0] == 'S')
+	{
+		decodeSchedule(target, frame, target->frameLength);
+		return;
+	}
+
+	if((frame[0] != 'K' && frame[0] != 'D') || (frame[0] == 'D' && target->haveKeyframe == 0))
+	{
+		return;
+	}
+
+	mask = frame[1];
+	needed += (mask & 0x01) ? 3 : 1;
+	needed += (mask & 0x02) ? 4 : 0;
+	needed += (mask & 0x04) ? 2 : 0;
+	needed += (mask & 0x08) ? 1 : 0;
+	needed += (mask & 0x10) ? 1 : 0;
+	needed += (mask & 0x20) ? 2 : 0;
+
+	if(needed != target->frameLength)
+	{
+		target->badFrames++;
+		return;
+	}
+
+	target->frames++;
+	previousCount = target->deliveryCount;
+	previousFlags = target->flags;
+
+	if(mask & 0x01)
+	{
+		target->clock = ((long) frame[position] << 16) | ((long) frame[position + 1] << 8) | frame[position + 2];
+		position += 3;
+	}
+	else
+	{
+		clockDelta = frame[position++];
+		target->clock = (target->clock + clockDelta) % 86400L;
+	}
+
+	if(mask & 0x02)
+	{
+		target->nextDoseIndex = frame[position];
+		target->nextDoseTime = ((long) frame[position + 1] << 16) | ((long) frame[position + 2] << 8) | frame[position + 3];
+		position += 4;
+	}
+
+	if(mask & 0x04)
+	{
+		target->deliveryCount = frame[position];
+		target->lastDelivery = frame[position + 1];
+		position += 2;
+	}
+
+	if(mask & 0x08)
+	{
+		target->boostsGiven = frame[position++];
+	}
+
+	if(mask & 0x10)
+	{
+		target->flags = frame[position++];
+	}
+
+	if(mask & 0x20)
+	{
+		target->pulseDelay = (frame[position] << 8) | frame[position + 1];
+		position += 2;
+	}
+
+	if(target->haveKeyframe && target->deliveryCount != previousCount)
+	{
+		target->deliveries += (unsigned long) ((target->deliveryCount - previousCount) & 0xFF);
+		printf("%s: %02ld:%02ld:%02ld %s delivered\n", target->name, target->clock / 3600, (target->clock / 60) % 60,
+			target->clock % 60, target->lastDelivery == MAX_DOSES + 1 ? "boost" : "dose");
+	}
+
+	if(target->haveKeyframe && (target->flags & ~previousFlags & 0x0B))
+	{
+		target->alarms++;
+		printf("%s: %02ld:%02ld:%02ld alarm - %s\n", target->name, target->clock / 3600, (target->clock / 60) % 60,
+			target->clock % 60, (target->flags & ~previousFlags & 0x01) ? "boost switch stuck"
+			: ((target->flags & ~previousFlags & 0x02) ? "delivery suspended" : "dose budget reached"));
+	}
+
+	target->haveKeyframe = 1;
+	recordLatency(target, now);
+}
+
+/* Function Name: decodeSchedule
+	Purpose: Replaces the unit's copy of its schedule from a schedule frame
+	Params: (struct unit *) target - Unit the frame came from
+			(unsigned char *) frame - Frame contents
+			(int) length - Length of the frame
+	Returns: (void)
+*/
+void decodeSchedule(struct unit * target, unsigned char * frame, int length)
+{
+	int i;
+	int count = frame[1];
+
+	if(count > MAX_DOSES || length != 3 + count * 4)
+	{
+		target->badFrames++;
+		return;
+	}
+
+	for(i = 0; i < count; i++)
+	{
+		target->doseTimes[i] = ((long) frame[2 + i * 4] << 16) | ((long) frame[3 + i * 4] << 8) | frame[4 + i * 4];
+		target->doseFlags[i] = frame[5 + i * 4];
+	}
+
+	target->doseCount = count;
+}
+
+/* Function Name: recordLatency
+	Purpose: Estimates how long after the unit's clock ticked over the frame was seen. The offset between host and
+			 unit clock is compared with the smallest offset in a short window, which follows clock drift
+			 and leaves the transport and scheduling delay. Resolution is limited by the unit's one second clock
+	Params: (struct unit *) target - Unit the frame came from
+			(double) now - Host time the frame was received
+	Returns: (void)
+*/
+void recordLatency(struct unit * target, double now)
+{
+	double offset = now - (double) target->clock;
+	double baseline = offset;
+	double latency;
+	int i;
+	int window;
+
+	target->offsets[target->offsetCount % LATENCY_WINDOW] = offset;
+	target->offsetCount++;
+	window = target->offsetCount < LATENCY_WINDOW ? target->offsetCount : LATENCY_WINDOW;
+
+	for(i = 0; i < window; i++)
+	{
+		if(target->offsets[i] < baseline)
+		{
+			baseline = target->offsets[i];
+		}
+	}
+
+	latency = offset - baseline;
+
+	if(latency > 1.0)
+	{
+		target->offsetCount = 0; /*Unit clock was set, start again*/
+		return;
+	}
+
+	target->latencySum += latency;
+	target->latencySamples++;
+
+	if(latency > target->latencyMax)
+	{
+		target->latencyMax = latency;
+	}
+}
+
+/* Function Name: printReport
+	Purpose: Prints the aggregated state of every unit
+	Params: none
+	Returns: (void)
+*/
+void printReport()
+{
+	int i;
+	int j;
+	int delivered;
+	struct unit *current;
+	char nextDose[24];
+
+	printf("\n%-10s %-5s %-8s %-7s %-8s %-6s %-12s %8s %6s %9s %9s\n", "Unit", "Link", "Clock", "Doses",
+		"Next", "Boosts", "Alarms", "Frames", "Bad", "Lat avg", "Lat max");
+
+	for(i = 0; i < unitCount; i++)
+	{
+		current = &units[i];
+		delivered = 0;
+
+		for(j = 0; j < current->doseCount; j++)
+		{
+			delivered += current->doseFlags[j] & 0x01;
+		}
+
+		if(current->nextDoseIndex == 0xFF)
+		{
+			strcpy(nextDose, "-");
+		}
+		else
+		{
+			snprintf(nextDose, sizeof(nextDose), "%02ld:%02ld", current->nextDoseTime / 3600, (current->nextDoseTime / 60) % 60);
+		}
+
+		printf("%-10s %-5s %02ld:%02ld:%02ld %d/%-5d %-8s %-6d %-12s %8lu %6lu %7.1fms %7.1fms\n", current->name,
+			current->connected ? "up" : "down", current->clock / 3600, (current->clock / 60) % 60, current->clock % 60,
+			delivered, current->doseCount, nextDose, current->boostsGiven,
+			(current->flags & 0x01) ? "BOOST-STUCK" : ((current->flags & 0x02) ? "SUSPENDED" : ((current->flags & 0x08) ? "BUDGET" : "-")),
+			current->frames, current->badFrames,
+			current->latencySamples ? current->latencySum * 1000.0 / current->latencySamples : 0.0,
+			current->latencyMax * 1000.0);
+	}
+
+	fflush(stdout);
+}
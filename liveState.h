@@ -0,0 +1,65 @@
+/*	File Name: liveState.h
+	Date: 18/10/2026
+	Purpose: Layout of the live state the native simulator publishes in POSIX shared memory (-share name),
+			 for dashboards and other readers on the same host. Only fixed width fields are used so the
+			 region can be read from any language.
+	Required Headers: stdint.h
+	Publishing: The region holds two snapshots. The simulator fills the one not named by latest, bumping that
+			 snapshot's sequence to an odd number before it starts and back to even when it is done, and then
+			 points latest at it. Nothing ever waits on a reader and readers never write.
+	Reading: Map the region read only and check magic, layoutVersion and size. Then:
+			 1. index = latest, s1 = snapshots[index].sequence, retry if s1 is odd
+			 2. read the fields wanted straight from snapshots[index]
+			 3. s2 = snapshots[index].sequence, the fields are consistent if s2 == s1, otherwise retry
+			 Use acquire loads (or a read barrier) after step 1 and before step 3.
+*/
+
+#ifndef LIVE_STATE_H
+#define LIVE_STATE_H
+
+#include <stdint.h>
+
+#define LIVE_STATE_MAGIC 0x534C4453UL /*"SDLS" in memory on a little endian host*/
+#define LIVE_STATE_VERSION 1
+#define LIVE_STATE_DOSES 10 /*MAX_DOSES when the layout was fixed*/
+
+/* Structure Declarations*/
+struct liveDose
+{
+	int32_t time; /*Seconds since midnight*/
+	int32_t status; /*0 pending, 1 delivered, 2 withheld by the dose budget*/
+	int32_t intensity; /*1 half dose, 0 full dose*/
+	int32_t repeatDays; /*0 for a single dose*/
+	uint32_t startDay;
+};
+
+struct liveSnapshot
+{
+	volatile uint32_t sequence; /*Odd while the snapshot is being written*/
+	uint32_t flags; /*0x01 running, 0x02 delivery suspended, 0x04 boost switch stuck, 0x08 motor running*/
+	uint64_t cycles; /*Virtual E clock cycles since reset*/
+	uint32_t days; /*Clock, days since start up*/
+	int32_t clock; /*Clock, seconds since midnight*/
+	int32_t scheduledDoses;
+	int32_t nextDoseIndex; /*-1 if no dose is due later today, as of the last schedule check*/
+	int32_t nextDoseTime;
+	int32_t statusCount[3]; /*Doses pending, delivered and withheld*/
+	int32_t deliveryEvents;
+	int32_t budgetWithheld;
+	int32_t boostsGiven;
+	int32_t boostIntensity;
+	int32_t sinceBoost; /*Seconds since the last boost, -1 if none*/
+	int32_t pulseDelay; /*Motor position, E clock cycles*/
+	struct liveDose doses[LIVE_STATE_DOSES];
+};
+
+struct liveState
+{
+	uint32_t magic;
+	uint32_t layoutVersion;
+	uint32_t size; /*sizeof(struct liveState)*/
+	volatile uint32_t latest; /*Index of the snapshot published last*/
+	struct liveSnapshot snapshots[2];
+};
+
+#endif
@@ -1,24 +1,196 @@
 #include <stdio.h> 
 #include <stdlib.h>
-#define MAX_DOSES 10
-#define MAX_BOOSTS 3
+#include <string.h>
+#include "doseCore.h"
+#define TELEMETRY_FLAG 0x7E
+#define TELEMETRY_ESCAPE 0x7D
+#define TELEMETRY_KEYFRAME_SECS 60
+#define RX_BUFFER_SIZE 16 /*Must be a power of two*/
+#define LANE_ALARM 0 /*Transmit lanes, highest priority first*/
+#define LANE_TELEMETRY 1
+#define LANE_UI 2
+#define SERIAL_LANES 3
+#define LANE_ALARM_SIZE 64 /*Lane sizes must be powers of two*/
+#define LANE_TELEMETRY_SIZE 128
+#define LANE_UI_SIZE 256
+#define LANE_ALARM_BUDGET 32 /*Bytes a lane may send each real time interrupt ahead of the lanes below it,*/
+#define LANE_TELEMETRY_BUDGET 8 /*at 9600 baud a tick is about 31 bytes*/
+#define LANE_UI_BUDGET 24
+#define TELEMETRY_MAX_BYTES (2 + 2 * 17 + 2 + 2 * (3 + 4 * MAX_DOSES)) /*A record and a schedule frame, every byte escaped*/
+#define BATTERY_CAPACITY_MAH 2000L
+#define RUN_CURRENT_UA 15000L /*Processor running at a 2MHz E clock*/
+#define WAIT_CURRENT_UA 6000L /*Processor in WAI with the timer and SCI still running*/
+#define MOTOR_CURRENT_UA 250000L /*Servo while it is moving*/
+#define MOTOR_SECS_PER_DELIVERY 1L
+#define SERVO_PERIOD 40000U /*20 ms servo frame, in E clock cycles*/
+#define SERVO_PERIODS_PER_DELIVERY 50 /*Frames the motor is held at the dose position, MOTOR_SECS_PER_DELIVERY*/
+#define CLOCK_UNITS_PER_SECOND 15625U /*The clock counts in units of 128 E clock cycles (64 us)*/
+#define CLOCK_UNITS_PER_TICK 512U /*One real time interrupt, 65536 E clock cycles*/
+#define CLOCK_CYCLES_PER_UNIT 128U
+#define SERIAL_STAMP() (tickCount * CLOCK_UNITS_PER_TICK + (unsigned int) (TCNT - tickTcnt) / CLOCK_CYCLES_PER_UNIT)
+#define COMMAND_LENGTH 32
+#define COMMAND_MAX_VALUES 7
+#define COMMAND_COUNT ((int) (sizeof(commands) / sizeof(commands[0])))
+#define SCHEDULE_TEMPLATES 2 /*Named schedules kept for the next patient*/
+#define SCHEDULE_POOL_SIZE (SCHEDULE_TEMPLATES + 2) /*Two more for the patient's own edited schedule and the copy an edit is made to*/
+#define EEPROM_SIZE 512 /*$B600-$B7FF on the 68HC11E9*/
+#define EEPROM_ROW_SIZE 16 /*Bytes cleared by a row erase*/
+#define EEPROM_PROGRAM_CYCLES 20000U /*10 ms for each erase or program at a 2MHz E clock*/
+#define JOURNAL_RECORD_SIZE 8 /*Must divide EEPROM_ROW_SIZE*/
+#define JOURNAL_SLOTS (EEPROM_SIZE / JOURNAL_RECORD_SIZE)
+#define JOURNAL_POWER_ON 1
+#define JOURNAL_DOSE 2
+#define JOURNAL_BOOST 3
+#define JOURNAL_WITHHELD 4
+#define JOURNAL_BOOST_STUCK 5
+#define JOURNAL_EMERGENCY 6
 
 /*	File Name: scheduleDose.c
 	Date: 22/02/2020
 	Author: Sophie Shufflebotham
 	Purpose: Program for the 68HC11 microcontroller to simulate a drug delivery system by turning a motor to deliver a dose.
-	Required Headers: stdio.h, stdlib.h
+	Required Headers: stdio.h, stdlib.h, string.h, doseCore.h (simulator.h when built natively with -DSIMULATOR)
+	Build: Link with doseCore.c, which holds the schedule, boost and dose budget logic
 */
 
+/* Native Build
+	When SIMULATOR is defined the program is built for the host, with simulator.c providing the registers,
+	interrupts and serial port. The SIM_ hooks mark the points where the hardware has side effects on a
+	register access which plain memory cannot reproduce, and compile to nothing on the microcontroller.
+	WAIT_FOR_INTERRUPT stops the processor until the next interrupt; the simulator uses it to advance time.
+	SIM_EEPROM_PROGRAM starts an EEPROM erase or program cycle, which the simulator carries out on its own copy.
+	SIM_SERIAL_TRANSMIT follows enabling the transmit interrupt, which the SCI raises at once if it is idle.
+	SIM_COMPARE_WRITTEN follows writing an output compare outside its interrupt, so the new match is scheduled.
+	SIM_TIMELINE_BEGIN and SIM_TIMELINE_END mark spans of work for the simulator's trace export.
+*/
+#ifdef SIMULATOR
+#include "simulator.h"
+#define main firmwareMain /*The simulator provides the process entry point*/
+#else
+#define INTERRUPT @interrupt
+#define REGISTER(offset) ((unsigned char*)(offset))
+#define WAIT_FOR_INTERRUPT() _asm("wai\n")
+#define DISABLE_INTERRUPTS() _asm("sei\n")
+#define ENABLE_INTERRUPTS() _asm("cli\n")
+#define SIM_SERIAL_READ()
+#define SIM_SERIAL_WRITE()
+#define SIM_SERIAL_TRANSMIT()
+#define SIM_CLOCK_LOAD()
+#define SIM_TIMELINE_BEGIN(event, value)
+#define SIM_TIMELINE_END(event)
+#define SIM_COMPARE_WRITTEN()
+#define SIM_EEPROM_PROGRAM(offset)
+#define EEPROM(offset) (*(volatile unsigned char*)(0xB600 + (offset)))
+#define serialPutchar putchar /*Replaces the library putchar, so everything printf writes is queued on the UI lane*/
+#endif
+
+/* Register Map
+	Each register is an lvalue at a fixed address, so an access compiles to a direct load or store with the
+	address in the instruction rather than first loading a pointer from RAM. REGISTER gives the address on
+	either build, so the simulator's registers drop in without any run time cost.
+*/
+#define REG8(offset) (*(volatile unsigned char*)REGISTER(offset))
+#define REG16(offset) (*(volatile unsigned int*)REGISTER(offset))
+#define PADR REG8(0x00)    /*Port A data: A0 boost switch, A2 emergency switch, A6 motor pulse, outputs drive the LEDs*/
+#define PADDR REG8(0x01)   /*Port A data direction*/
+#define OC1M REG8(0x0C)    /*Port A pins output compare 1 drives*/
+#define OC1D REG8(0x0D)    /*Levels output compare 1 drives them to*/
+#define TCNT REG16(0x0E)   /*Free running counter*/
+#define TOC1 REG16(0x16)   /*Output compare 1, rising edge of the motor pulse*/
+#define TOC2 REG16(0x18)   /*Output compare 2, falling edge of the motor pulse*/
+#define TCTL1 REG8(0x20)
+#define TMSK1 REG8(0x22)
+#define TFLG1 REG8(0x23)
+#define TMSK2 REG8(0x24)
+#define TFLG2 REG8(0x25)
+#define PACTL REG8(0x26)
+#define SCCR2 REG8(0x2D)
+#define SCSR REG8(0x2E)
+#define SCDR REG8(0x2F)
+#define PPROG REG8(0x3B)   /*EEPROM programming control*/
+
+/* Register bits */
+#define PADR_BOOST 0x01
+#define PADR_EMERGENCY 0x04
+#define PADR_PULSE 0x40   /*A6, the OC2 pin*/
+#define OC2_FLAG 0x40      /*TMSK1 enable and TFLG1 flag*/
+#define TCTL1_OC2_CLEAR 0x80 /*OC2 drives A6 low*/
+#define RTI_FLAG 0x40      /*TMSK2 enable and TFLG2 flag*/
+#define SCCR2_TIE 0x80     /*Transmit interrupt enable*/
+#define SCCR2_RIE 0x20     /*Receive interrupt enable*/
+#define SCSR_RDRF 0x20     /*Receive data register full*/
+#define SCSR_TDRE 0x80     /*Transmit data register empty*/
+#define PPROG_BYTE 0x10    /*Erase one byte*/
+#define PPROG_ROW 0x08     /*Erase one row, bulk erase when neither BYTE nor ROW is set*/
+#define PPROG_ERASE 0x04
+#define PPROG_EELAT 0x02   /*Latch address and data for programming*/
+#define PPROG_EPGM 0x01    /*Apply the programming voltage*/
+
 
 /* Structure Declarations*/
-struct dose
+/* Telemetry record - snapshot of the state reported to the host.
+	Frames are sent as: FLAG | type | mask | [clock delta] | fields... | checksum | FLAG
+	type - 'K' keyframe (every field present) or 'D' delta (only changed fields present)
+	mask - bit 0 clock (3 bytes, seconds since midnight), bit 1 next dose (index, 3 byte time),
+		   bit 2 delivery (event count, dose number), bit 3 boosts given, bit 4 state flags
+		   (0x01 boostError, 0x02 suspended, 0x04 motorRunning, 0x08 delivery withheld by the dose budget),
+		   bit 5 pulse delay (2 bytes)
+	Delta frames without bit 0 carry a single byte of seconds elapsed since the previous frame.
+	Bytes equal to FLAG or ESCAPE are sent as ESCAPE followed by the byte XOR 0x20.
+	The checksum makes the sum of type, mask, fields and checksum zero.
+	Whenever the schedule changes an 'S' frame follows: FLAG | 'S' | dose count | per dose (3 byte time,
+	flags 0x01 delivered 0x02 half intensity 0x04 withheld) | checksum | FLAG */
+struct telemetryRecord
+{
+	long clock;
+	int nextDoseIndex;
+	long nextDoseTime;
+	int deliveryCount;
+	int lastDelivery;
+	int boostsGiven;
+	int flags;
+	int pulseDelay;
+	unsigned char scheduleVersion;
+};
+
+/* Transmit lane - a queue of serial output with its own priority and bandwidth budget. The transmit interrupt
+	sends from the highest priority lane with budget left this tick or, if none has any left, the highest with
+	anything queued. An alarm goes out ahead of text queued before it, and no lane is starved by those above.
+	Telemetry frames and escape sequences are sent whole, so the line only changes lane between them. A lane
+	with nothing queued gives up the line, as a sequence cut short by a dropped redraw is never finished.
+	Queueing delay is timed from queueing to sending for the first byte queued while no byte of the lane is
+	being timed, in clock units of 64 us */
+struct serialLane
+{
+	unsigned char * buffer;
+	unsigned int mask; /*Size - 1*/
+	int budget; /*Bytes per tick*/
+	char * name;
+	volatile unsigned int head;
+	volatile unsigned int tail;
+	volatile int credit; /*Budget left this tick*/
+	volatile int frame; /*Part way through a telemetry frame (1), or an escape sequence (1 after ESC, 2 after ESC [)*/
+	volatile int timing; /*Set while the byte at timedPosition is being timed*/
+	unsigned int timedPosition;
+	unsigned long timedStamp;
+	unsigned long sent;
+	unsigned long dropped; /*Bytes of redraws cut short by a newer one*/
+	unsigned long deferred; /*Clock lines or telemetry records held over until the lane had room*/
+	unsigned long delays; /*Bytes timed*/
+	unsigned long delayTotal;
+	unsigned long delayMax;
+};
+
+/* One line operator command. The pattern has a letter per argument: t a time hh:mm:ss or hh:mm (three values),
+	n a number, i an intensity of 50 or 100 (1 or 0, as in struct dose) and w a word, which is copied to
+	commandName. Arguments after the required ones may be left off and are passed as 0 */
+struct command
 {
-	int hours;
-	int mins;
-	int secs;
-	int status;
-	int intensity;
+	char * name;
+	char * pattern;
+	int required;
+	int (*run)(int *);
+	char * usage;
 };
 
 struct personalInfo
@@ -30,57 +202,156 @@ struct personalInfo
 };
 
 /* Global Variable Declarations*/
-volatile unsigned int *tcnt,*toc2,delay;
-volatile int hours, mins, secs, ticks, updateClockDisp, updateInfoDisp;
-unsigned char *padr, *paddr, *tflg2, *pactl, *tmsk2, *scdr, *scsr, *tflg1,*tctl1,*pgddr,*pgdr, *tmsk1;
-int scheduledDoses = 0;
-int boostsGiven = 0;
-int suspended = 0;
-int previousSwitchStatus = 0;
-int boostError = 0;
-struct dose doseTimes[MAX_DOSES];
-struct dose boostTimes[MAX_BOOSTS];
+volatile int hours, mins, secs, updateClockDisp, updateInfoDisp;
+volatile unsigned int clockFraction = 0; /*Clock units of the current second counted by the last tick*/
+volatile unsigned int tickTcnt = 0; /*TCNT when the last tick was counted*/
+volatile unsigned int days = 0; /*Days since start up*/
+int suspended = 0; /*Set by emergency mode, which stops delivery. The menu leaves delivery running*/
+struct doseCore doseState; /*Schedule, boosts and dose budget*/
+struct doseSchedule schedulePool[SCHEDULE_POOL_SIZE]; /*Templates, the patient's own schedule and a spare for edits*/
 struct personalInfo patientInfo;
+char * doseStatusNames[] = {"Pending", "Delivered", "Withheld"}; /*Indexed by dose status*/
 volatile int deliverDoseFlag = 0;
-int motorOn = 0;
-int fullCycleTime = 40000;
-volatile int pulseDelay = 800;
+unsigned int servoFrame = 0; /*TOC1 of the motor pulse being sent, each frame starts SERVO_PERIOD after the last*/
+volatile int pulseDelay = PULSE_REST;
 int alarm = 0;
-volatile int cycles = 0;
+volatile int cycles = 0; /*Servo frames set up at the dose position for the delivery being made*/
 volatile int motorRunning = 0;
-int boostIntensity = 0; /*0 value indicates full dose, 1 indicates half dose*/
+int telemetryEnabled = 0;
+int telemetryInterval = 1; /*Seconds between telemetry records*/
+int telemetryCountdown = 0;
+int telemetryKeyframeCountdown = 0;
+struct telemetryRecord lastTelemetry;
+volatile unsigned char rxBuffer[RX_BUFFER_SIZE];
+volatile unsigned char rxHead = 0;
+volatile unsigned char rxTail = 0;
+unsigned char laneAlarmBuffer[LANE_ALARM_SIZE];
+unsigned char laneTelemetryBuffer[LANE_TELEMETRY_SIZE];
+unsigned char laneUiBuffer[LANE_UI_SIZE];
+struct serialLane serialLanes[SERIAL_LANES] =
+{
+	{laneAlarmBuffer, LANE_ALARM_SIZE - 1, LANE_ALARM_BUDGET, "Alarm", 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+	{laneTelemetryBuffer, LANE_TELEMETRY_SIZE - 1, LANE_TELEMETRY_BUDGET, "Telemetry", 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+	{laneUiBuffer, LANE_UI_SIZE - 1, LANE_UI_BUDGET, "UI", 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+};
+int redrawing = 0; /*1 while the live monitor is redrawn, 2 once the rest of the redraw is being dropped*/
+volatile unsigned long tickCount = 0; /*Real time interrupts since start up*/
+volatile unsigned long upTime = 0; /*Seconds since start up, counted from the ticks. Setting the clock leaves it alone*/
+volatile unsigned int upFraction = 0; /*Clock units of the current second of upTime*/
+volatile int cpuIdle = 0;
+volatile unsigned long activeTicks = 0;
+volatile unsigned long idleTicks = 0;
+volatile unsigned char clockSequence = 0; /*Odd while timer() is changing the clock*/
+char commandLine[COMMAND_LENGTH] = "";
+int commandLength = 0;
+char commandReply[64] = "";
+char commandName[TEMPLATE_NAME_LENGTH] = ""; /*Word argument of the command being run*/
+
+/* Delivery journal - deliveries and alarms are appended to EEPROM so they survive a power loss.
+	The EEPROM is used as a ring of 8 byte records: sequence (2 bytes), type, detail (dose index, 10 for a
+	boost, plus 0x80 for a half dose), time (3 bytes, seconds since start up) and a CRC-8 of the first 7
+	bytes, written last. Each row is erased as the ring enters it, so every byte is erased once a lap and
+	wears evenly. At power on the newest valid record is found and writing carries on after it */
+int journalTail = 0; /*Slot the next record is written to*/
+unsigned int journalSequence = 0; /*Sequence of the next record*/
+int journalErrors = 0; /*Records which did not read back as written*/
 
 /* Function Prototypes*/
 int main(void);
-void timer(void);
-void deliverDose(int);
+int initialise(void);
+void displayUI(void);
+INTERRUPT void timer(void);
+INTERRUPT void turnMotor(void);
+INTERRUPT void serialInterrupt(void);
 void setDoseTime(int);
-void verifyDoseTime(void);
 void printAllDoses(void);
 void configureClock(void);
 void displayMenu(void);
 void serviceAlarm(void);
 int getStringSerial(char *, int);
 int getCharSerial(void);
-int putCharSerial(void);
+void serialPut(int, unsigned char);
+int serialPutchar(int);
+void serialAlarm(char *);
+void serialDiscard(int);
+void printSerialStatistics(void);
 void clearScreen(void);
-void verifyBoost(void);
+int validateTimeInput(char *);
+void printPatientInfo(void);
+void printBoostStatus(void);
+void resetMotor(void);
+void emergencyOverride(int);
+void editDoseTime(void);
 struct dose advanceFiveMinutes(struct dose);
 struct dose removeFiveMinutes(struct dose);
 int deliverMotorDose(int, int);
 void setPatientInformation(int);
+void serviceTelemetry(void);
+void buildTelemetryRecord(struct telemetryRecord *);
+void sendTelemetryRecord(struct telemetryRecord *, int);
+void sendTelemetrySchedule(void);
+void putTelemetryByte(unsigned char, unsigned char *);
+void configureTelemetry(void);
+void waitForInterrupt(void);
+long projectBatteryLife(unsigned long, unsigned long);
+void printPowerStatistics(void);
+void readClock(struct clockTime *);
+void setClock(int, int, int);
+void printBudgetStatus(void);
+void serviceDoses(void);
+void eepromErase(int, unsigned char);
+void eepromProgram(int, unsigned char);
+void eepromWait(int);
+unsigned char journalCrc(unsigned char *, int);
+int journalRead(int, unsigned char *);
+int journalOpen(void);
+void journalAppend(int, int);
+void printJournal(void);
+int executeCommand(char *);
+char * nextWord(char **);
+int parseArgument(char, char *, int *);
+int parseNumber(char *, int);
+int commandAdd(int *);
+int commandDelete(int *);
+int commandClock(int *);
+int commandBoost(int *);
+int commandHelp(int *);
+int commandSave(int *);
+int commandUse(int *);
+int commandDrop(int *);
+int commandForecast(int *);
+int commandWhatIf(int *);
+void forecastReply(struct doseForecast *, char *);
+void printForecast(void);
+void printForecastDelivery(const struct forecastDelivery *, void *);
+
+/* Operator commands, accepted on the live monitor and at the menu prompt */
+struct command commands[] =
+{
+	{"add", "tinn", 2, commandAdd, "add hh:mm:ss 50|100 [repeat days] [days until first]"},
+	{"del", "n", 1, commandDelete, "del dose"},
+	{"clock", "t", 1, commandClock, "clock hh:mm:ss"},
+	{"boost", "i", 1, commandBoost, "boost 50|100"},
+	{"save", "w", 1, commandSave, "save template"},
+	{"use", "w", 1, commandUse, "use template"},
+	{"drop", "w", 1, commandDrop, "drop template"},
+	{"forecast", "nn", 1, commandForecast, "forecast days [50|100 for a boost now]"},
+	{"whatif", "ntinn", 3, commandWhatIf, "whatif days hh:mm:ss 50|100 [repeat] [first day]"},
+	{"help", "", 0, commandHelp, "help"}
+};
 
 /* Board Configuration
 	Vectors:
 
 	SVEC 7 (Real Time) - timer()
 	SVEC C (TOC2) - turnMotor()
+	SVEC 14 (SCI) - serialInterrupt()
 
 	Ports:
 	A0 - LED
 	A1 - Booster Switch (Switch should be used as a button, being toggled between on and off rather than being left on)
 	A2 - Emergency Override Switch
-	G0 - Servo Motor
+	A6 - Servo Motor (OC2 pin, the pulse is made by OC1 and OC2)
 
 	Delay Values:
 	800  - Left
@@ -122,7 +393,7 @@ int main()
 } 
 
 /* Function Name: displayUI
-	Purpose: Draws the live monitor menu
+	Purpose: Draws the live monitor menu and collects operator commands typed on it
 	Params: none
 	Returns: (void)
 */
@@ -130,9 +401,9 @@ void displayUI()
 {
 	char userInput;
 	char * res;
+	struct clockTime now;
 	
 	updateClockDisp = 1;
-	suspended = 0;
 	
 	clearScreen();
 	
@@ -140,13 +411,27 @@ void displayUI()
 	{
 		if (updateClockDisp == 1)         /*Update display every second*/
 		{
-			printf("%2d:%2d:%2d\r", hours, mins, secs);
 			updateClockDisp = 0;
+
+			if(serialLanes[LANE_UI].head != serialLanes[LANE_UI].tail)
+			{
+				serialLanes[LANE_UI].deferred++; /*Still sending, the next second's clock will do*/
+			}
+			else
+			{
+				SIM_TIMELINE_BEGIN(SIM_EVENT_CLOCK, 0);
+				readClock(&now);
+				printf("\r%2d:%2d:%2d > %s", now.hours, now.mins, now.secs, commandLine);
+				SIM_TIMELINE_END(SIM_EVENT_CLOCK);
+			}
 		}
 		
 		
 		if(updateInfoDisp)
 		{
+			SIM_TIMELINE_BEGIN(SIM_EVENT_REDRAW, 0);
+			updateInfoDisp = 0; /*Set again if the state changes while the redraw waits for the line*/
+			redrawing = 1;
 			clearScreen();
 			printf("--- Drug Delivery System Live Monitor---\n");
 			printf("--- Press 'Esc' for menu ---\n\n");
@@ -156,65 +441,87 @@ void displayUI()
 			printAllDoses();
 			printf("\nBoosts\n---------------");
 			printBoostStatus();
+			printBudgetStatus();
 
-			if(boostError == 1)
+			if(doseState.boostError == 1)
 			{
 				printf("\nBoost switch may be stuck. \nFurther boosts will not be delivered until resolved\n");
 			}
 
+			printf("\nType a command such as add 08:30:00 50, or help\n%s\n", commandReply);
 
-			updateInfoDisp = 0;
+			redrawing = 0;
 			updateClockDisp = 1;
+			SIM_TIMELINE_END(SIM_EVENT_REDRAW);
 		}
 		
 		userInput = getCharSerial();
 		
 		if(userInput == 0x1B) /* Escape */
 		{
+			commandLength = 0;
+			commandLine[0] = '\0';
 			break;
 		}
+
+		/*Commands are typed a character at a time between the checks above, so doses keep being serviced*/
+		if(userInput == 0x0d && commandLength > 0)
+		{
+			executeCommand(commandLine);
+			commandLength = 0;
+			commandLine[0] = '\0';
+			updateInfoDisp = 1;
+		}
+		else if(userInput == 0x08 && commandLength > 0)
+		{
+			commandLine[--commandLength] = '\0';
+			printf("\b \b");
+		}
+		else if(userInput >= 0x20 && userInput < 0x7F && commandLength < COMMAND_LENGTH - 1)
+		{
+			commandLine[commandLength++] = userInput;
+			commandLine[commandLength] = '\0';
+			putchar(userInput);
+		}
 	}
 	
 	return;	
 }
 
 /* Function Name: initialise
-	Purpose: Initialises memory addresses and default values for registers
+	Purpose: Initialises the registers and default values
 	Params: none
 	Returns: (int) 1
 */
 int initialise()
 {
 	int res;
-	padr = (unsigned char*)0x0;
-	paddr = (unsigned char*)0x1;
-	tmsk2 = (unsigned char*)0x24;
-	tflg2 = (unsigned char*)0x25;
-	pactl = (unsigned char*)0x26;
-	scdr = (unsigned char*)0x2F;
-	scsr = (unsigned char*)0x2E;
-	tmsk1 = (unsigned char*)0x22;
-	tflg1=(unsigned char*)0x23;
-	toc2=(unsigned int*)0x18;
-	tcnt=(unsigned int*)0x0e;
-	pgddr=(unsigned char*)0x3;
-	pgdr=(unsigned char*)0x02;
-	tctl1=(unsigned char*)0x20;
-
-	*paddr = 0xFA;   /*Port A Data Register all outputs apart from A0*/
-	*padr = 0x00;	 /*Port A Values */
-	*pactl = 0x03;   /*Prescaler - to maximum*/
-	*tmsk2 = 0x40;   /*Enable RTI interrupt*/
-	*pgddr =0xff; 	 /*Port G Data Register - Output*/
-	*tctl1=0x00;
-	*tmsk1 = 0x40;
-
+	doseCorePoolInit(schedulePool, SCHEDULE_POOL_SIZE);
+	doseCoreInit(&doseState, schedulePool, SCHEDULE_POOL_SIZE);
+
+	PADDR = 0xFA;   /*Port A Data Register all outputs apart from A0*/
+	PADR = 0x00;	/*Port A Values */
+	PACTL = 0x03;   /*Prescaler - to maximum*/
+	TMSK2 = RTI_FLAG;   /*Enable RTI interrupt*/
+	servoFrame = (TCNT + SERVO_PERIOD) & 0xFFFFU;
+	TOC1 = servoFrame;
+	TOC2 = servoFrame + pulseDelay;
+	OC1D = PADR_PULSE; /*OC1 raises A6 at the start of each frame*/
+	OC1M = PADR_PULSE;
+	TCTL1 = TCTL1_OC2_CLEAR; /*OC2 lowers it pulseDelay later*/
+	TFLG1 = OC2_FLAG;
+	TMSK1 = OC2_FLAG;
+	SCCR2 |= SCCR2_RIE;  /*Enable SCI receive interrupt, so a key press wakes the processor*/
+
+	journalOpen();
+	journalAppend(JOURNAL_POWER_ON, 0);
 	
 	return 1;
 }
 
 /* Function Name: displayMenu
-	Purpose: Displays option menu when 'Esc' is pressed in the live monitor
+	Purpose: Displays option menu when 'Esc' is pressed in the live monitor. Doses and boosts go on being
+			 delivered while it waits for input, and each edit reaches the dosing core whole
 	Params: none
 	Returns: (void)
 */
@@ -222,10 +529,9 @@ void displayMenu()
 {
 	char userInput [37] = "";
 	char inputChar;
-	char inputString [];
 	int returnToDisp = 0;
+	struct clockTime now;
 	
-	suspended = 1;
 	updateInfoDisp = 1;
 	clearScreen();
 	
@@ -234,7 +540,7 @@ void displayMenu()
 	{
 		printf("--- Drug Delivery System Menu ---");
 		printf("\n--- Press 'Esc' to return to live monitor ---");
-		printf("\n1. Setup New Dose\n2. View All Dose Times\n3. View Current Time\n4. Edit Patient Information\n5. Alter Existing Dose\n");		
+		printf("\n1. Setup New Dose\n2. View All Dose Times\n3. View Current Time\n4. Edit Patient Information\n5. Alter Existing Dose\n6. Telemetry Settings\n7. Power and Serial Statistics\n8. Delivery Journal\n9. Dose Forecast\n");		
 	
 		getStringSerial(userInput, 37);
 		
@@ -248,7 +554,7 @@ void displayMenu()
 			/*Option 1*/
 			if(userInput[0] == '1')
 			{
-				if(scheduledDoses >= MAX_DOSES)
+				if(doseState.schedule->scheduledDoses >= MAX_DOSES)
 				{
 					clearScreen();
 					printf("No more than %d doses can be scheduled", MAX_DOSES);
@@ -273,7 +579,8 @@ void displayMenu()
 			if(userInput[0] == '3')
 			{
 				clearScreen();
-				printf("\nThe current time is: %02d:%02d:%02d\r", hours, mins, secs);	
+				readClock(&now);
+				printf("\nThe current time is: Day %u %02d:%02d:%02d\r", now.days + 1, now.hours, now.mins, now.secs);	
 			}		
 				
 			/*Option 4*/
@@ -288,7 +595,7 @@ void displayMenu()
 			if(userInput[0] == '5')
 			{
 				clearScreen();
-				if(scheduledDoses > 0)
+				if(doseState.schedule->scheduledDoses > 0)
 				{
 					editDoseTime();
 					clearScreen();
@@ -299,1051 +606,2650 @@ void displayMenu()
 				}
 
 			}	
+
+			/*Option 6*/
+			if(userInput[0] == '6')
+			{
+				clearScreen();
+				configureTelemetry();
+				clearScreen();
+			}
+
+			/*Option 7*/
+			if(userInput[0] == '7')
+			{
+				clearScreen();
+				printPowerStatistics();
+				printSerialStatistics();
+			}
+
+			/*Option 8*/
+			if(userInput[0] == '8')
+			{
+				clearScreen();
+				printJournal();
+			}
+
+			/*Option 9*/
+			if(userInput[0] == '9')
+			{
+				clearScreen();
+				printForecast();
+			}
+
+			/*Anything else is a one line command*/
+			if((userInput[0] < '1' || userInput[0] > '9') && userInput[0] != '\0')
+			{
+				clearScreen();
+				executeCommand(userInput);
+				printf("%s\n", commandReply);
+			}
 		}
 	}
 }
 
 
-/* Interrupt Function - Real Time (SVEC 7)
-	Function Name: timer
-	Purpose: Tracks number of ticks to monitor current time, sets alarm flag every second
-	Params: none
-	Returns: (void)
+/* Function Name: executeCommand
+	Purpose: Runs a one line operator command. The command is looked up in the commands table and its arguments
+			 are all checked against the table's pattern before anything is changed. The line is split in place
+	Params: (char *) line - Command line
+	Returns: (int) 1 if the command was carried out, 0 otherwise. commandReply says what happened
 */
-@interrupt void timer(void)
+int executeCommand(char * line)
 {
-	ticks++;
-	
-	if (ticks == 30)
+	char * cursor = line;
+	char * word;
+	char * pattern;
+	int values[COMMAND_MAX_VALUES];
+	int count = 0;
+	int arguments = 0;
+	int i;
+	struct command * selected = NULL;
+
+	word = nextWord(&cursor);
+
+	if(word == NULL)
 	{
-		ticks = 0;
-		alarm = 1;
-		secs++;
+		commandReply[0] = '\0';
+		return 0;
+	}
+
+	for(i = 0; i < COMMAND_COUNT; i++)
+	{
+		if(strcmp(word, commands[i].name) == 0)
+		{
+			selected = &commands[i];
+		}
+	}
+
+	if(selected == NULL)
+	{
+		sprintf(commandReply, "Unknown command %.12s, type help for a list", word);
+		return 0;
 	}
 
-	if (secs == 60)
+	for(i = 0; i < COMMAND_MAX_VALUES; i++)
 	{
-		secs = 0;
-		mins++;
+		values[i] = 0;
 	}
-	if (mins == 60)
+
+	for(pattern = selected->pattern; *pattern != '\0'; pattern++)
 	{
-		mins = 0;
-		hours++;
+		word = nextWord(&cursor);
+
+		if(word == NULL)
+		{
+			break;
+		}
+
+		if(parseArgument(*pattern, word, &values[count]) == 0)
+		{
+			arguments = -1;
+			break;
+		}
+
+		count += (*pattern == 't') ? 3 : 1;
+		arguments++;
 	}
-	if (hours == 24)
+
+	if(arguments < selected->required || nextWord(&cursor) != NULL)
 	{
-		hours = 0;
+		sprintf(commandReply, "Usage: %.56s", selected->usage);
+		return 0;
 	}
-	*tflg2 = 0x40;                      /*Reset RTI flag*/
+
+	return selected->run(values);
 }
 
-/* 
-	Function Name: deliverDose
-	Purpose: Sets flag to indicate that scheduled dose should be delivered, sets dose status to delivered
-	Params: (int) doseIndex - Integer indicating index of dose to be delivered in the array
-	Returns: (void)
+/* Function Name: nextWord
+	Purpose: Splits the next space separated word off a command line, in place
+	Params: (char **) cursor - Position in the line, moved past the word
+	Returns: (char *) The word, NULL at the end of the line
 */
-void deliverDose(doseIndex)
+char * nextWord(char ** cursor)
 {
-	deliverDoseFlag = deliverMotorDose(doseTimes[doseIndex].intensity, (doseIndex + 1));
-	updateInfoDisp = 1;
-	doseTimes[doseIndex].status = 1; /*Delivered*/
+	char * word;
+
+	while(**cursor == ' ')
+	{
+		(*cursor)++;
+	}
+
+	if(**cursor == '\0')
+	{
+		return NULL;
+	}
+
+	word = *cursor;
+
+	while(**cursor != ' ' && **cursor != '\0')
+	{
+		(*cursor)++;
+	}
+
+	if(**cursor == ' ')
+	{
+		**cursor = '\0';
+		(*cursor)++;
+	}
+
+	return word;
 }
 
-/* 
-	Function Name: setDoseTime
-	Purpose: Create a new scheduled dose
-	Params: (int) index - Index of dose to be overwritten, only set if applicable
-	Returns: (void)
+/* Function Name: parseArgument
+	Purpose: Checks and converts one command argument
+	Params: (char) type - Pattern letter of the argument
+			(char *) word - Argument as typed
+			(int *) value - Receives the value, three values for a time
+	Returns: (int) 1 if the argument is valid, 0 otherwise
 */
-void setDoseTime(int index)
+int parseArgument(char type, char * word, int * value)
 {
-	struct dose newDoseTime;
-	char hourString [3] = "";
-	char minString [3] = "";
-	char secString[3] = "";
-	char intensityString[2] = "";
-	int validationResult = 0;
-	int validTime = 0;
+	char * mins;
+	char * secs = NULL;
 
-	while (validTime != 1)
+	if(type == 'i')
 	{
-		while(validationResult != 1)
-		{
-			printf("\nPlease set dose hours: ");
-			getStringSerial(hourString, 3);
-			
-			validationResult = validateTimeInput(hourString);
-			
-			if(validationResult == 1)
-			{
-				newDoseTime.hours = atoi(hourString);
-				
-				if(newDoseTime.hours > 23)
-				{
-					printf("\nHours should only be 0-23");
-					validationResult = -1;
-				}
-			}
-		}
-		
-		validationResult = 0; /* Reset Validation status */
-		
-		while(validationResult != 1)
+		if(strcmp(word, "50") == 0)
 		{
-			printf("\nPlease set dose mins: ");
-			getStringSerial(minString, 3);
-			
-			validationResult = validateTimeInput(minString);
-			
-			if(validationResult == 1)
-			{
-				newDoseTime.mins = atoi(minString);
-				
-				if(newDoseTime.mins > 60)
-				{
-					printf("\nMins should only be 0-59");
-					validationResult = -1;
-				}
-			}
+			*value = 1;
+			return 1;
 		}
-		
-		validationResult = 0;
-		
-		while(validationResult != 1)
+
+		if(strcmp(word, "100") == 0)
 		{
-			printf("\nPlease set dose secs: ");
-			getStringSerial(secString, 3);
-			
-			validationResult = validateTimeInput(secString);
-			
-			if(validationResult == 1)
-			{
-				newDoseTime.secs = atoi(secString);
-				
-				if(newDoseTime.secs > 60)
-				{
-					printf("\nSecs should only be 0-59");
-					validationResult = -1;
-				}
-			}
+			*value = 0;
+			return 1;
 		}
 
-	
-		validationResult = 0;
-		validTime = 1; /*Note - Hardcoded due to removal of function*/
-
-		do
-		{
-			printf("\nPlease set dose intensity a. 50%% b.: 100%% ");
-			getStringSerial(intensityString, 2);
+		return 0;
+	}
 
-			if(intensityString[0] == 'a')
-			{
-				newDoseTime.intensity = 1;
-				validationResult = 1;
-			}
+	if(type == 'n')
+	{
+		*value = parseNumber(word, 999);
+		return *value >= 0;
+	}
 
-			if(intensityString[0] == 'b')
-			{
-				newDoseTime.intensity = 0;
-				validationResult = 1;
-			}
+	if(type == 'w')
+	{
+		strncpy(commandName, word, TEMPLATE_NAME_LENGTH - 1);
+		commandName[TEMPLATE_NAME_LENGTH - 1] = '\0';
+		*value = 1;
+		return 1;
+	}
 
-			if(validationResult != 1)
-			{
-				printf("\nPlease only use the characters 'a' and 'b' to indicate your choice");
-			}
-		}
-		while(validationResult != 1);
+	/*Time, hh:mm:ss or hh:mm*/
+	mins = strchr(word, ':');
 
+	if(mins == NULL)
+	{
+		return 0;
 	}
-	newDoseTime.status = 0; /*Pending*/
-	
-	if(index == -1)
+
+	*mins++ = '\0';
+	secs = strchr(mins, ':');
+
+	if(secs != NULL)
 	{
-		index = scheduledDoses;
-		scheduledDoses++;
+		*secs++ = '\0';
 	}
 
-	doseTimes[index] = newDoseTime;
+	value[0] = parseNumber(word, 23);
+	value[1] = parseNumber(mins, 59);
+	value[2] = (secs == NULL) ? 0 : parseNumber(secs, 59);
+
+	return value[0] >= 0 && value[1] >= 0 && value[2] >= 0;
 }
 
-/* 
-	Function Name: verifyDoseTime
-	Purpose: Checks whether a scheduled dose should be delivered
-	Params: none
-	Returns: (void)
+/* Function Name: parseNumber
+	Purpose: Converts a number of up to three digits
+	Params: (char *) text - Number as typed
+			(int) maximum - Largest value allowed
+	Returns: (int) The number, -1 if it is not a number or is out of range
 */
-void verifyDoseTime()
+int parseNumber(char * text, int maximum)
 {
-	int i;
-	
-	for(i = 0; i < scheduledDoses; i++)
+	int value = 0;
+	int digits = 0;
+
+	while(*text >= '0' && *text <= '9' && digits < 3)
 	{
-		if(hours == doseTimes[i].hours)
-		{
-			if(mins == doseTimes[i].mins)
-			{
-				if(secs == doseTimes[i].secs)
-				{
-					deliverDose(i);				
-				}
-			}
-		}	
+		value = (value * 10) + (*text - '0');
+		text++;
+		digits++;
+	}
+
+	if(digits == 0 || *text != '\0' || value > maximum)
+	{
+		return -1;
 	}
+
+	return value;
 }
 
-/* 
-	Function Name: printAllDoses
-	Purpose: Prints all scheduled doses onto the screen
-	Params: none
-	Returns: (void)
+/* Function Name: commandAdd
+	Purpose: add hh:mm:ss 50|100 [repeat days] [days until first] - schedules a dose, as option 1 of the menu
+	Params: (int *) values - hours, mins, secs, intensity, repeat days, days until the first dose
+	Returns: (int) 1 if the dose was added, 0 otherwise
 */
-void printAllDoses()
+int commandAdd(int * values)
 {
-	int i;
-	char status[20] = "";
-	char intensity[20] = "";
-	
-	if(scheduledDoses == 0)
+	struct clockTime now;
+	struct dose newDose;
+	int index;
+
+	if(doseState.schedule->scheduledDoses >= MAX_DOSES)
 	{
-		printf("\n--No doses currently scheduled--");
+		sprintf(commandReply, "No more than %d doses can be scheduled", MAX_DOSES);
+		return 0;
 	}
-	
-	for(i = 0; i < scheduledDoses; i++)
+
+	if(values[4] > MAX_REPEAT_DAYS)
 	{
-		if(suspended == 1)
-		{
-			strcpy(status, "Suspended");
-		}
-		else
-		{
-			if(doseTimes[i].status == 1)
-			{
-				strcpy(status, "Delivered");
-			}	
-			else
-			{
-				strcpy(status, "Pending");
-			}	
-		}
+		sprintf(commandReply, "Repeat should only be 0-%d", MAX_REPEAT_DAYS);
+		return 0;
+	}
 
-			if(doseTimes[i].intensity == 1)
-			{
-				strcpy(intensity, "50");
-			}	
-			else
-			{
-				strcpy(intensity, "100");
-			}	
+	readClock(&now);
+	newDose.hours = values[0];
+	newDose.mins = values[1];
+	newDose.secs = values[2];
+	newDose.intensity = values[3];
+	newDose.repeatDays = values[4];
+	newDose.startDay = now.days + values[5];
+	index = doseCoreSetDose(&doseState, -1, &newDose);
 
-		printf("\nDose #%d at %02d:%02d:%02d		Status: %s      Intensity: %s%%", (i + 1), doseTimes[i].hours, doseTimes[i].mins, doseTimes[i].secs, status, intensity);		
+	if(index < 0)
+	{
+		strcpy(commandReply, "Dose could not be added");
+		return 0;
 	}
-	
-	printf("\n%d of %d doses scheduled\n", scheduledDoses, MAX_DOSES);
+
+	sprintf(commandReply, "Dose #%d added at %02d:%02d:%02d", index + 1, values[0], values[1], values[2]);
+	return 1;
 }
 
-/* 
-	Function Name: configureClock
-	Purpose: Sets initial clock time
-	Params: none
-	Returns: (void)
+/* Function Name: commandDelete
+	Purpose: del dose - removes a dose, as option 5 of the menu
+	Params: (int *) values - Dose number, from 1
+	Returns: (int) 1 if the dose was removed, 0 otherwise
 */
-void configureClock()
+int commandDelete(int * values)
+{
+	if(doseCoreRemoveDose(&doseState, values[0] - 1) != CORE_OK)
+	{
+		strcpy(commandReply, "Invalid dose");
+		return 0;
+	}
+
+	sprintf(commandReply, "Dose #%d removed", values[0]);
+	return 1;
+}
+
+/* Function Name: commandClock
+	Purpose: clock hh:mm:ss - sets the clock
+	Params: (int *) values - hours, mins, secs
+	Returns: (int) 1
+*/
+int commandClock(int * values)
+{
+	setClock(values[0], values[1], values[2]);
+
+	sprintf(commandReply, "Clock set to %02d:%02d:%02d", values[0], values[1], values[2]);
+	return 1;
+}
+
+/* Function Name: commandBoost
+	Purpose: boost 50|100 - sets the patient's boost intensity
+	Params: (int *) values - Intensity
+	Returns: (int) 1
+*/
+int commandBoost(int * values)
+{
+	doseState.boostIntensity = values[0];
+
+	sprintf(commandReply, "Boost intensity set to %s%%", doseState.boostIntensity == 1 ? "50" : "100");
+	return 1;
+}
+
+/* Function Name: commandHelp
+	Purpose: help - lists the commands
+	Params: (int *) values - Unused
+	Returns: (int) 1
+*/
+int commandHelp(int * values)
+{
+	(void) values; /*Takes no values, every handler has the same signature*/
+
+	strcpy(commandReply, "Commands: add del clock boost save use drop forecast whatif");
+	return 1;
+}
+
+/* Function Name: commandSave
+	Purpose: save template - keeps the schedule as a named template, replacing any template of that name.
+			 Templates outlast a reset for a new patient
+	Params: (int *) values - Unused, the name is in commandName
+	Returns: (int) 1 if the template was saved, 0 otherwise
+*/
+int commandSave(int * values)
+{
+	int templates = 0;
+	int i;
+
+	(void) values;
+
+	for(i = 0; i < SCHEDULE_POOL_SIZE; i++)
+	{
+		if(schedulePool[i].name[0] != '\0' && strcmp(schedulePool[i].name, commandName) != 0)
+		{
+			templates++;
+		}
+	}
+
+	if(templates >= SCHEDULE_TEMPLATES) /*Keeps a schedule free for the patient's own copy*/
+	{
+		sprintf(commandReply, "No more than %d templates can be kept", SCHEDULE_TEMPLATES);
+		return 0;
+	}
+
+	if(doseCoreSaveTemplate(&doseState, commandName) != CORE_OK)
+	{
+		strcpy(commandReply, "Template could not be saved");
+		return 0;
+	}
+
+	sprintf(commandReply, "Schedule saved as %s", commandName);
+	return 1;
+}
+
+/* Function Name: commandUse
+	Purpose: use template - replaces the schedule with a template, every dose pending. The template is shared
+			 until a dose is added, edited or removed
+	Params: (int *) values - Unused, the name is in commandName
+	Returns: (int) 1 if the template is in use, 0 otherwise
+*/
+int commandUse(int * values)
+{
+	(void) values;
+
+	if(doseCoreUseTemplate(&doseState, commandName) != CORE_OK)
+	{
+		sprintf(commandReply, "No template called %s", commandName);
+		return 0;
+	}
+
+	sprintf(commandReply, "Schedule set from %s, %d doses", commandName, doseState.schedule->scheduledDoses);
+	return 1;
+}
+
+/* Function Name: commandDrop
+	Purpose: drop template - forgets a template. A schedule set from it is kept
+	Params: (int *) values - Unused, the name is in commandName
+	Returns: (int) 1 if the template was dropped, 0 otherwise
+*/
+int commandDrop(int * values)
+{
+	(void) values;
+
+	if(doseCoreDeleteTemplate(&doseState, commandName) != CORE_OK)
+	{
+		sprintf(commandReply, "No template called %s", commandName);
+		return 0;
+	}
+
+	sprintf(commandReply, "Template %s dropped", commandName);
+	return 1;
+}
+
+/* Function Name: commandForecast
+	Purpose: forecast days [50|100] - forecasts the deliveries over the coming days, optionally as if the boost
+			 switch were pressed now at the given intensity. Nothing is changed
+	Params: (int *) values - Days, boost intensity as a percentage, 0 if left off
+	Returns: (int) 1 if the forecast was made, 0 otherwise
+*/
+int commandForecast(int * values)
+{
+	struct doseForecast forecast;
+
+	forecast.days = values[0];
+	forecast.extraDose = NULL;
+	forecast.boostIntensity = (values[1] == 50) ? 1 : (values[1] == 100) ? 0 : -1;
+
+	if(values[1] != 0 && forecast.boostIntensity == -1)
+	{
+		strcpy(commandReply, "Boost should only be 50 or 100");
+		return 0;
+	}
+
+	forecastReply(&forecast, (forecast.boostIntensity == -1) ? "" : " with boost");
+	return forecast.days > 0;
+}
+
+/* Function Name: commandWhatIf
+	Purpose: whatif days hh:mm:ss 50|100 [repeat days] [days until first] - forecasts the deliveries over the
+			 coming days as if the dose were added. Nothing is changed
+	Params: (int *) values - Days, hours, mins, secs, intensity, repeat days, days until the first dose
+	Returns: (int) 1 if the forecast was made, 0 otherwise
+*/
+int commandWhatIf(int * values)
+{
+	struct doseForecast forecast;
+	struct clockTime now;
+	struct dose extraDose;
+
+	readClock(&now);
+	extraDose.hours = values[1];
+	extraDose.mins = values[2];
+	extraDose.secs = values[3];
+	extraDose.intensity = values[4];
+	extraDose.repeatDays = values[5];
+	extraDose.startDay = now.days + values[6];
+	forecast.days = values[0];
+	forecast.extraDose = &extraDose;
+	forecast.boostIntensity = -1;
+
+	forecastReply(&forecast, " with dose");
+	return forecast.days > 0;
+}
+
+/* Function Name: forecastReply
+	Purpose: Makes a forecast and sums it up in commandReply
+	Params: (struct doseForecast *) forecast - Days and what if fields, days is set to 0 if it fails
+			(char *) label - What was tried out, for the reply
+	Returns: (void)
+*/
+void forecastReply(struct doseForecast * forecast, char * label)
+{
+	struct clockTime now;
+	int result;
+
+	readClock(&now);
+	result = doseCoreForecast(&doseState, &now, forecast, NULL, NULL);
+
+	if(result == CORE_INVALID_DAYS)
+	{
+		sprintf(commandReply, "Days should only be 1-%d", FORECAST_MAX_DAYS);
+	}
+	else if(result == CORE_FULL)
+	{
+		sprintf(commandReply, "No more than %d doses can be scheduled", MAX_DOSES);
+	}
+	else if(result == CORE_INVALID_REPEAT)
+	{
+		sprintf(commandReply, "Repeat should only be 0-%d", MAX_REPEAT_DAYS);
+	}
+	else
+	{
+		sprintf(commandReply, "%d days%s: %d given, %d withheld, %d.%d doses", forecast->days, label,
+			forecast->delivered, forecast->withheld, forecast->units / 2, (forecast->units & 1) * 5);
+		return;
+	}
+
+	forecast->days = 0;
+}
+
+/* Interrupt Function - Real Time (SVEC 7)
+	Function Name: timer
+	Purpose: Keeps the clock, setting the alarm flag every second. A tick is 32.768 ms, which does not divide a
+			 second, so each tick adds its length to clockFraction and a second is counted whenever a whole
+			 one has built up, carrying the remainder into the next. The clock never drifts from the E clock.
+			 upTime counts seconds the same way from its own fraction, so it only ever counts up whatever the
+			 clock is set to, and times the dose budget, boosts and journal.
+			 Also samples whether the processor was waiting, for the power statistics, and gives each transmit
+			 lane its budget for the tick. clockSequence is odd while the clock is changing so readClock can detect a torn read
+	Params: none
+	Returns: (void)
+*/
+INTERRUPT void timer(void)
+{
+	int lane;
+
+	clockSequence++;
+	tickTcnt = TCNT;
+	tickCount++;
+	clockFraction += CLOCK_UNITS_PER_TICK;
+	upFraction += CLOCK_UNITS_PER_TICK;
+
+	if(upFraction >= CLOCK_UNITS_PER_SECOND)
+	{
+		upFraction -= CLOCK_UNITS_PER_SECOND;
+		upTime++;
+	}
+
+	for(lane = 0; lane < SERIAL_LANES; lane++)
+	{
+		serialLanes[lane].credit = serialLanes[lane].budget;
+	}
+
+	if(cpuIdle)
+	{
+		idleTicks++;
+	}
+	else
+	{
+		activeTicks++;
+	}
+	
+	if (clockFraction >= CLOCK_UNITS_PER_SECOND)
+	{
+		clockFraction -= CLOCK_UNITS_PER_SECOND;
+		alarm = 1;
+		secs++;
+
+		if (secs == 60)
+		{
+			secs = 0;
+			mins++;
+		}
+		if (mins == 60)
+		{
+			mins = 0;
+			hours++;
+		}
+		if (hours == 24)
+		{
+			hours = 0;
+			days++;
+		}
+	}
+	clockSequence++;
+	TFLG2 = RTI_FLAG;                   /*Reset RTI flag*/
+}
+
+/* 
+	Function Name: setDoseTime
+	Purpose: Create a new scheduled dose
+	Params: (int) index - Index of dose to be overwritten, only set if applicable
+	Returns: (void)
+*/
+void setDoseTime(int index)
 {
+	struct dose newDoseTime;
 	char hourString [3] = "";
 	char minString [3] = "";
 	char secString[3] = "";
+	char intensityString[2] = "";
+	char repeatString[3] = "";
+	char startString[3] = "";
 	int validationResult = 0;
-	
-	while(validationResult != 1)
+	int validTime = 0;
+	struct clockTime now;
+
+	readClock(&now);
+
+	while (validTime != 1)
 	{
-		printf("\nPlease set current hours: ");
-		getStringSerial(hourString, 3);
+		while(validationResult != 1)
+		{
+			printf("\nPlease set dose hours: ");
+			getStringSerial(hourString, 3);
+			
+			validationResult = validateTimeInput(hourString);
+			
+			if(validationResult == 1)
+			{
+				newDoseTime.hours = atoi(hourString);
+				
+				if(newDoseTime.hours > 23)
+				{
+					printf("\nHours should only be 0-23");
+					validationResult = -1;
+				}
+			}
+		}
 		
-		validationResult = validateTimeInput(hourString);
+		validationResult = 0; /* Reset Validation status */
 		
-		if(validationResult == 1)
+		while(validationResult != 1)
+		{
+			printf("\nPlease set dose mins: ");
+			getStringSerial(minString, 3);
+			
+			validationResult = validateTimeInput(minString);
+			
+			if(validationResult == 1)
+			{
+				newDoseTime.mins = atoi(minString);
+				
+				if(newDoseTime.mins > 59)
+				{
+					printf("\nMins should only be 0-59");
+					validationResult = -1;
+				}
+			}
+		}
+		
+		validationResult = 0;
+		
+		while(validationResult != 1)
+		{
+			printf("\nPlease set dose secs: ");
+			getStringSerial(secString, 3);
+			
+			validationResult = validateTimeInput(secString);
+			
+			if(validationResult == 1)
+			{
+				newDoseTime.secs = atoi(secString);
+				
+				if(newDoseTime.secs > 59)
+				{
+					printf("\nSecs should only be 0-59");
+					validationResult = -1;
+				}
+			}
+		}
+
+	
+		validationResult = 0;
+		validTime = 1; /*Note - Hardcoded due to removal of function*/
+
+		do
+		{
+			printf("\nPlease set dose intensity a. 50%% b.: 100%% ");
+			getStringSerial(intensityString, 2);
+
+			if(intensityString[0] == 'a')
+			{
+				newDoseTime.intensity = 1;
+				validationResult = 1;
+			}
+
+			if(intensityString[0] == 'b')
+			{
+				newDoseTime.intensity = 0;
+				validationResult = 1;
+			}
+
+			if(validationResult != 1)
+			{
+				printf("\nPlease only use the characters 'a' and 'b' to indicate your choice");
+			}
+		}
+		while(validationResult != 1);
+
+		validationResult = 0;
+
+		while(validationResult != 1)
+		{
+			printf("\nRepeat every how many days? (0 once, 1 daily, up to %d): ", MAX_REPEAT_DAYS);
+			getStringSerial(repeatString, 3);
+
+			validationResult = validateTimeInput(repeatString);
+
+			if(validationResult == 1)
+			{
+				newDoseTime.repeatDays = atoi(repeatString);
+
+				if(newDoseTime.repeatDays > MAX_REPEAT_DAYS)
+				{
+					printf("\nRepeat should only be 0-%d", MAX_REPEAT_DAYS);
+					validationResult = -1;
+				}
+			}
+		}
+
+		validationResult = 0;
+
+		while(validationResult != 1)
+		{
+			printf("\nFirst dose in how many days? (0 today): ");
+			getStringSerial(startString, 3);
+
+			validationResult = validateTimeInput(startString);
+
+			if(validationResult == 1)
+			{
+				newDoseTime.startDay = now.days + atoi(startString);
+			}
+		}
+
+	}
+
+	if(index >= 0 && doseState.status[index] == 1)
+	{
+		printf("\nDose %d was delivered while it was being edited, so it has not been changed", index + 1);
+		return;
+	}
+
+	doseCoreSetDose(&doseState, index, &newDoseTime); /*Published whole, delivery goes on while the prompts wait*/
+}
+
+/* 
+	Function Name: printBudgetStatus
+	Purpose: Prints how much of each dose budget window is used, in full doses
+	Params: none
+	Returns: (void)
+*/
+void printBudgetStatus()
+{
+	struct clockTime now;
+	int shortUnits, longUnits;
+
+	readClock(&now);
+	doseCoreBudgetUsed(&doseState, &now, &shortUnits, &longUnits);
+
+	printf("\nDose budget: %d.%d of %d.%d in 4 hours, %d.%d of %d.%d in 24 hours", shortUnits / 2, (shortUnits & 1) * 5,
+		BUDGET_SHORT_UNITS / 2, (BUDGET_SHORT_UNITS & 1) * 5, longUnits / 2, (longUnits & 1) * 5,
+		BUDGET_LONG_UNITS / 2, (BUDGET_LONG_UNITS & 1) * 5);
+
+	if(doseState.budgetWithheld > 0)
+	{
+		printf("\nDose budget reached, %d deliveries withheld", doseState.budgetWithheld);
+	}
+
+	printf("\n");
+}
+
+/* 
+	Function Name: printForecast
+	Purpose: Asks how many days to forecast, the rest of today being the first, then prints every delivery
+			 due in them and the doses given by the end of each day. Use forecast and whatif at the menu
+			 prompt to try out a change
+	Params: none
+	Returns: (void)
+*/
+void printForecast()
+{
+	struct doseForecast forecast;
+	struct clockTime now;
+	char daysString[3] = "";
+	int validResponse = 0;
+	int days = 0;
+	int i;
+
+	while(validResponse != 1)
+	{
+		printf("\nPlease set days to forecast (1-%d): ", FORECAST_MAX_DAYS);
+		getStringSerial(daysString, 3);
+
+		validResponse = validateTimeInput(daysString);
+
+		if(validResponse == 1)
+		{
+			days = atoi(daysString);
+
+			if(days < 1 || days > FORECAST_MAX_DAYS)
+			{
+				printf("\nDays should only be 1-%d", FORECAST_MAX_DAYS);
+				validResponse = -1;
+			}
+		}
+	}
+
+	forecast.days = days;
+	forecast.extraDose = NULL;
+	forecast.boostIntensity = -1;
+	readClock(&now);
+
+	printf("\nForecast for %d days from day %u %02d:%02d:%02d\n---------------", days, now.days + 1, now.hours, now.mins, now.secs);
+	doseCoreForecast(&doseState, &now, &forecast, printForecastDelivery, NULL);
+
+	if(forecast.delivered + forecast.withheld == 0)
+	{
+		printf("\n--No deliveries due--");
+	}
+
+	printf("\nDoses given by the end of each day:");
+
+	for(i = 0; i < days; i++)
+	{
+		printf("%s day %u %d.%d", (i == 0) ? "" : ",", now.days + i + 1, forecast.dayUnits[i] / 2, (forecast.dayUnits[i] & 1) * 5);
+	}
+
+	printf("\n%d given, %d withheld by the dose budget\n", forecast.delivered, forecast.withheld);
+}
+
+/* 
+	Function Name: printForecastDelivery
+	Purpose: Prints one forecast delivery, called by doseCoreForecast
+	Params: (const struct forecastDelivery *) delivery - Delivery
+			(void *) context - Unused
+	Returns: (void)
+*/
+void printForecastDelivery(const struct forecastDelivery * delivery, void * context)
+{
+	(void) context;
+
+	printf("\nDay %u %02ld:%02ld:%02ld  ", delivery->day + 1, delivery->time / 3600L, (delivery->time / 60L) % 60L, delivery->time % 60L);
+
+	if(delivery->index == MAX_DOSES)
+	{
+		printf("Boost");
+	}
+	else
+	{
+		printf("Dose #%d", delivery->index + 1);
+	}
+
+	printf(" %s%%  %s  %d.%d doses so far", (delivery->intensity == 1) ? "50" : "100",
+		delivery->withheld ? "Withheld" : "Given", delivery->units / 2, (delivery->units & 1) * 5);
+}
+
+/* 
+	Function Name: printAllDoses
+	Purpose: Prints all scheduled doses onto the screen
+	Params: none
+	Returns: (void)
+*/
+void printAllDoses()
+{
+	int i;
+	char * status;
+	char delivered[24];
+	char intensity[20] = "";
+	char repeat[32] = "";
+	int next;
+	long nextTime;
+	long late;
+	struct clockTime now;
+	const struct dose * scheduled;
+	
+	if(doseState.schedule->scheduledDoses == 0)
+	{
+		printf("\n--No doses currently scheduled--");
+	}
+	
+	for(i = 0; i < doseState.schedule->scheduledDoses; i++)
+	{
+		status = (suspended == 1) ? "Suspended" : doseStatusNames[doseState.status[i]];
+		scheduled = &doseState.schedule->doses[i];
+
+		if(suspended == 0 && doseState.status[i] == 1)
+		{
+			/*How long after its due time the dose was delivered*/
+			late = (doseCoreSecondsOfDay(doseState.deliveredAt[i].hours, doseState.deliveredAt[i].mins, doseState.deliveredAt[i].secs)
+				- doseCoreSecondsOfDay(scheduled->hours, scheduled->mins, scheduled->secs)) * 1000L + doseState.deliveredAt[i].millis;
+			sprintf(delivered, "Delivered +%ldms", late);
+			status = delivered;
+		}
+
+			if(doseState.schedule->doses[i].intensity == 1)
+			{
+				strcpy(intensity, "50");
+			}	
+			else
+			{
+				strcpy(intensity, "100");
+			}	
+
+			if(doseState.schedule->doses[i].repeatDays == 0)
+			{
+				sprintf(repeat, "Once on day %u", doseState.schedule->doses[i].startDay + 1);
+			}
+			else if(doseState.schedule->doses[i].repeatDays == 1)
+			{
+				sprintf(repeat, "Daily from day %u", doseState.schedule->doses[i].startDay + 1);
+			}
+			else
+			{
+				sprintf(repeat, "Every %d days from day %u", doseState.schedule->doses[i].repeatDays, doseState.schedule->doses[i].startDay + 1);
+			}
+
+		printf("\nDose #%d at %02d:%02d:%02d		Status: %s      Intensity: %s%%      %s", (i + 1), doseState.schedule->doses[i].hours, doseState.schedule->doses[i].mins, doseState.schedule->doses[i].secs, status, intensity, repeat);		
+	}
+	
+	printf("\n%d of %d doses scheduled: %d pending, %d delivered, %d withheld", doseState.schedule->scheduledDoses, MAX_DOSES,
+		doseState.statusCount[0], doseState.statusCount[1], doseState.statusCount[2]);
+
+	if(doseState.schedule->name[0] != '\0')
+	{
+		printf("\nSchedule is template %s", doseState.schedule->name);
+	}
+
+	readClock(&now);
+	next = doseCoreNextDose(&doseState, &now, &nextTime);
+
+	if(next != NO_DOSE)
+	{
+		printf("\nNext dose #%d at %02ld:%02ld:%02ld", next + 1, nextTime / 3600L, (nextTime / 60L) % 60L, nextTime % 60L);
+	}
+
+	printf("\n");
+}
+
+/* 
+	Function Name: configureClock
+	Purpose: Sets initial clock time
+	Params: none
+	Returns: (void)
+*/
+void configureClock()
+{
+	char hourString [3] = "";
+	char minString [3] = "";
+	char secString[3] = "";
+	int validationResult = 0;
+	int newHours = 0;
+	int newMins = 0;
+	int newSecs = 0;
+	
+	while(validationResult != 1)
+	{
+		printf("\nPlease set current hours: ");
+		getStringSerial(hourString, 3);
+		
+		validationResult = validateTimeInput(hourString);
+		
+		if(validationResult == 1)
+		{
+			newHours = atoi(hourString);
+			
+			if(newHours > 23)
+			{
+				printf("\nHours should only be 0-23");
+				validationResult = -1;
+			}
+		}
+	}
+	
+	validationResult = 0; /* Reset Validation status */
+	
+	while(validationResult != 1)
+	{
+		printf("\nPlease set current mins: ");
+		getStringSerial(minString, 3);
+		
+		validationResult = validateTimeInput(minString);
+		
+		if(validationResult == 1)
+		{
+			newMins = atoi(minString);
+			
+			if(newMins > 59)
+			{
+				printf("\nMins should only be 0-59");
+				validationResult = -1;
+			}
+		}
+	}
+	
+	validationResult = 0;
+	
+	while(validationResult != 1)
+	{
+		printf("\nPlease set current secs: ");
+		getStringSerial(secString, 3);
+		
+		validationResult = validateTimeInput(secString);
+		
+		if(validationResult == 1)
+		{
+			newSecs = atoi(secString);
+			
+			if(newSecs > 59)
+			{
+				printf("\nSecs should only be 0-59");
+				validationResult = -1;
+			}
+		}
+	}		
+
+	setClock(newHours, newMins, newSecs);
+}
+
+/* 
+	Function Name: readClock
+	Purpose: Takes a consistent copy of the clock without disabling interrupts. The copy is retried if
+			 timer() changed the clock part way through, detected by a change in clockSequence.
+			 Milliseconds are the part of the second counted by the last tick plus the time since it, from TCNT
+	Params: (struct clockTime *) snapshot - Pointer to the destination for the copy
+	Returns: (void)
+*/
+void readClock(struct clockTime * snapshot)
+{
+	unsigned char sequence;
+	unsigned int fraction;
+	unsigned int elapsed;
+	unsigned long units;
+
+	do
+	{
+		sequence = clockSequence;
+		snapshot->days = days;
+		snapshot->hours = hours;
+		SIM_CLOCK_LOAD();
+		snapshot->mins = mins;
+		SIM_CLOCK_LOAD();
+		snapshot->secs = secs;
+		snapshot->upTime = (long) upTime;
+		fraction = clockFraction;
+		elapsed = (TCNT - tickTcnt) & 0xFFFFU;
+	}
+	while((sequence & 1) || sequence != clockSequence);
+
+	units = (unsigned long) fraction + (elapsed / CLOCK_CYCLES_PER_UNIT);
+	snapshot->millis = (int) ((units * 8UL) / 125UL); /*64 us units*/
+
+	if(snapshot->millis > 999)
+	{
+		snapshot->millis = 999; /*The tick which starts the next second is due*/
+	}
+}
+
+/* 
+	Function Name: setClock
+	Purpose: Sets the clock, starting the second at the last tick. Interrupts are held off for the stores
+			 only, so timer() can not run part way through
+	Params: (int) newHours - Hours to set
+			(int) newMins - Minutes to set
+			(int) newSecs - Seconds to set
+	Returns: (void)
+*/
+void setClock(int newHours, int newMins, int newSecs)
+{
+	DISABLE_INTERRUPTS();
+	clockSequence++;
+	hours = newHours;
+	mins = newMins;
+	secs = newSecs;
+	clockFraction = 0;
+	clockSequence++;
+	ENABLE_INTERRUPTS();
+
+	doseCoreClockChanged(&doseState);
+}
+
+/* 
+	Function Name: serviceAlarm
+	Purpose: Calls functions that must be executed every second. These functions are:
+				- emergencyOverride - Overrides system if switch is enabled
+				- serviceDoses - Delivers scheduled doses and boosts
+				- serviceTelemetry - Sends telemetry record when due
+	Params: none
+	Returns: (void)
+*/
+void serviceAlarm()
+{
+	unsigned char emergencySwitch;
+
+	SIM_TIMELINE_BEGIN(SIM_EVENT_SERVICE, 0);
+	alarm = 0; /*Cleared first, as output queued from here may wait for the line and service the next second*/
+	emergencySwitch = PADR & PADR_EMERGENCY;
+	updateClockDisp = 1;
+
+	if(emergencySwitch > 1)
+	{
+		emergencyOverride(1);
+	}
+
+	if(suspended == 0)
+	{
+		serviceDoses();
+	}
+
+	serviceTelemetry();
+	SIM_TIMELINE_END(SIM_EVENT_SERVICE);
+}
+
+/* 
+	Function Name: serviceDoses
+	Purpose: Runs the dosing core for this second and carries out the deliveries it asks for
+	Params: none
+	Returns: (void)
+*/
+void serviceDoses()
+{
+	struct clockTime now;
+	struct doseAction actions[CORE_MAX_ACTIONS];
+	int count;
+	int i;
+
+	readClock(&now);
+	count = doseCoreTick(&doseState, &now, PADR & PADR_BOOST, actions);
+
+	for(i = 0; i < count; i++)
+	{
+		if(actions[i].type == CORE_DELIVER_DOSE)
+		{
+			deliverMotorDose(actions[i].intensity, actions[i].index + 1);
+			journalAppend(JOURNAL_DOSE, actions[i].index | (actions[i].intensity ? 0x80 : 0));
+		}
+		else if(actions[i].type == CORE_DELIVER_BOOST)
+		{
+			deliverMotorDose(actions[i].intensity, MAX_DOSES + 1);
+			journalAppend(JOURNAL_BOOST, MAX_DOSES | (actions[i].intensity ? 0x80 : 0));
+		}
+		else if(actions[i].type == CORE_WITHHELD)
+		{
+			journalAppend(JOURNAL_WITHHELD, actions[i].index | (actions[i].intensity ? 0x80 : 0));
+		}
+		else if(actions[i].type == CORE_BOOST_STUCK)
+		{
+			journalAppend(JOURNAL_BOOST_STUCK, MAX_DOSES);
+			serialAlarm("\r\nBoost switch may be stuck\r\n");
+		}
+
+		updateInfoDisp = 1;
+	}
+}
+
+/* 
+	Function Name: getStringSerial
+	Purpose: Builds string using custom getChar function
+	Params: (char *) fullString - Pointer to destination array for full string
+			(int) maxLength - Integer indicating size of array
+	Returns: (int) 0
+*/
+int getStringSerial(char * fullString, int maxLength)
+{
+	char *stringPoint;
+	char currentChar;
+	int noOfChars = 0;
+
+		
+	stringPoint = fullString; /*create a pointer, as we don't know how big the string will be*/
+	
+	for (;;){
+		
+		currentChar = getCharSerial(); /*Get the individual character from the serial port*/
+		
+		if(currentChar == 0x1B) /* Escape */
+		{
+			fullString[0] = 0x1B;
+			break;	
+		}
+		
+		/*dealing with backspace*/
+		if(currentChar == 0x08)
+		{ 
+			putchar(0x08);		
+			putchar(' '); /*print the backspace and a blank space to the screen, this will overwrite the old character*/
+			/*stringPoint--;	move the pointer to remove the deleted character*/
+				
+			printf("%c", currentChar);		
+			if(noOfChars > 0){ /*Removes 1 from the total if there was characters existing in the first place, to stop the program creating negative numbers by pressing backspace at the begining of the string*/
+				noOfChars = noOfChars - 1;
+				stringPoint--;
+			}								
+		}
+		else if((noOfChars+1) >= maxLength)
+		{
+			currentChar == 0xFF;
+		}
+		
+		else if(currentChar != 0x0d && currentChar != 0xFF)
+		{ /*Make sure currentChar isn't backspace or FF, the character that's returned after the alarm has been triggered and handled*/
+			printf("%c",currentChar); 
+			*(stringPoint++) = currentChar; /*set the current location of the pointer to the current character*/
+			noOfChars = noOfChars + 1;
+		}
+		
+		
+		if(currentChar == 0x0d) /*dealing with when the enter key is pressed*/
+		{ 	*stringPoint = '\0'; /* terminate string*/
+			break; /*when enter is pressed, break out of the infinte for loop, so the string can be terminated and return*/
+		}
+		
+	}
+	return 0;
+}
+
+/* 
+	Function Name: getCharSerial
+	Purpose: Get individually input character from the serial receive buffer
+	Params: none
+	Returns: (int) currentChar - Value of char input, cast to an int for comparisons
+*/
+int getCharSerial()
+{
+	char currentChar;
+	
+	while (rxHead == rxTail && alarm == 0) /*while the alarm is 0 and nothing has been received the data entry is just sitting idle, so sleep until the next interrupt*/
+	{
+		waitForInterrupt();
+	}
+	
+	if(alarm == 0)
+	{
+	 currentChar = rxBuffer[rxTail]; /*Take the oldest character received by serialInterrupt*/
+	 rxTail = (rxTail + 1) & (RX_BUFFER_SIZE - 1);
+	}
+	
+	if(alarm == 1) /*Alarm will only equal 1 when too much time has elapsed*/
+	{ 
+		serviceAlarm();
+		return -1;
+	}
+	
+	return (int) currentChar;
+}
+
+/* Interrupt Function - SCI (SVEC 14)
+	Function Name: serialInterrupt
+	Purpose: Moves a received character from the serial data register into the receive buffer, and sends the
+			 next byte from the transmit lanes once the transmitter is free. Characters received while the
+			 buffer is full are dropped. The transmit interrupt is turned off when every lane is empty
+	Params: none
+	Returns: (void)
+*/
+INTERRUPT void serialInterrupt(void)
+{
+	unsigned char receivedChar;
+	unsigned char nextHead;
+	struct serialLane * queue;
+	int lane;
+	int chosen = -1;
+	unsigned char value;
+	unsigned long delay;
+
+	if(SCSR & SCSR_RDRF)
+	{
+		receivedChar = SCDR; /*Reading SCSR then SCDR clears the receive flag*/
+		SIM_SERIAL_READ();
+		nextHead = (rxHead + 1) & (RX_BUFFER_SIZE - 1);
+
+		if(nextHead != rxTail)
+		{
+			rxBuffer[rxHead] = receivedChar;
+			rxHead = nextHead;
+		}
+	}
+
+	if(!(SCCR2 & SCCR2_TIE) || !(SCSR & SCSR_TDRE))
+	{
+		return;
+	}
+
+	for(lane = 0; lane < SERIAL_LANES; lane++)
+	{
+		if(serialLanes[lane].frame != 0 && serialLanes[lane].head != serialLanes[lane].tail)
+		{
+			chosen = lane; /*Keeps the line until the frame or sequence is finished*/
+			break;
+		}
+	}
+
+	for(lane = 0; lane < SERIAL_LANES && chosen < 0; lane++)
+	{
+		if(serialLanes[lane].head != serialLanes[lane].tail)
+		{
+			if(serialLanes[lane].credit > 0)
+			{
+				chosen = lane;
+				break;
+			}
+
+			if(chosen < 0)
+			{
+				chosen = lane; /*Used if no lane with anything queued has budget left*/
+			}
+		}
+	}
+
+	if(chosen < 0 || serialLanes[chosen].head == serialLanes[chosen].tail)
+	{
+		SCCR2 &= ~SCCR2_TIE; /*Turned back on when more is queued*/
+		return;
+	}
+
+	queue = &serialLanes[chosen];
+	value = queue->buffer[queue->tail];
+	SCDR = value; /*Writing SCDR after reading SCSR clears the transmit flag*/
+	SIM_SERIAL_WRITE();
+
+	if(chosen == LANE_TELEMETRY)
+	{
+		queue->frame = (value == TELEMETRY_FLAG) ? !queue->frame : queue->frame;
+	}
+	else if(value == 0x1B)
+	{
+		queue->frame = 1;
+	}
+	else if(queue->frame == 1 && value == '[')
+	{
+		queue->frame = 2;
+	}
+	else if(queue->frame != 0 && value >= 0x40 && value <= 0x7E)
+	{
+		queue->frame = 0; /*Final byte of the sequence*/
+	}
+
+	if(queue->timing && queue->tail == queue->timedPosition)
+	{
+		delay = SERIAL_STAMP() - queue->timedStamp; /*Clock units, wrapping after about 76 hours*/
+		queue->delays++;
+		queue->delayTotal += delay;
+
+		if(delay > queue->delayMax)
+		{
+			queue->delayMax = delay;
+		}
+
+		queue->timing = 0;
+	}
+
+	queue->tail = (queue->tail + 1) & queue->mask;
+	queue->credit--;
+	queue->sent++;
+}
+
+/* 
+	Function Name: waitForInterrupt
+	Purpose: Stops the processor until the next interrupt (SCI, RTI or TOC2), marking the time as idle
+	Params: none
+	Returns: (void)
+*/
+void waitForInterrupt()
+{
+	cpuIdle = 1;
+	WAIT_FOR_INTERRUPT();
+	cpuIdle = 0;
+}
+
+/* 
+	Function Name: serialPut
+	Purpose: Queues a byte on a transmit lane, waiting while the lane is full. While UI text waits the second's
+			 doses and alarms are still serviced, and the rest of a live monitor redraw is dropped once a newer
+			 one is wanted, so a slow line neither holds up a delivery nor sends a screen which is out of date
+	Params: (int) lane - LANE_ALARM, LANE_TELEMETRY or LANE_UI
+			(unsigned char) value - Byte to be sent
+	Returns: (void)
+*/
+void serialPut(int lane, unsigned char value)
+{
+	struct serialLane * queue = &serialLanes[lane];
+	unsigned int nextHead;
+
+	for(;;)
+	{
+		if(lane == LANE_UI && redrawing == 2)
+		{
+			queue->dropped++;
+			return;
+		}
+
+		nextHead = (queue->head + 1) & queue->mask;
+
+		if(nextHead != queue->tail)
+		{
+			break;
+		}
+
+		if(lane == LANE_UI && redrawing == 1 && updateInfoDisp)
+		{
+			redrawing = 2;
+		}
+		else if(lane == LANE_UI && alarm == 1)
+		{
+			serviceAlarm();
+		}
+		else
+		{
+			waitForInterrupt();
+		}
+	}
+
+	if(queue->timing == 0)
+	{
+		queue->timedPosition = queue->head;
+		DISABLE_INTERRUPTS();
+		queue->timedStamp = SERIAL_STAMP();
+		ENABLE_INTERRUPTS();
+		queue->timing = 1;
+	}
+
+	queue->buffer[queue->head] = value;
+	queue->head = nextHead; /*Only now can the interrupt send it*/
+	SCCR2 |= SCCR2_TIE;
+	SIM_SERIAL_TRANSMIT();
+}
+
+/* 
+	Function Name: serialPutchar
+	Purpose: Queues a character of text on the UI lane. Stands in for putchar, which printf writes through
+	Params: (int) outputChar - Character to be sent
+	Returns: (int) outputChar
+*/
+int serialPutchar(int outputChar)
+{
+	serialPut(LANE_UI, (unsigned char) outputChar);
+
+	return outputChar;
+}
+
+/* 
+	Function Name: serialAlarm
+	Purpose: Queues an alarm message on the alarm lane, which is sent ahead of any text already queued
+	Params: (char *) text - Message to be sent
+	Returns: (void)
+*/
+void serialAlarm(char * text)
+{
+	while(*text != '\0')
+	{
+		serialPut(LANE_ALARM, (unsigned char) *text++);
+	}
+}
+
+/* 
+	Function Name: serialDiscard
+	Purpose: Empties a transmit lane without sending what was queued on it
+	Params: (int) lane - Lane to be emptied
+	Returns: (void)
+*/
+void serialDiscard(int lane)
+{
+	DISABLE_INTERRUPTS();
+	serialLanes[lane].dropped += (serialLanes[lane].head - serialLanes[lane].tail) & serialLanes[lane].mask;
+	serialLanes[lane].head = serialLanes[lane].tail;
+	serialLanes[lane].timing = 0;
+	serialLanes[lane].frame = 0;
+	ENABLE_INTERRUPTS();
+}
+
+/*  
+	Function Name: validateTimeInput
+	Purpose: Validate whether the given time is a valid time value (supports values with leading 0)
+	Params: (char *) userInput - Pointer to input value
+	Returns: (int) result - Validation result - -1 for failure
+*/
+
+int validateTimeInput(char * userInput)
+{
+	int stringSize = 0;
+	int result = 0;
+	
+	stringSize = strlen(userInput);
+	
+	if(stringSize > 2)
+	{
+		printf("\n[%s]Input value is too long", userInput);
+		result = -1;
+	}
+	
+	if(result == 0)
+	{
+		if(stringSize == 0)
+		{
+			printf("\nPlease enter a number");
+			result = -1;
+		}
+	}
+	
+	if(result == 0) /*If validation has not already failed*/
+	{
+		if((int) userInput[0] < 0x30 || (int) userInput[0] > 0x39)
+		{
+			printf("\nPlease only use numbers");
+			result = -1;	
+		}
+	}
+	
+	if(result == 0) /*If validation has not already failed*/
+	{
+		if(stringSize == 2)
+		{
+			if((int) userInput[1] < 0x30 || (int) userInput[1] > 0x39)
+			{
+				printf("\nPlease only use numbers");
+				result = -1;	
+			}			
+		}
+	}
+	
+	
+	if(result == 0) /*Unmodified 'result' variable means that validation has passed*/
+	{
+		result = 1;
+	}
+
+	return result;
+}
+
+/*  
+	Function Name: clearScreen
+	Purpose: Removes all text from screen and sets cursor to top left of screen
+	Params: none
+	Returns: (void)
+*/
+void clearScreen(void)
+{
+	/*Below is an ANSI Escape Sequence
+	\033 Represents Esc 
+	[2J erases display
+	[H moves cursor to specified position, or 0,0 if no position is specified*/
+	printf("\033[2J\033[H"); 
+}
+
+/*  
+	Function Name: setPatientInformation
+	Purpose: Set values containing patient personal information
+	Params: (int) initialRunComplete - Flag to indicate if information is being initialised or overwritten
+	Returns: (void)
+*/
+void setPatientInformation(int initialRunComplete)
+{
+	char name [20];
+	char surname [20];
+	char id [10];
+	char intensity [2];
+	char yesNo [2];
+	int i;
+	int validResponse = 0;
+
+	printf("\nPlease set patient forename: ");
+	getStringSerial(name, 20);
+	strcpy(patientInfo.forename, name);
+
+	printf("\nPlease set patient surname: ");
+	getStringSerial(surname, 20);
+	strcpy(patientInfo.surname, surname);
+
+	printf("\nPlease set patient id: ");
+	getStringSerial(id, 10);
+	strcpy(patientInfo.id, id);
+
+	do
+	{
+		printf("\nSet patient's boost intensity, a. 50%% b.100%%: ");
+		getStringSerial(intensity, 2);
+
+		if(intensity[0] == 'a')
+		{
+			doseState.boostIntensity = 1;
+			validResponse = 1;
+		}
+
+		if(intensity[0] == 'b')
+		{
+			doseState.boostIntensity = 0;
+			validResponse = 1;
+		}
+
+		if(validResponse != 1)
+		{
+			printf("\nPlease only use the characters 'a' and 'b' to indicate your choice\n");
+		}
+	}
+	while(validResponse != 1);
+
+	updateInfoDisp = 1;
+
+	if(initialRunComplete)
+	{
+	do
+	{
+		printf("\nWould you like to reset the system? (This includes scheduled doses and administered boosts)\na. Yes b. No\n");
+		getStringSerial(yesNo, 2);
+
+		if(yesNo[0] == 'a')
+		{
+			doseCoreReset(&doseState);
+			validResponse = 1;
+		}
+
+		if(yesNo[0] == 'b')
+		{
+			validResponse = 1;
+		}
+
+		if(validResponse != 1)
+		{
+			printf("\nPlease only use characters 'a' and 'b' to indicate your choice\n");
+		}
+	}
+	while(validResponse != 1);
+	}
+}
+
+/*  
+	Function Name: printPatientInfo
+	Purpose: Print the patient information on screen with formatting
+	Params: none
+	Returns: (void)
+*/
+void printPatientInfo()
+{
+	printf("\nPatient name: %s %s", patientInfo.forename, patientInfo.surname);
+	printf("\nID: %s", patientInfo.id);
+}
+
+/*  
+	Function Name: printBoostStatus
+	Purpose: Print the current boost status - how many boosts have been delivered, and list the intensity
+	Params: none
+	Returns: (void)
+*/
+void printBoostStatus()
+{
+	int i;
+	char intensityString[5];
+	long sinceBoost;
+	struct clockTime now;
+
+	if(doseState.boostIntensity == 1)
+	{
+		strcpy(intensityString, "50");
+	}
+	else
+	{
+		strcpy(intensityString, "100");
+	}
+
+	printf("\n%d of %d boosts delivered     -     Intensity: %s%%", doseState.boostsGiven, MAX_BOOSTS, intensityString);
+
+	if(doseState.boostsGiven > 0)
+	{
+		for(i = 0; i < doseState.boostsGiven; i++)
+		{
+			printf("\nBoost #%d delivered at %02d:%02d:%02d.%03d", (i + 1), doseState.boostTimes[i].hours, doseState.boostTimes[i].mins,
+				doseState.boostTimes[i].secs, doseState.boostTimes[i].millis);
+		}
+	}
+
+	readClock(&now);
+	sinceBoost = doseCoreSinceBoost(&doseState, &now);
+
+	if(sinceBoost != NO_BOOST)
+	{
+		printf("\nLast boost %ld:%02ld ago", sinceBoost / 3600L, (sinceBoost / 60L) % 60L);
+	}
+	printf("\n");
+}
+
+/*  UNUSED
+	Function Name: validateTimeBetweenDoses 
+	Purpose: Validate that the new dose is not too close to an existing dose
+	Params: (struct dose) inputTime - Structure containing time input by user
+	Returns: (int) validationResult - Result of validation, -1 for failure
+*/
+int validateTimeBetweenDoses(struct dose inputTime)
+{
+	int validationResult = 0;
+	int i = 0;
+	struct dose fiveMinsPrior;
+	struct dose fiveMinsAhead;
+
+	fiveMinsAhead = advanceFiveMinutes(inputTime);
+	fiveMinsPrior = removeFiveMinutes(inputTime);
+
+	for(i = 0; i < doseState.schedule->scheduledDoses; i++)
+	{
+		if(doseState.schedule->doses[i].hours == fiveMinsAhead.hours)
 		{
-			hours = atoi(hourString);
-			
-			if(hours > 23)
+			if(doseState.schedule->doses[i].mins == fiveMinsAhead.mins)
 			{
-				printf("\nHours should only be 0-23");
 				validationResult = -1;
+				break;
 			}
 		}
-	}
-	
-	validationResult = 0; /* Reset Validation status */
-	
-	while(validationResult != 1)
-	{
-		printf("\nPlease set current mins: ");
-		getStringSerial(minString, 3);
-		
-		validationResult = validateTimeInput(minString);
-		
-		if(validationResult == 1)
+		if(doseState.schedule->doses[i].hours == fiveMinsPrior.hours)
 		{
-			mins = atoi(minString);
-			
-			if(mins > 60)
+			if(doseState.schedule->doses[i].mins == fiveMinsPrior.mins)
 			{
-				printf("\nMins should only be 0-59");
 				validationResult = -1;
+				break;
 			}
 		}
 	}
-	
-	validationResult = 0;
-	
-	while(validationResult != 1)
+
+	if(validationResult != -1)
 	{
-		printf("\nPlease set current secs: ");
-		getStringSerial(secString, 3);
-		
-		validationResult = validateTimeInput(secString);
-		
-		if(validationResult == 1)
-		{
-			secs = atoi(secString);
-			
-			if(secs > 60)
-			{
-				printf("\nSecs should only be 0-59");
-				validationResult = -1;
-			}
-		}
-	}		
+		validationResult = 1;
+	}
+
+	return validationResult;
 }
 
-/* 
-	Function Name: serviceAlarm
-	Purpose: Calls functions that must be executed every second. These functions are:
-				- emergencyOverride - Overrides system if switch is enabled
-				- verifyDoseTime - Checks if scheduled dose should be delivered
-				- verifyBoostTime - Validates and delivers boost
-	Params: none
-	Returns: (void)
+/*  UNUSED
+	Function Name: advanceFiveMinutes
+	Purpose: Advance the input time by 5 minutes
+	Params: (struct dose) originalTime - Time to be advanced
+	Returns: (struct dose) newTime - Original time advanced by 5 minutes
 */
-void serviceAlarm()
+struct dose advanceFiveMinutes(struct dose originalTime)
 {
-	unsigned char emergencySwitch;
+	struct dose newTime;
+	int tempNum = 0;
+	int minsDifference = 0;
 
-	emergencySwitch = *padr &0x04;
-	updateClockDisp = 1;
+	if(originalTime.mins > 54)
+	{
+		newTime.hours = (originalTime.hours + 1);
 
-	if(emergencySwitch > 1)
+		if(newTime.hours == 24)
+		{
+			newTime.hours = 0;
+		}
+	}
+	else
 	{
-		emergencyOverride(1);
+		newTime.hours = originalTime.hours;
 	}
 
-	if(suspended == 0)
+	newTime.mins = (originalTime.mins + 5);
+
+	if(newTime.mins > 59)
 	{
-		verifyDoseTime();
-		verifyBoostTime();		
+		tempNum = 60 - newTime.mins; /*How many mins from 60*/
+		minsDifference = 5 - tempNum; /*Take that away from 5*/
+		newTime.mins = (0 + minsDifference);
 	}
-	alarm = 0;	
+
+	newTime.secs = 0;
+
+	return newTime;
 }
 
-/* 
-	Function Name: getStringSerial
-	Purpose: Builds string using custom getChar function
-	Params: (char *) fullString - Pointer to destination array for full string
-			(int) maxLength - Integer indicating size of array
-	Returns: (int) 0
+/*  UNUSED
+	Function Name: removeFiveMinutes
+	Purpose: Remove 5 minutes from the input time
+	Params: (struct dose) originalTime - Time to be altered
+	Returns: (struct dose) newTime - Original time with 5 minutes removed
 */
-int getStringSerial(char * fullString, int maxLength)
+struct dose removeFiveMinutes(struct dose originalTime)
 {
-	char *stringPoint;
-	char currentChar;
-	int noOfChars = 0;
+	struct dose newTime;
+	int tempNum = 0;
+	int minsDifference = 0;
+	int wrappedTime = 0;
 
-		
-	stringPoint = fullString; /*create a pointer, as we don't know how big the string will be*/
-	
-	for (;;){
-		
-		currentChar = getCharSerial(); /*Get the individual character from the serial port*/
-		
-		if(currentChar == 0x1B) /* Escape */
+	if(originalTime.mins <= 4)
+	{
+		newTime.hours = (originalTime.hours - 1);
+
+		if(newTime.hours == 0)
 		{
-			fullString[0] = 0x1B;
-			break;	
-		}
-		
-		/*dealing with backspace*/
-		if(currentChar == 0x08)
-		{ 
-			putchar(0x08);		
-			putchar(' '); /*print the backspace and a blank space to the screen, this will overwrite the old character*/
-			/*stringPoint--;	move the pointer to remove the deleted character*/
-				
-			printf("%c", currentChar);		
-			if(noOfChars > 0){ /*Removes 1 from the total if there was characters existing in the first place, to stop the program creating negative numbers by pressing backspace at the begining of the string*/
-				noOfChars = noOfChars - 1;
-				stringPoint--;
-			}								
+			wrappedTime = 1; /*Don't worry about yesterday's doses*/
 		}
-		else if((noOfChars+1) >= maxLength)
+	}
+	else
+	{
+		newTime.hours = originalTime.hours;
+	}
+
+	if(wrappedTime != 1) 
+	{
+		if(newTime.mins <= 4)
 		{
-			currentChar == 0xFF;
-		}
-		
-		else if(currentChar != 0x0d && currentChar != 0xFF)
-		{ /*Make sure currentChar isn't backspace or FF, the character that's returned after the alarm has been triggered and handled*/
-			printf("%c",currentChar); 
-			*(stringPoint++) = currentChar; /*set the current location of the pointer to the current character*/
-			noOfChars = noOfChars + 1;
+			minsDifference = 5 - newTime.mins;
+			newTime.mins = 60 - minsDifference;
 		}
-		
-		
-		if(currentChar == 0x0d) /*dealing with when the enter key is pressed*/
-		{ 	*stringPoint = '\0'; /* terminate string*/
-			break; /*when enter is pressed, break out of the infinte for loop, so the string can be terminated and return*/
+		else
+		{
+			printf("\nnew mins before: %d", newTime.mins);
+			newTime.mins = (originalTime.mins - 5);
+			printf("\nnew mins after: %d", newTime.mins);
 		}
-		
 	}
-	return 0;
-}
 
-/* 
-	Function Name: getCharSerial
-	Purpose: Get individually input character from the serial data register
-	Params: none
-	Returns: (int) currentChar - Value of char input, cast to an int for comparisons
-*/
-int getCharSerial()
-{
-	char currentChar;
-	
-	while (!(*scsr & 0x20) && alarm == 0); /*while the alarm is 0 and the scsr is free, meaning the data entry is just sitting idle*/
-	
-	if(alarm == 0)
-	{
-	 currentChar = *scdr; /*Currently stored in the scdr is the current character, put that into currentChar so that the scdr can be freed again*/
-	}
-	
-	if(alarm == 1) /*Alarm will only equal 1 when too much time has elapsed*/
-	{ 
-		serviceAlarm();
-		return -1;
-	}
-	
-	return (int) currentChar;
+
+	printf("\nOG mins: %d", originalTime.mins);
+	newTime.secs = 0;
+
+	return newTime;
 }
 
-/*  
-	Function Name: validateTimeInput
-	Purpose: Validate whether the given time is a valid time value (supports values with leading 0)
-	Params: (char *) userInput - Pointer to input value
-	Returns: (int) result - Validation result - -1 for failure
+/*  Interrupt Function - TOC 2 (SVEC C)
+	Function Name: turnMotor
+	Purpose: Sets up the next servo frame once the motor pulse has ended. OC1 raises A6 and OC2 lowers it in
+			 hardware, so the edges have no interrupt latency in them and this runs once a frame. Both compares
+			 step on from the last frame rather than from TCNT, so the period is exact and a pulse width set
+			 here is sent in full the next frame
+	Params: none
+	Returns: (void)
 */
-
-int validateTimeInput(char * userInput)
+INTERRUPT void turnMotor()
 {
-	int stringSize = 0;
-	int result = 0;
-	
-	stringSize = strlen(userInput);
-	
-	if(stringSize > 2)
+	if (motorRunning == 1)
 	{
-		printf("\n[%s]Input value is too long", userInput);
-		result = -1;
+		PADR |= (unsigned char) ~PADR_PULSE; /*LEDs only, A6 belongs to OC1 and OC2*/
 	}
-	
-	if(result == 0)
+	else
 	{
-		if(stringSize == 0)
-		{
-			printf("\nPlease enter a number");
-			result = -1;
-		}
+		PADR &= PADR_PULSE;
 	}
-	
-	if(result == 0) /*If validation has not already failed*/
+
+	if(deliverDoseFlag > 0)
 	{
-		if((int) userInput[0] < 0x30 || (int) userInput[0] > 0x39)
+		motorRunning = 1;
+
+		if(cycles >= SERVO_PERIODS_PER_DELIVERY)
 		{
-			printf("\nPlease only use numbers");
-			result = -1;	
+			cycles = 0;
+			resetMotor();
 		}
-	}
-	
-	if(result == 0) /*If validation has not already failed*/
-	{
-		if(stringSize == 2)
+		else
 		{
-			if((int) userInput[1] < 0x30 || (int) userInput[1] > 0x39)
-			{
-				printf("\nPlease only use numbers");
-				result = -1;	
-			}			
+			cycles++;
 		}
 	}
-	
-	
-	if(result == 0) /*Unmodified 'result' variable means that validation has passed*/
+
+	TFLG1 = OC2_FLAG; /*Clear TOC2 Flag*/
+	servoFrame = (servoFrame + SERVO_PERIOD) & 0xFFFFU;
+	TOC1 = servoFrame;
+	TOC2 = servoFrame + pulseDelay;
+}
+
+/*  
+	Function Name: deliverMotorDose
+	Purpose: Set the pulse delay for the motor based on the intensity of the dose to be delivered. The delivery
+			 is flagged before any frame is set up at the dose position, so turnMotor counts every one of them
+	Params: (int) intensity - Flag indicating if the dose to be delivered is a half or full dose
+			(int) doseIndex - Index of dose to be delivered
+	Returns: (int) doseIndex - Index of dose delivered
+*/
+int deliverMotorDose(int intensity, int doseIndex)
+{
+	SIM_TIMELINE_BEGIN(SIM_EVENT_DELIVERY, doseIndex);
+	DISABLE_INTERRUPTS();
+	motorRunning = 1;
+	pulseDelay = doseCorePulseDelay(intensity);
+
+	/*Until the next frame starts its width can still be changed, otherwise turnMotor sets the one after*/
+	if(((servoFrame - TCNT) & 0xFFFFU) <= SERVO_PERIOD)
 	{
-		result = 1;
+		TOC2 = servoFrame + pulseDelay;
+
+		if(deliverDoseFlag == 0)
+		{
+			cycles++; /*That frame is at the dose position too. A delivery already running has counted it*/
+		}
+
+		SIM_COMPARE_WRITTEN();
 	}
 
-	return result;
+	deliverDoseFlag = doseIndex;
+	ENABLE_INTERRUPTS();
+
+	return doseIndex;
 }
 
 /*  
-	Function Name: clearScreen
-	Purpose: Removes all text from screen and sets cursor to top left of screen
+	Function Name: resetMotor
+	Purpose: Set the pulse delay to turn the motor all the way to the left, and reset all associated flags
 	Params: none
 	Returns: (void)
 */
-void clearScreen(void)
+void resetMotor()
 {
-	/*Below is an ANSI Escape Sequence
-	\033 Represents Esc 
-	[2J erases display
-	[H moves cursor to specified position, or 0,0 if no position is specified*/
-	printf("\033[2J\033[H"); 
+	SIM_TIMELINE_END(SIM_EVENT_DELIVERY);
+	motorRunning = 0;
+	deliverDoseFlag = 0;
+	pulseDelay = PULSE_REST;
 }
 
 /*  
-	Function Name: setPatientInformation
-	Purpose: Set values containing patient personal information
-	Params: (int) initialRunComplete - Flag to indicate if information is being initialised or overwritten
+	Function Name: emergencyOverride
+	Purpose: Prevent any further action being taken by the system
+	Params: (int) statusCode - An integer indicating the reason for the override
 	Returns: (void)
 */
-void setPatientInformation(int initialRunComplete)
+void emergencyOverride(int statusCode)
 {
-	char name [20];
-	char surname [20];
-	char id [10];
-	char intensity [2];
-	char yesNo [2];
-	int i;
-	int validResponse = 0;
+	suspended = 1;
+	journalAppend(JOURNAL_EMERGENCY, statusCode);
+	serialDiscard(LANE_UI); /*Nothing queued before the alarm is sent after it*/
+	serialDiscard(LANE_TELEMETRY);
+	serialAlarm("\033[2J\033[HEmergency Mode active\nReason: ");
 
-	printf("\nPlease set patient forename: ");
-	getStringSerial(name, 20);
-	strcpy(patientInfo.forename, name);
+	switch(statusCode)
+	{
+		case 1:
+		serialAlarm("\nManual override engaged\nPlease restart the system");
+		break;
 
-	printf("\nPlease set patient surname: ");
-	getStringSerial(surname, 20);
-	strcpy(patientInfo.surname, surname);
+		case 2:
+		serialAlarm("\nAn unexpected error occurred\nPlease restart the system");
+		break;
+	}
+	while(1)
+	{
+		waitForInterrupt();
+	}
+}
+
+/*  
+	Function Name: editDoseTime
+	Purpose: Accept a new dose time from the user, and overwrite the selected dose with the new time. The dose
+			 may fall due while the prompts wait, so it is checked again before it is changed
+	Params: none
+	Returns: (void)
+*/
+void editDoseTime()
+{
+	char userInput [3];
+	int doseToChange;
+	int validationResult = 0;
+
+	clearScreen();
 
-	printf("\nPlease set patient id: ");
-	getStringSerial(id, 10);
-	strcpy(patientInfo.id, id);
 
 	do
 	{
-		printf("\nSet patient's boost intensity, a. 50%% b.100%%: ");
-		getStringSerial(intensity, 2);
+		printf("\nWhich dose would you like to edit?\n");
+		printAllDoses();
+		getStringSerial(userInput, 3);
+		doseToChange = (atoi(userInput) - 1);
 
-		if(intensity[0] == 'a')
+		if(doseToChange > (doseState.schedule->scheduledDoses - 1))
 		{
-			boostIntensity = 1;
-			validResponse = 1;
+			printf("Invalid dose\n");
+			validationResult = -1;
 		}
-
-		if(intensity[0] == 'b')
+		else
 		{
-			boostIntensity = 0;
-			validResponse = 1;
+			validationResult = 1;
 		}
 
-		if(validResponse != 1)
+		if(doseState.status[doseToChange] == 1)
 		{
-			printf("\nPlease only use the characters 'a' and 'b' to indicate your choice\n");
+			printf("Delivered doses cannot be edited\n");
+			validationResult = -1;
+		}
+		else
+		{
+			if(validationResult == 0)
+			{
+				validationResult = 1;
+			}
 		}
 	}
-	while(validResponse != 1);
+	while (validationResult != 1);
 
-	updateInfoDisp = 1;
+	validationResult = 0;
 
-	if(initialRunComplete)
-	{
 	do
 	{
-		printf("\nWould you like to reset the system? (This includes scheduled doses and administered boosts)\na. Yes b. No\n");
-		getStringSerial(yesNo, 2);
+		printf("\nDose %d at %2d:%2d is selected\nWhat would you like to do? \na. Edit Dose b. Remove Dose c. Cancel\n",
+			doseToChange + 1, doseState.schedule->doses[doseToChange].hours, doseState.schedule->doses[doseToChange].mins);
+		getStringSerial(userInput, 3);
 
-		if(yesNo[0] == 'a')
+		if(userInput[0] == 'a')
 		{
-			scheduledDoses = 0;
-			boostsGiven = 0;
-			validResponse = 1;
+			validationResult = 1;
+			setDoseTime(doseToChange);
 		}
 
-		if(yesNo[0] == 'b')
+		if(userInput[0] == 'b')
 		{
-			validResponse = 1;
+			validationResult = 1;
+
+			if(doseState.status[doseToChange] == 1)
+			{
+				printf("\nDose %d was delivered while it was selected, so it has not been removed", doseToChange + 1);
+			}
+			else
+			{
+				doseCoreRemoveDose(&doseState, doseToChange);
+			}
 		}
 
-		if(validResponse != 1)
+		if(userInput[0] == 'c')
 		{
-			printf("\nPlease only use characters 'a' and 'b' to indicate your choice\n");
+			validationResult = 1;
+		}
+
+		if(validationResult != 1)
+		{
+			printf("\nPlease only use the characters 'a', 'b' or 'c' to indicate your choice \n");
 		}
 	}
-	while(validResponse != 1);
-	}
+	while (validationResult != 1);
 }
 
 /*  
-	Function Name: printPatientInfo
-	Purpose: Print the patient information on screen with formatting
+	Function Name: serviceTelemetry
+	Purpose: Sends a telemetry record every telemetryInterval seconds. Records are delta encoded against the
+			 last record sent, and nothing is sent if nothing has changed, apart from a periodic keyframe.
+			 A record is held over while the telemetry lane has no room for it
 	Params: none
 	Returns: (void)
 */
-void printPatientInfo()
+void serviceTelemetry()
 {
-	printf("\nPatient name: %s %s", patientInfo.forename, patientInfo.surname);
-	printf("\nID: %s", patientInfo.id);
-}
+	struct telemetryRecord currentRecord;
+	int keyframe = 0;
 
-/*  
-	Function Name: printBoostStatus
-	Purpose: Print the current boost status - how many boosts have been delivered, and list the intensity
-	Params: none
-	Returns: (void)
-*/
-void printBoostStatus()
-{
-	int i;
-	char intensityString[5];
+	if(telemetryEnabled == 0)
+	{
+		return;
+	}
 
-	if(boostIntensity == 1)
+	if(telemetryKeyframeCountdown > 0)
 	{
-		strcpy(intensityString, "50");
+		telemetryKeyframeCountdown--;
 	}
-	else
+
+	if(telemetryCountdown > 0)
 	{
-		strcpy(intensityString, "100");
+		telemetryCountdown--;
+	}
+
+	if(telemetryCountdown > 0)
+	{
+		return;
+	}
+
+	if(LANE_TELEMETRY_SIZE - 1 - ((serialLanes[LANE_TELEMETRY].head - serialLanes[LANE_TELEMETRY].tail) & (LANE_TELEMETRY_SIZE - 1))
+		< TELEMETRY_MAX_BYTES)
+	{
+		serialLanes[LANE_TELEMETRY].deferred++; /*Tried again next second, the delta then covers both*/
+		return;
 	}
 
-	printf("\n%d of %d boosts delivered     -     Intensity: %s%%", boostsGiven, MAX_BOOSTS, intensityString);
+	telemetryCountdown = telemetryInterval;
 
-	if(boostsGiven > 0)
+	if(telemetryKeyframeCountdown == 0)
 	{
-		for(i = 0; i < boostsGiven; i++)
-		{
-			printf("\nBoost #%d delivered at %02d:%02d:%02d", (i + 1), boostTimes[i].hours, boostTimes[i].mins, boostTimes[i].secs);
-		}
+		keyframe = 1;
+		telemetryKeyframeCountdown = TELEMETRY_KEYFRAME_SECS;
 	}
-	printf("\n");
+
+	buildTelemetryRecord(&currentRecord);
+	sendTelemetryRecord(&currentRecord, keyframe);
 }
 
 /*  
-	Function Name: verifyBoostTime
-	Purpose: Validate whether a boost can be delivered
-	Params: none
+	Function Name: buildTelemetryRecord
+	Purpose: Fill a telemetry record with the current state of the system
+	Params: (struct telemetryRecord *) record - Pointer to the record to be filled
 	Returns: (void)
 */
-void verifyBoostTime()
+void buildTelemetryRecord(struct telemetryRecord * record)
 {
-	unsigned char switchIn;
+	long doseTime;
+	struct clockTime now;
 
-	switchIn = *padr &0x01;
+	readClock(&now);
+	record->clock = doseCoreSecondsOfDay(now.hours, now.mins, now.secs);
+	record->nextDoseIndex = doseCoreNextDose(&doseState, &now, &doseTime);
+	record->nextDoseTime = doseTime;
 
-	if(switchIn == 0)
+	if(record->nextDoseIndex == NO_DOSE)
 	{
-		previousSwitchStatus = 0;
-
-		if(boostError == 1)
-		{
-			boostError = 0;
-			updateInfoDisp = 1;
-		}	
+		record->nextDoseIndex = 0xFF; /*No pending dose*/
+		record->nextDoseTime = 0;
 	}
 
-	if(switchIn == 1)
-	{
-		if(previousSwitchStatus == 1)
-		{
-			if(boostError == 0)
-			{
-				boostError = 1;
-				updateInfoDisp = 1; 
-			}	
-		}
-
-		if(boostsGiven < MAX_BOOSTS && boostError == 0)
-		{
-			deliverBoost();
-		}
-		previousSwitchStatus = 1;
-	}
+	record->deliveryCount = doseState.deliveryEvents & 0xFF;
+	record->lastDelivery = deliverDoseFlag;
+	record->boostsGiven = doseState.boostsGiven;
+	record->flags = (doseState.boostError ? 0x01 : 0) | (suspended ? 0x02 : 0) | (motorRunning ? 0x04 : 0) | (doseState.budgetWithheld ? 0x08 : 0);
+	record->pulseDelay = pulseDelay;
+	record->scheduleVersion = (unsigned char) doseState.scheduleVersion;
 }
 
 /*  
-	Function Name: deliverBoost
-	Purpose: Sets flag to indicate that boost should be delivered, sets boost status to delivered
-	Params: none
+	Function Name: sendTelemetryRecord
+	Purpose: Encode and send a telemetry frame containing the fields which differ from the last record sent
+	Params: (struct telemetryRecord *) record - Pointer to the record to be sent
+			(int) keyframe - Flag indicating that every field should be sent
 	Returns: (void)
 */
-void deliverBoost()
-{
-	deliverDoseFlag = deliverMotorDose(boostIntensity, 11);
-	boostTimes[boostsGiven].hours = hours;
-	boostTimes[boostsGiven].mins = mins;
-	boostTimes[boostsGiven].secs = secs;
-
-	boostsGiven++;
-	updateInfoDisp = 1;
-}
-
-/*  UNUSED
-	Function Name: validateTimeBetweenDoses 
-	Purpose: Validate that the new dose is not too close to an existing dose
-	Params: (struct dose) inputTime - Structure containing time input by user
-	Returns: (int) validationResult - Result of validation, -1 for failure
-*/
-int validateTimeBetweenDoses(struct dose inputTime)
+void sendTelemetryRecord(struct telemetryRecord * record, int keyframe)
 {
-	int validationResult = 0;
-	int i = 0;
-	struct dose fiveMinsPrior;
-	struct dose fiveMinsAhead;
+	unsigned char mask = 0;
+	unsigned char checksum = 0;
+	long clockDelta;
 
-	fiveMinsAhead = advanceFiveMinutes(inputTime);
-	fiveMinsPrior = removeFiveMinutes(inputTime);
+	clockDelta = record->clock - lastTelemetry.clock;
 
-	for(i = 0; i < scheduledDoses; i++)
+	if(clockDelta < 0)
 	{
-		if(doseTimes[i].hours == fiveMinsAhead.hours)
-		{
-			if(doseTimes[i].mins == fiveMinsAhead.mins)
-			{
-				validationResult = -1;
-				break;
-			}
-		}
-		if(doseTimes[i].hours == fiveMinsPrior.hours)
-		{
-			if(doseTimes[i].mins == fiveMinsPrior.mins)
-			{
-				validationResult = -1;
-				break;
-			}
-		}
+		clockDelta += 86400L; /*Clock passed midnight*/
 	}
 
-	if(validationResult != -1)
+	if(keyframe || clockDelta > 0xFF)
 	{
-		validationResult = 1;
+		mask |= 0x01;
 	}
 
-	return validationResult;
-}
-
-/*  UNUSED
-	Function Name: advanceFiveMinutes
-	Purpose: Advance the input time by 5 minutes
-	Params: (struct dose) originalTime - Time to be advanced
-	Returns: (struct dose) newTime - Original time advanced by 5 minutes
-*/
-struct dose advanceFiveMinutes(struct dose originalTime)
-{
-	struct dose newTime;
-	int tempNum = 0;
-	int minsDifference = 0;
-
-	if(originalTime.mins > 54)
+	if(keyframe || record->nextDoseIndex != lastTelemetry.nextDoseIndex || record->nextDoseTime != lastTelemetry.nextDoseTime)
 	{
-		newTime.hours = (originalTime.hours + 1);
-
-		if(newTime.hours == 24)
-		{
-			newTime.hours = 0;
-		}
+		mask |= 0x02;
 	}
-	else
+
+	if(keyframe || record->deliveryCount != lastTelemetry.deliveryCount)
 	{
-		newTime.hours = originalTime.hours;
+		mask |= 0x04;
 	}
 
-	newTime.mins = (originalTime.mins + 5);
-
-	if(newTime.mins > 59)
+	if(keyframe || record->boostsGiven != lastTelemetry.boostsGiven)
 	{
-		tempNum = 60 - newTime.mins; /*How many mins from 60*/
-		minsDifference = 5 - tempNum; /*Take that away from 5*/
-		newTime.mins = (0 + minsDifference);
+		mask |= 0x08;
 	}
 
-	newTime.secs = 0;
+	if(keyframe || record->flags != lastTelemetry.flags)
+	{
+		mask |= 0x10;
+	}
 
-	return newTime;
-}
+	if(keyframe || record->pulseDelay != lastTelemetry.pulseDelay)
+	{
+		mask |= 0x20;
+	}
 
-/*  UNUSED
-	Function Name: removeFiveMinutes
-	Purpose: Remove 5 minutes from the input time
-	Params: (struct dose) originalTime - Time to be altered
-	Returns: (struct dose) newTime - Original time with 5 minutes removed
-*/
-struct dose removeFiveMinutes(struct dose originalTime)
-{
-	struct dose newTime;
-	int tempNum = 0;
-	int minsDifference = 0;
-	int wrappedTime = 0;
+	if(keyframe || record->scheduleVersion != lastTelemetry.scheduleVersion)
+	{
+		sendTelemetrySchedule();
+	}
 
-	if(originalTime.mins <= 4)
+	if((mask & 0x3E) == 0 && !keyframe)
 	{
-		newTime.hours = (originalTime.hours - 1);
+		lastTelemetry.scheduleVersion = record->scheduleVersion;
+		return; /*Only the clock has moved on, the host can infer that*/
+	}
 
-		if(newTime.hours == 0)
-		{
-			wrappedTime = 1; /*Don't worry about yesterday's doses*/
-		}
+	serialPut(LANE_TELEMETRY, TELEMETRY_FLAG);
+	putTelemetryByte(keyframe ? 'K' : 'D', &checksum);
+	putTelemetryByte(mask, &checksum);
+
+	if(mask & 0x01)
+	{
+		putTelemetryByte((unsigned char) (record->clock >> 16), &checksum);
+		putTelemetryByte((unsigned char) (record->clock >> 8), &checksum);
+		putTelemetryByte((unsigned char) record->clock, &checksum);
 	}
 	else
 	{
-		newTime.hours = originalTime.hours;
+		putTelemetryByte((unsigned char) clockDelta, &checksum);
 	}
 
-	if(wrappedTime != 1) 
+	if(mask & 0x02)
 	{
-		if(newTime.mins <= 4)
-		{
-			minsDifference = 5 - newTime.mins;
-			newTime.mins = 60 - minsDifference;
-		}
-		else
-		{
-			printf("\nnew mins before: %d", newTime.mins);
-			newTime.mins = (originalTime.mins - 5);
-			printf("\nnew mins after: %d", newTime.mins);
-		}
+		putTelemetryByte((unsigned char) record->nextDoseIndex, &checksum);
+		putTelemetryByte((unsigned char) (record->nextDoseTime >> 16), &checksum);
+		putTelemetryByte((unsigned char) (record->nextDoseTime >> 8), &checksum);
+		putTelemetryByte((unsigned char) record->nextDoseTime, &checksum);
 	}
 
+	if(mask & 0x04)
+	{
+		putTelemetryByte((unsigned char) record->deliveryCount, &checksum);
+		putTelemetryByte((unsigned char) record->lastDelivery, &checksum);
+	}
 
-	printf("\nOG mins: %d", originalTime.mins);
-	newTime.secs = 0;
+	if(mask & 0x08)
+	{
+		putTelemetryByte((unsigned char) record->boostsGiven, &checksum);
+	}
 
-	return newTime;
+	if(mask & 0x10)
+	{
+		putTelemetryByte((unsigned char) record->flags, &checksum);
+	}
+
+	if(mask & 0x20)
+	{
+		putTelemetryByte((unsigned char) (record->pulseDelay >> 8), &checksum);
+		putTelemetryByte((unsigned char) record->pulseDelay, &checksum);
+	}
+
+	checksum = (unsigned char) (0x100 - checksum);
+	putTelemetryByte(checksum, &checksum);
+	serialPut(LANE_TELEMETRY, TELEMETRY_FLAG);
+
+	lastTelemetry = *record;
 }
 
-/*  Interrupt Function - TOC 2 (SVEC C)
-	Function Name: turnMotor
-	Purpose: Create a PWM waveform in order to turn the motor
+/*  
+	Function Name: sendTelemetrySchedule
+	Purpose: Send a telemetry frame listing every scheduled dose
 	Params: none
 	Returns: (void)
 */
-@interrupt void turnMotor()
+void sendTelemetrySchedule()
 {
 	int i;
-	int localPulseDelay = pulseDelay;
+	long doseTime;
+	unsigned char checksum = 0;
 
-	if (motorRunning == 1)
+	serialPut(LANE_TELEMETRY, TELEMETRY_FLAG);
+	putTelemetryByte('S', &checksum);
+	putTelemetryByte((unsigned char) doseState.schedule->scheduledDoses, &checksum);
+
+	for(i = 0; i < doseState.schedule->scheduledDoses; i++)
 	{
-		*padr = 0xff;
+		doseTime = ((long) doseState.schedule->doses[i].hours * 3600L) + ((long) doseState.schedule->doses[i].mins * 60L) + doseState.schedule->doses[i].secs;
+
+		putTelemetryByte((unsigned char) (doseTime >> 16), &checksum);
+		putTelemetryByte((unsigned char) (doseTime >> 8), &checksum);
+		putTelemetryByte((unsigned char) doseTime, &checksum);
+		putTelemetryByte((unsigned char) ((doseState.status[i] == 1 ? 0x01 : 0) | (doseState.schedule->doses[i].intensity ? 0x02 : 0)
+			| (doseState.status[i] == 2 ? 0x04 : 0)), &checksum);
 	}
-	else
+
+	checksum = (unsigned char) (0x100 - checksum);
+	putTelemetryByte(checksum, &checksum);
+	serialPut(LANE_TELEMETRY, TELEMETRY_FLAG);
+}
+
+/*  
+	Function Name: putTelemetryByte
+	Purpose: Send a single byte of a telemetry frame, escaping it if it matches a framing character
+	Params: (unsigned char) value - Byte to be sent
+			(unsigned char *) checksum - Pointer to the running checksum of the frame
+	Returns: (void)
+*/
+void putTelemetryByte(unsigned char value, unsigned char * checksum)
+{
+	*checksum += value;
+
+	if(value == TELEMETRY_FLAG || value == TELEMETRY_ESCAPE)
 	{
-		*padr = 0x00;
+		serialPut(LANE_TELEMETRY, TELEMETRY_ESCAPE);
+		serialPut(LANE_TELEMETRY, value ^ 0x20);
 	}
-
-	if(deliverDoseFlag > 0)
+	else
 	{
-		cycles++;
-		motorRunning = 1;
+		serialPut(LANE_TELEMETRY, value);
 	}
+}
+
+/*  
+	Function Name: configureTelemetry
+	Purpose: Enable or disable the telemetry stream and set the number of seconds between records
+	Params: none
+	Returns: (void)
+*/
+void configureTelemetry()
+{
+	char yesNo [2];
+	char intervalString [3] = "";
+	int validResponse = 0;
 
-	if(motorOn == 0)
+	do
 	{
-		/*On*/
-		*pgdr = 0x1;
-		motorOn = 1;
-		*tflg1=0x40; /*Clear TOC2 Flag*/
-		*toc2=*tcnt+localPulseDelay; /*Read timer and add offset period*/
+		printf("\nEnable binary telemetry stream? a. Yes b. No\n");
+		getStringSerial(yesNo, 2);
+
+		if(yesNo[0] == 'a')
+		{
+			telemetryEnabled = 1;
+			validResponse = 1;
+		}
+
+		if(yesNo[0] == 'b')
+		{
+			telemetryEnabled = 0;
+			validResponse = 1;
+		}
+
+		if(validResponse != 1)
+		{
+			printf("\nPlease only use characters 'a' and 'b' to indicate your choice\n");
+		}
 	}
-	else
+	while(validResponse != 1);
+
+	if(telemetryEnabled == 0)
 	{
-		/*Off*/
-		*pgdr = 0x00;
-		motorOn = 0;
-		*tflg1=0x40;/*Clear TOC2 Flag*/
-		*toc2=*tcnt+(fullCycleTime - localPulseDelay); /*Read timer and add offset period*/
+		return;
 	}
 
-	if(cycles > 100 && deliverDoseFlag > 0)
+	validResponse = 0;
+
+	while(validResponse != 1)
 	{
-		cycles = 0;
-		resetMotor();
+		printf("\nPlease set seconds between records (1-60): ");
+		getStringSerial(intervalString, 3);
+
+		validResponse = validateTimeInput(intervalString);
+
+		if(validResponse == 1)
+		{
+			telemetryInterval = atoi(intervalString);
+
+			if(telemetryInterval < 1 || telemetryInterval > 60)
+			{
+				printf("\nInterval should only be 1-60");
+				validResponse = -1;
+			}
+		}
 	}
+
+	telemetryCountdown = telemetryInterval;
+	telemetryKeyframeCountdown = 0; /*Start the stream with a keyframe*/
 }
 
 /*  
-	Function Name: deliverMotorDose
-	Purpose: Set the pulse delay for the motor based on the intensity of the dose to be delivered
-	Params: (int) intensity - Flag indicating if the dose to be delivered is a half or full dose
-			(int) doseIndex - Index of dose to be delivered
-	Returns: (int) doseIndex - Index of dose delivered
+	Function Name: projectBatteryLife
+	Purpose: Projects how long the battery will last, from the proportion of time the processor spends waiting
+			 and the motor running time needed to deliver each scheduled dose once a day
+	Params: (unsigned long) active - Time spent running
+			(unsigned long) idle - Time spent waiting, in the same units as active
+	Returns: (long) hours - Projected battery life in hours, 0 if nothing has been measured yet
 */
-int deliverMotorDose(int intensity, int doseIndex)
+long projectBatteryLife(unsigned long active, unsigned long idle)
 {
-	motorRunning = 1;
+	unsigned long total = active + idle;
+	long idlePermille;
+	long averageCurrent;
 
-	if(intensity == 1)
+	if(total == 0)
 	{
-		pulseDelay = 2500;
+		return 0;
 	}
-	else
+
+	while(total > 1000000L) /*Keep idle * 1000 inside 32 bits*/
 	{
-		pulseDelay = 4800;
+		active >>= 1;
+		idle >>= 1;
+		total = active + idle;
 	}
 
-	return doseIndex;
+	idlePermille = (long) ((idle * 1000L) / total);
+	averageCurrent = ((RUN_CURRENT_UA * (1000L - idlePermille)) + (WAIT_CURRENT_UA * idlePermille)) / 1000L;
+	averageCurrent += ((long) doseState.schedule->scheduledDoses * MOTOR_CURRENT_UA * MOTOR_SECS_PER_DELIVERY) / 86400L;
+
+	return (BATTERY_CAPACITY_MAH * 1000L) / averageCurrent;
 }
 
 /*  
-	Function Name: resetMotor
-	Purpose: Set the pulse delay to turn the motor all the way to the left, and reset all associated flags
+	Function Name: printPowerStatistics
+	Purpose: Print the time spent running and waiting since start up, and the projected battery life
 	Params: none
 	Returns: (void)
 */
-void resetMotor()
+void printPowerStatistics()
 {
-	motorRunning = 0;
-	deliverDoseFlag = 0;
-	pulseDelay = 800;
+	unsigned long active = activeTicks;
+	unsigned long idle = idleTicks;
+	unsigned long scaledActive = active;
+	unsigned long scaledIdle = idle;
+	long lifeHours;
+
+	lifeHours = projectBatteryLife(active, idle);
+
+	printf("\nProcessor active for %lu ticks, waiting for %lu ticks", active, idle);
+
+	while(scaledActive + scaledIdle > 1000000L)
+	{
+		scaledActive >>= 1;
+		scaledIdle >>= 1;
+	}
+
+	if(scaledActive + scaledIdle > 0)
+	{
+		printf(" (%lu%% waiting)", (scaledIdle * 100L) / (scaledActive + scaledIdle));
+	}
+
+	printf("\nProjected battery life with %d doses a day: %ld hours (%ld days)\n", doseState.schedule->scheduledDoses, lifeHours, lifeHours / 24L);
 }
 
-/*  
-	Function Name: emergencyOverride
-	Purpose: Prevent any further action being taken by the system
-	Params: (int) statusCode - An integer indicating the reason for the override
+/* 
+	Function Name: printSerialStatistics
+	Purpose: Print the bytes sent, dropped and held over on each transmit lane, and how long bytes waited on it
+	Params: none
 	Returns: (void)
 */
-void emergencyOverride(int statusCode)
+void printSerialStatistics()
 {
-	suspended = 1;
-	clearScreen();
-	printf("Emergency Mode active\nReason: ");
+	int lane;
+	struct serialLane * queue;
+	unsigned long mean;
 
-	switch(statusCode)
-	{
-		case '1':
-		printf("\nManual override engaged\nPlease restart the system");
-		break;
+	printf("\nLane       Sent     Dropped  Deferred  Wait ms mean  max");
 
-		case '2':
-		printf("\nAn unexpected error occurred\nPlease restart the system");
-		break;
+	for(lane = 0; lane < SERIAL_LANES; lane++)
+	{
+		queue = &serialLanes[lane];
+		mean = queue->delays > 0 ? queue->delayTotal / queue->delays : 0;
+		printf("\n%-10s %-8lu %-8lu %-8lu  %12lu  %lu", queue->name, queue->sent, queue->dropped, queue->deferred,
+			mean * 8UL / 125UL, queue->delayMax * 8UL / 125UL); /*Clock units are 0.064 ms*/
 	}
-	while(1);
+
+	printf("\n");
 }
 
-/*  
-	Function Name: editDoseTime
-	Purpose: Accept a new dose time from the user, and overwrite the selected dose with the new time
-	Params: none
+/* 
+	Function Name: eepromErase
+	Purpose: Erases EEPROM back to 0xFF
+	Params: (int) offset - Offset of the byte, or of any byte in the row, from the start of the EEPROM
+			(unsigned char) mode - PPROG_BYTE or PPROG_ROW
 	Returns: (void)
 */
-void editDoseTime()
+void eepromErase(int offset, unsigned char mode)
 {
-	char userInput [2];
-	int doseToChange;
-	int validationResult = 0;
+	PPROG = mode | PPROG_ERASE | PPROG_EELAT;
+	EEPROM(offset) = 0xFF; /*Any write latches the address*/
+	PPROG = mode | PPROG_ERASE | PPROG_EELAT | PPROG_EPGM;
+	eepromWait(offset);
+	PPROG = 0;
+}
 
-	clearScreen();
+/* 
+	Function Name: eepromProgram
+	Purpose: Programs one erased EEPROM byte
+	Params: (int) offset - Offset of the byte from the start of the EEPROM
+			(unsigned char) value - Value to store
+	Returns: (void)
+*/
+void eepromProgram(int offset, unsigned char value)
+{
+	PPROG = PPROG_EELAT;
+	EEPROM(offset) = value;
+	PPROG = PPROG_EELAT | PPROG_EPGM;
+	eepromWait(offset);
+	PPROG = 0;
+}
+
+/* 
+	Function Name: eepromWait
+	Purpose: Holds the programming voltage on for the 10 ms an erase or program takes, timed on the free running
+			 counter. Interrupts carry on meanwhile, they never read the EEPROM
+	Params: (int) offset - Offset being erased or programmed
+	Returns: (void)
+*/
+void eepromWait(int offset)
+{
+	unsigned int start = TCNT;
 
+	SIM_EEPROM_PROGRAM(offset);
 
-	do
+	while((unsigned int) (TCNT - start) < EEPROM_PROGRAM_CYCLES);
+}
+
+/* 
+	Function Name: journalCrc
+	Purpose: CRC-8 (polynomial 0x07) of a journal record
+	Params: (unsigned char *) bytes - Record
+			(int) length - Number of bytes covered
+	Returns: (unsigned char) CRC
+*/
+unsigned char journalCrc(unsigned char * bytes, int length)
+{
+	unsigned char crc = 0;
+	int i;
+	int bit;
+
+	for(i = 0; i < length; i++)
 	{
-		printf("\nWhich dose would you like to edit?\n");
-		printAllDoses();
-		getStringSerial(userInput, 3);
-		doseToChange = (atoi(userInput) - 1);
+		crc ^= bytes[i];
 
-		if(doseToChange > (scheduledDoses - 1))
-		{
-			printf("Invalid dose\n");
-			validationResult = -1;
-		}
-		else
+		for(bit = 0; bit < 8; bit++)
 		{
-			validationResult = 1;
+			crc = (crc & 0x80) ? (unsigned char) ((crc << 1) ^ 0x07) : (unsigned char) (crc << 1);
 		}
+	}
 
-		if(doseTimes[doseToChange].status == 1)
-		{
-			printf("Delivered doses cannot be edited\n");
-			validationResult = -1;
-		}
-		else
+	return crc;
+}
+
+/* 
+	Function Name: journalRead
+	Purpose: Reads a journal record and checks it
+	Params: (int) slot - Slot to read
+			(unsigned char *) record - Receives JOURNAL_RECORD_SIZE bytes
+	Returns: (int) 1 if the slot holds a complete record, 0 if it is erased or was cut off by a power loss
+*/
+int journalRead(int slot, unsigned char * record)
+{
+	int i;
+
+	for(i = 0; i < JOURNAL_RECORD_SIZE; i++)
+	{
+		record[i] = EEPROM(slot * JOURNAL_RECORD_SIZE + i);
+	}
+
+	return record[2] != 0xFF && journalCrc(record, JOURNAL_RECORD_SIZE - 1) == record[JOURNAL_RECORD_SIZE - 1];
+}
+
+/* 
+	Function Name: journalOpen
+	Purpose: Finds the newest record at power on so the journal carries on after it. Sequences only ever
+			 increase around the ring, so the newest record is the one with the greatest sequence
+	Params: none
+	Returns: (int) Number of records in the journal
+*/
+int journalOpen()
+{
+	unsigned char record[JOURNAL_RECORD_SIZE];
+	unsigned int sequence;
+	int slot;
+	int records = 0;
+
+	journalTail = 0;
+	journalSequence = 0;
+
+	for(slot = 0; slot < JOURNAL_SLOTS; slot++)
+	{
+		if(journalRead(slot, record))
 		{
-			if(validationResult == 0)
+			sequence = ((unsigned int) record[0] << 8) | record[1];
+
+			/*Compared as a difference so the 16 bit sequence may wrap*/
+			if(records == 0 || ((sequence - journalSequence) & 0xFFFF) < 0x8000)
 			{
-				validationResult = 1;
+				journalSequence = (sequence + 1) & 0xFFFF;
+				journalTail = (slot + 1) % JOURNAL_SLOTS;
 			}
+
+			records++;
 		}
 	}
-	while (validationResult != 1);
-
-	validationResult = 0;
 
-	do
-	{
-		printf("\nDose %d at %2d:%2d is selected\nWhat would you like to do? \na. Edit Dose b. Remove Dose c. Cancel\n");
-		getStringSerial(userInput, 3);
+	return records;
+}
 
-		if(userInput[0] == 'a')
-		{
-			validationResult = 1;
-			setDoseTime(doseToChange);
-		}
+/* 
+	Function Name: journalAppend
+	Purpose: Adds a record to the journal. Takes at most one row erase and eight byte programs (90 ms), or eight
+			 byte erases in place of the row erase for the first record after a power loss cut one off
+	Params: (int) type - JOURNAL_ record type
+			(int) detail - Dose index or reason
+	Returns: (void)
+*/
+void journalAppend(int type, int detail)
+{
+	unsigned char record[JOURNAL_RECORD_SIZE];
+	struct clockTime now;
+	long time;
+	int offset = journalTail * JOURNAL_RECORD_SIZE;
+	int i;
 
-		if(userInput[0] == 'b')
+	readClock(&now);
+	time = now.upTime; /*Setting the clock must not reorder the journal*/
+	record[0] = (unsigned char) (journalSequence >> 8);
+	record[1] = (unsigned char) journalSequence;
+	record[2] = (unsigned char) type;
+	record[3] = (unsigned char) detail;
+	record[4] = (unsigned char) (time >> 16);
+	record[5] = (unsigned char) (time >> 8);
+	record[6] = (unsigned char) time;
+	record[7] = journalCrc(record, JOURNAL_RECORD_SIZE - 1);
+
+	if(offset % EEPROM_ROW_SIZE == 0)
+	{
+		eepromErase(offset, PPROG_ROW); /*Entering a row, everything in it is older than a lap*/
+	}
+	else
+	{
+		for(i = 0; i < JOURNAL_RECORD_SIZE; i++)
 		{
-			validationResult = 1;
-			removeDoseTime(doseToChange);
+			if(EEPROM(offset + i) != 0xFF)
+			{
+				eepromErase(offset + i, PPROG_BYTE);
+			}
 		}
+	}
 
-		if(userInput[0] == 'c')
-		{
-			validationResult = 1;
-		}
+	for(i = 0; i < JOURNAL_RECORD_SIZE; i++)
+	{
+		eepromProgram(offset + i, record[i]); /*The CRC goes last, so a cut off record never checks*/
+	}
 
-		if(validationResult != 1)
+	for(i = 0; i < JOURNAL_RECORD_SIZE; i++)
+	{
+		if(EEPROM(offset + i) != record[i])
 		{
-			printf("\nPlease only use the characters 'a', 'b' or 'c' to indicate your choice \n");
+			journalErrors++;
+			break;
 		}
 	}
-	while (validationResult != 1);
+
+	journalTail = (journalTail + 1) % JOURNAL_SLOTS;
+	journalSequence = (journalSequence + 1) & 0xFFFF;
 }
 
-/*  
-	Function Name: removeDoseTimes
-	Purpose: Remove the selected dose from the array of doses
-	Params: (int) doseIndex - Index of dose to be removed
+/* 
+	Function Name: printJournal
+	Purpose: Prints the journal from the oldest record to the newest
+	Params: none
 	Returns: (void)
 */
-void removeDoseTime(doseIndex)
+void printJournal()
 {
-	struct dose tempArray[MAX_DOSES];
+	unsigned char record[JOURNAL_RECORD_SIZE];
+	char * names[] = {"", "Power on", "Dose delivered", "Boost delivered", "Withheld by dose budget", "Boost switch stuck", "Emergency override"};
+	long time;
+	int slot;
 	int i;
-	int elements = 0;
-	/*Copy array*/
 
-	for(i = 0; i < scheduledDoses; i++)
+	printf("\nDelivery journal\n---------------");
+
+	for(i = 0; i < JOURNAL_SLOTS; i++)
 	{
-		if(i != doseIndex)
+		slot = (journalTail + i) % JOURNAL_SLOTS;
+
+		if(journalRead(slot, record) == 0 || record[2] > JOURNAL_EMERGENCY)
 		{
-			tempArray[elements] = doseTimes[i];
-			elements++;
+			continue;
 		}
-	}
 
-	scheduledDoses--;
+		time = ((long) record[4] << 16) | ((long) record[5] << 8) | record[6];
+		printf("\nUp %ldd %02ld:%02ld:%02ld  %s", time / 86400L, (time / 3600L) % 24L, (time / 60L) % 60L, time % 60L, names[record[2]]);
+
+		if(record[2] == JOURNAL_DOSE || record[2] == JOURNAL_BOOST || record[2] == JOURNAL_WITHHELD)
+		{
+			if((record[3] & 0x7F) == MAX_DOSES)
+			{
+				printf(" (boost, %s%%)", (record[3] & 0x80) ? "50" : "100");
+			}
+			else
+			{
+				printf(" (dose #%d, %s%%)", (record[3] & 0x7F) + 1, (record[3] & 0x80) ? "50" : "100");
+			}
+		}
+	}
 
-	for(i = 0; i < elements; i++)
+	if(journalErrors > 0)
 	{
-		doseTimes[elements] = tempArray[elements];
+		printf("\n%d records failed to verify, the EEPROM may be worn", journalErrors);
 	}
+
+	printf("\n");
 }
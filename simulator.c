@@ -0,0 +1,2715 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <termios.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <sched.h>
+#include "simulator.h"
+#include "fleet.h"
+#include "doseCore.h"
+#include "liveState.h"
+#include "doseTable.h"
+
+/*	File Name: simulator.c
+	Date: 18/10/2026
+	Purpose: Native (Linux) stand-in for the 68HC11 board so scheduleDose.c can run on the host.
+			 Models the free running timer, the real time interrupt, TOC1 and TOC2 making the motor pulse on A6,
+			 the SCI and the port A switches
+			 on a virtual E clock, with the serial port mapped to stdin/stdout.
+	Build: gcc -std=gnu89 -funsigned-char -DSIMULATOR -o scheduleDose scheduleDose.c doseCore.c simulator.c fleet.c doseTable.c -pthread
+	Usage: scheduleDose [-fast] [-run secs] [-baud rate] [-telemetry secs] [-record file] [-replay file]
+						[-timeline file] [-share name] [-eeprom file] [-scenario file] [-fleet instances [-workers n] [-days n] [-seed n]] [-clockstress reads]
+						[-dosebench doses] [-single]
+			-fast - Run virtual time as fast as possible instead of in step with the wall clock
+			-run - Exit after the given number of virtual seconds
+			-baud - Serial line rate, output keeps the processor busy for as long as it takes to send (default 9600)
+			-telemetry - Start with the binary telemetry stream enabled at the given interval
+			-record - Write the serial input and switch presses, with the virtual time of each, to a trace file
+			-replay - Feed the firmware from a trace file instead of stdin, as fast as possible, and stop at
+					  the virtual time the recording ended. Runs are repeatable, so output size and timings
+					  can be compared between builds
+			-timeline - Write a Chrome trace (JSON, opens in Perfetto or chrome://tracing) of the interrupts,
+						serviceAlarm, monitor redraws, deliveries and serial traffic on virtual time
+			-share - Publish the clock, schedule, boost and motor state in POSIX shared memory /name for other
+					 processes to read, see liveState.h. Updated after every real time interrupt
+			-eeprom - Keep the EEPROM, and how worn each byte is, in a file so the delivery journal survives
+					  between runs. Without it the EEPROM starts erased every run
+			-scenario - Replay a synthetic workload described in a scenario file (see below) and report the
+						command throughput and response latency
+			-fleet - Run the dosing cores of many generated patients in parallel instead of the firmware, see fleet.c
+			-clockstress - Instead of running the firmware, check readClock against clock ticks injected between
+						   its loads, and compare with reading the clock fields directly
+			-dosebench - Instead of running the firmware, time finding the doses due every second of a day in a
+						 schedule of that many doses, with the dosing core's struct dose loop and each doseTable kernel
+			-single - Write the terminal output and publish the live state on the firmware's thread
+	Latency: Every delivery is timed from its stimulus to the first motor pulse the firmware sends for it, the
+			 rising edge OC1 makes on A6 for the first frame turnMotor() sets up after deliverMotorDose. A
+			 dose's stimulus is the firmware
+			 clock entering the second the dose is due, a boost's is the switch being pressed. The percentiles
+			 are printed on stderr when the simulation ends, along with the time to deliverMotorDose alone
+	EEPROM: Erase and program cycles take 10 ms of busy virtual time. Programming can only clear bits, as on the
+			part, and a byte erased more than EEPROM_ENDURANCE times no longer erases fully. The number of
+			cycles and the most worn byte are reported when the simulation ends.
+	Energy: Virtual time spent in WAI is counted as idle and time spent sending serial output as active.
+			The totals and the projected battery life are printed on stderr when the simulation ends.
+	Pipeline: The firmware and the virtual clock run on the main thread. Writing the serial output to the terminal
+			  and publishing live state snapshots (-share) are stages on threads of their own, each fed by a lock
+			  free single producer, single consumer ring, so a slow terminal or reader never holds up virtual
+			  time until a ring fills. Each stage's bytes, busy time and waits are printed on stderr when the
+			  simulation ends, so the throughput of each can be measured on its own. -single runs every
+			  stage on the main thread. The firmware formats its screens and encodes telemetry itself,
+			  a byte at a time onto the transmit lanes as on the board, so that work stays on the main thread
+			  with the serial timing it produces; the README gives its measured share
+	Switches: SIGUSR1 presses the boost switch, SIGUSR2 toggles the emergency override switch
+	Scenarios: One directive per line, times are virtual seconds from reset and # starts a comment
+			name text - Name printed in the report
+			baud rate - Serial line rate for the scenario
+			send time "text" - Type text, one character time apart. \r, \n, \e (Esc), \\ and \" are escaped,
+							   %n is replaced by the repeat number from 00 and %N by the repeat number from 01.
+							   Commands are typed in time order, those due together in file order, and
+							   a command starts once the one before it has been typed
+			boost time - Press the boost switch
+			emergency time - Toggle the emergency override switch
+			clearbudget time - Clear the dose budget, as resetting for a new patient does, keeping the schedule.
+							   Lets a scenario which sets the clock back have every dose delivered, as the
+							   budget is timed from start up
+			end time - Stop the run, otherwise it stops a minute after the last event
+			Any event can end with "every step count" to repeat it count times, step seconds apart.
+			A command's latency runs from its first character reaching the firmware to the firmware waiting for
+			input again with every character of it read, so it includes the time to send the response
+	Required Headers: stdio.h, stdlib.h, string.h, signal.h, poll.h, time.h, unistd.h, termios.h, ctype.h,
+					  stdint.h, fcntl.h, sys/mman.h, pthread.h, sched.h, simulator.h, fleet.h, doseCore.h, liveState.h,
+					  doseTable.h
+*/
+
+#define E_CLOCK_HZ 2000000ULL
+#define RTI_PERIOD 65536ULL /*E clock / 2^13 with the RTI rate bits set to 3*/
+#define BOOST_PRESS_CYCLES (E_CLOCK_HZ / 2) /*Boost switch is held for half a second*/
+#define CLOCK_SECOND_UNITS 15625U /*CLOCK_UNITS_PER_SECOND in scheduleDose.c*/
+#define CLOCK_TICK_UNITS 512U /*CLOCK_UNITS_PER_TICK in scheduleDose.c*/
+
+/* Trace records: virtual time since the previous record as a base 128 varint, a type byte, then a value byte
+	for TRACE_INPUT. The file starts with TRACE_MAGIC and the baud rate the recording was made at */
+#define TRACE_MAGIC "SDT1"
+#define TRACE_INPUT 0
+#define TRACE_BOOST 1
+#define TRACE_EMERGENCY 2
+#define TRACE_END 3
+#define TRACE_CLEAR_BUDGET 4 /*Scenarios only*/
+
+#define SCENARIO_LINE_LENGTH 512
+#define SCENARIO_MAX_EVENTS 4096
+#define SCENARIO_MAX_INPUT 65536
+#define TIMELINE_BUFFER_RECORDS 4096 /*Records kept in memory before they are spooled to disk*/
+#define LATENCY_MAX_SAMPLES 4096 /*Deliveries timed of each kind, later ones are not counted*/
+#define LATENCY_DOSE 0
+#define LATENCY_BOOST 1
+#define SIM_STAGE_TERMINAL 0 /*Writes the serial output to stdout*/
+#define SIM_STAGE_SHARE 1 /*Publishes live state snapshots in shared memory*/
+#define SIM_STAGES 2
+#define SIM_TERMINAL_RING 65536 /*Bytes of output in flight to the terminal stage*/
+#define SIM_SHARE_RING 1024 /*Snapshots in flight to the share stage*/
+#define SIM_CACHE_LINE 64
+#define SIM_STAGE_WAIT_NS 100000L /*Sleep when a ring is empty or full*/
+#define SIM_STAGE_SPINS 64 /*Times a stage yields on an empty ring before it sleeps*/
+
+/* Register offsets */
+#define SIM_PADR 0x00
+#define SIM_PADDR 0x01
+#define SIM_OC1M 0x0C
+#define SIM_OC1D 0x0D
+#define SIM_TCNT 0x0E
+#define SIM_TOC1 0x16
+#define SIM_TOC2 0x18
+#define SIM_TCTL1 0x20
+#define SIM_TMSK1 0x22
+#define SIM_TFLG1 0x23
+#define SIM_TMSK2 0x24
+#define SIM_TFLG2 0x25
+#define SIM_SCCR2 0x2D
+#define SIM_SCSR 0x2E
+#define SIM_SCDR 0x2F
+#define SIM_PPROG 0x3B
+#define EEPROM_PROGRAM_CYCLES 20000ULL /*10 ms for each erase or program*/
+#define EEPROM_ENDURANCE 10000UL /*Erase cycles each 68HC11 EEPROM byte is rated for*/
+
+/* Structure Declarations*/
+struct simTimelineRecord /*One timeline event, spooled as it is and converted to JSON when the run ends*/
+{
+	unsigned long long cycles;
+	unsigned long value;
+	unsigned long duration; /*Cycles, for spans recorded by the simulator once they have finished*/
+	unsigned char event;
+	unsigned char phase; /*B begin, E end, X complete*/
+};
+
+/* Lock free ring between the firmware thread and one stage. head and tail only ever grow, each is written by
+	one side and read by the other, and they are kept on separate cache lines. Everything is pushed in whole
+	records and the size is a multiple of the record size, so a record never wraps */
+struct simRing
+{
+	unsigned char * data;
+	size_t size;
+	size_t head; /*Bytes pushed, written by the producer only*/
+	char headPadding[SIM_CACHE_LINE];
+	size_t tail; /*Bytes consumed, written by the consumer only*/
+	char tailPadding[SIM_CACHE_LINE];
+	int closed; /*Set by the producer after its last push*/
+};
+
+/* A pipeline stage and what it got through. busyNs and waits are only written by the stage's own thread */
+struct simStage
+{
+	const char * name;
+	void (*consume)(const unsigned char *, size_t);
+	size_t record; /*Bytes handed to consume at a time are a multiple of this*/
+	struct simRing ring;
+	pthread_t thread;
+	int threaded;
+	unsigned long long bytes;
+	unsigned long long busyNs;
+	unsigned long long waits; /*Times the stage slept on an empty ring*/
+	unsigned long long stalls; /*Times the firmware thread found the ring full*/
+	unsigned long long stallNs;
+};
+
+struct simTimelineEvent
+{
+	const char * name;
+	const char * argument; /*Name of the value, NULL if it has none*/
+	int thread;
+};
+
+/* Firmware state configured from the command line or checked by the stress tests */
+extern int telemetryEnabled, telemetryInterval, telemetryCountdown, telemetryKeyframeCountdown;
+extern volatile int hours, mins, secs;
+extern volatile unsigned int clockFraction;
+extern volatile unsigned int days;
+extern volatile unsigned long upTime;
+extern volatile int pulseDelay, motorRunning;
+extern int suspended;
+extern volatile unsigned char rxHead, rxTail;
+extern struct doseCore doseState;
+
+/* Global Variable Declarations*/
+unsigned int simRegisters[SIM_REGISTER_COUNT];
+unsigned long long simCycles = 0;
+unsigned long long simNextRti = RTI_PERIOD;
+unsigned long long simNextToc1 = 0;
+unsigned long long simNextToc2 = 0;
+unsigned long long simBoostRelease = 0;
+unsigned long long simRunLimit = 0;
+unsigned long long simActiveCycles = 0;
+unsigned long long simIdleCycles = 0;
+unsigned long long simOutputBytes = 0;
+unsigned long long simCyclesPerByte = 0;
+unsigned long long simTransmitDone = 0; /*When the byte being sent is done, while the SCI transmitter is busy*/
+unsigned long long simTransmitStart = 0; /*Start of the run of bytes sent back to back*/
+unsigned long simTransmitBytes = 0;
+unsigned long simBaud = 9600;
+char simOutputBuffer[4096];
+size_t simOutputLength = 0;
+unsigned long simRandomState = 1;
+unsigned long simInjectedTicks = 0;
+int simClockStress = 0;
+int simToc1Armed = 0;
+int simToc2Armed = 0;
+int simMotorPin = 0; /*Level of A6, which OC1 and OC2 drive*/
+int simFast = 0;
+int simExiting = 0;
+int simInputClosed = 0;
+unsigned char simSwitches = 0;
+unsigned char simInputBuffer[256];
+int simInputHead = 0;
+int simInputCount = 0;
+struct timespec simWallStart;
+FILE *simRecordFile = NULL;
+FILE *simReplayFile = NULL;
+FILE *simTimelineFile = NULL;
+FILE *simTimelineSpool = NULL;
+struct simTimelineRecord simTimelineBuffer[TIMELINE_BUFFER_RECORDS];
+int simTimelineCount = 0;
+struct liveState * simShare = NULL;
+char simShareName[64] = "";
+volatile unsigned char simEeprom[SIM_EEPROM_SIZE]; /*EEPROM as the firmware reads and latches it*/
+unsigned char simEepromCells[SIM_EEPROM_SIZE]; /*What is actually stored*/
+unsigned long simEepromWear[SIM_EEPROM_SIZE]; /*Erase cycles of each byte*/
+unsigned long simEepromCycles = 0;
+FILE *simEepromFile = NULL;
+struct simStage simStages[SIM_STAGES];
+int simPipelined = 1;
+const char * simTimelineThreads[] = {"", "Interrupts", "Main loop", "Motor", "Serial"};
+const struct simTimelineEvent simTimelineEvents[SIM_EVENT_COUNT] =
+{
+	{"timer", NULL, 1},
+	{"turnMotor", NULL, 1},
+	{"serialInterrupt", "byte", 1},
+	{"serviceAlarm", NULL, 2},
+	{"clock redraw", NULL, 2},
+	{"monitor redraw", NULL, 2},
+	{"delivery", "dose", 3},
+	{"transmit", "bytes", 4},
+	{"eeprom", "offset", 2}
+};
+unsigned long long simTraceTime = 0;
+unsigned long long simReplayTime = 0;
+int simReplayType = TRACE_END;
+int simReplayValue = 0;
+char simScenarioName[64] = "";
+int simScenarioCommands = 0;
+int simScenarioStarted = 0;
+int simScenarioCompleted = 0;
+unsigned long long simScenarioStart[SCENARIO_MAX_EVENTS];
+unsigned long simScenarioLastByte[SCENARIO_MAX_EVENTS];
+unsigned long long simScenarioLatency[SCENARIO_MAX_EVENTS];
+unsigned long simInputDelivered = 0;
+unsigned long long simSecondStart = 0; /*When the firmware clock entered the second it shows*/
+int simClockSecond = -1;
+unsigned long long simBoostPressed = 0; /*Press not yet answered by a boost, 0 if none*/
+int simLatencyWaiting = 0; /*Deliveries started which have not sent a motor pulse yet*/
+int simLatencyFramed = 0; /*Of those, the first ones turnMotor has set the next frame's pulse width for*/
+int simLatencyKind[CORE_MAX_ACTIONS];
+unsigned long long simLatencyStimulus[CORE_MAX_ACTIONS];
+unsigned long long simLatencyStarted[CORE_MAX_ACTIONS];
+unsigned long long simLatencyPulse[2][LATENCY_MAX_SAMPLES]; /*Stimulus to first motor pulse, by kind*/
+unsigned long long simLatencyStart[2][LATENCY_MAX_SAMPLES]; /*Stimulus to deliverMotorDose, by kind*/
+int simLatencyCount[2] = {0, 0};
+unsigned long simDosesDue = 0;
+struct termios simSavedTerminal;
+int simTerminalSaved = 0;
+volatile sig_atomic_t simBoostRequest = 0;
+volatile sig_atomic_t simEmergencyRequest = 0;
+volatile sig_atomic_t simStopRequest = 0;
+
+/* Function Prototypes*/
+int main(int, char **);
+int simRun(void);
+void simExit(void);
+void simSignal(int);
+void simApplySwitches(void);
+void simRunUntil(unsigned long long);
+unsigned long long simNextEvent(void);
+unsigned long long simCompareTime(unsigned int);
+int simPollInput(unsigned long long);
+long simWallDelayMs(unsigned long long);
+ssize_t simOutputWrite(void *, const char *, size_t);
+void simFlushOutput(void);
+void simSerialTransmitted(void);
+unsigned long simRandom(void);
+long simSecondsOfDay(int, int, int);
+int simClockReadTorn(long, long, long);
+int simClockStressTest(unsigned long);
+int simDoseBenchmark(int);
+void simDeliverInput(unsigned char);
+void simTraceWrite(int, int);
+void simReplayNext(void);
+void simReplayEvents(void);
+int simReplayInput(void);
+void simTraceEncode(FILE *, unsigned long long, int, int);
+int simScenarioText(char *, unsigned char *, int, int);
+unsigned long long simScenarioTime(const char *);
+int simCompareCycles(const void *, const void *);
+FILE * simLoadScenario(FILE *, const char *);
+void simScenarioProgress(void);
+void simScenarioReport(void);
+void simTimelineSpan(int, unsigned long long, unsigned long);
+void simTimelineWrite(void);
+int simShareOpen(const char *);
+int simEepromOpen(const char *);
+void simEepromSave(int, int);
+void simBusy(unsigned long long);
+void simSharePublish(int);
+void simSwitchRequests(void);
+void simLatencySecond(unsigned long long);
+void simLatencyDelivery(unsigned long);
+void simLatencyMotorPulse(void);
+void simLatencyReport(void);
+void simPrintPercentiles(unsigned long long *, int);
+void simShareCapture(struct liveSnapshot *, int);
+void simShareStore(const unsigned char *, size_t);
+void simTerminalWrite(const unsigned char *, size_t);
+unsigned long long simElapsedNs(struct timespec *);
+void simStageStart(int, const char *, void (*)(const unsigned char *, size_t), size_t, size_t);
+void simStagePush(int, const void *, size_t);
+void * simStageRun(void *);
+void simStageConsume(struct simStage *, const unsigned char *, size_t);
+void simStageStop(void);
+void simStageReport(void);
+
+/* Function Name: main
+	Purpose: Parses the simulator options, resets the simulated registers and starts the firmware
+	Params: (int) argc - Number of arguments
+			(char **) argv - Argument strings
+	Returns: (int) 0 on exit of the firmware, 1 on invalid arguments
+*/
+int main(int argc, char ** argv)
+{
+	int i;
+	unsigned long stressReads = 0;
+	int benchDoses = 0;
+	char * scenarioPath = NULL;
+	FILE * scenario;
+	int fleetInstances = 0;
+	int fleetWorkers = 0;
+	int fleetDays = 2;
+	unsigned long fleetSeed = 1;
+
+	for(i = 1; i < argc; i++)
+	{
+		if(strcmp(argv[i], "-fast") == 0)
+		{
+			simFast = 1;
+		}
+		else if(strcmp(argv[i], "-run") == 0 && i + 1 < argc)
+		{
+			simRunLimit = strtoull(argv[++i], NULL, 10) * E_CLOCK_HZ;
+		}
+		else if(strcmp(argv[i], "-baud") == 0 && i + 1 < argc)
+		{
+			simBaud = strtoul(argv[++i], NULL, 10);
+		}
+		else if(strcmp(argv[i], "-telemetry") == 0 && i + 1 < argc)
+		{
+			telemetryEnabled = 1;
+			telemetryInterval = atoi(argv[++i]);
+			telemetryCountdown = telemetryInterval;
+			telemetryKeyframeCountdown = 0;
+		}
+		else if(strcmp(argv[i], "-record") == 0 && i + 1 < argc)
+		{
+			simRecordFile = fopen(argv[++i], "wb");
+
+			if(simRecordFile == NULL)
+			{
+				perror(argv[i]);
+				return 1;
+			}
+		}
+		else if(strcmp(argv[i], "-replay") == 0 && i + 1 < argc)
+		{
+			simReplayFile = fopen(argv[++i], "rb");
+
+			if(simReplayFile == NULL)
+			{
+				perror(argv[i]);
+				return 1;
+			}
+		}
+		else if(strcmp(argv[i], "-timeline") == 0 && i + 1 < argc)
+		{
+			simTimelineFile = fopen(argv[++i], "w");
+			simTimelineSpool = tmpfile();
+
+			if(simTimelineFile == NULL || simTimelineSpool == NULL)
+			{
+				perror(argv[i]);
+				return 1;
+			}
+		}
+		else if(strcmp(argv[i], "-share") == 0 && i + 1 < argc)
+		{
+			if(simShareOpen(argv[++i]) == 0)
+			{
+				return 1;
+			}
+		}
+		else if(strcmp(argv[i], "-eeprom") == 0 && i + 1 < argc)
+		{
+			if(simEepromOpen(argv[++i]) == 0)
+			{
+				return 1;
+			}
+		}
+		else if(strcmp(argv[i], "-scenario") == 0 && i + 1 < argc)
+		{
+			scenarioPath = argv[++i];
+		}
+		else if(strcmp(argv[i], "-fleet") == 0 && i + 1 < argc)
+		{
+			fleetInstances = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "-workers") == 0 && i + 1 < argc)
+		{
+			fleetWorkers = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "-days") == 0 && i + 1 < argc)
+		{
+			fleetDays = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "-seed") == 0 && i + 1 < argc)
+		{
+			fleetSeed = strtoul(argv[++i], NULL, 10);
+		}
+		else if(strcmp(argv[i], "-clockstress") == 0 && i + 1 < argc)
+		{
+			stressReads = strtoul(argv[++i], NULL, 10);
+		}
+		else if(strcmp(argv[i], "-dosebench") == 0 && i + 1 < argc)
+		{
+			benchDoses = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "-single") == 0)
+		{
+			simPipelined = 0;
+		}
+		else
+		{
+			fprintf(stderr, "Usage: %s [-fast] [-run secs] [-baud rate] [-telemetry secs] [-record file] [-replay file]\n"
+				"\t[-timeline file] [-share name] [-eeprom file] [-scenario file] [-fleet instances [-workers n] [-days n] [-seed n]] [-clockstress reads]\n"
+				"\t[-dosebench doses] [-single]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if(stressReads > 0)
+	{
+		return simClockStressTest(stressReads);
+	}
+
+	if(benchDoses > 0)
+	{
+		return simDoseBenchmark(benchDoses);
+	}
+
+	if(fleetInstances > 0)
+	{
+		return simFleet(fleetInstances, fleetWorkers, fleetDays, fleetSeed);
+	}
+
+	if(scenarioPath != NULL)
+	{
+		scenario = fopen(scenarioPath, "r");
+
+		if(scenario == NULL)
+		{
+			perror(scenarioPath);
+			return 1;
+		}
+
+		simReplayFile = simLoadScenario(scenario, scenarioPath);
+		fclose(scenario);
+
+		if(simReplayFile == NULL)
+		{
+			return 1;
+		}
+	}
+
+	return simRun();
+}
+
+/* Function Name: simRun
+	Purpose: Starts the firmware on the configured input, a trace being replayed or stdin
+	Params: none
+	Returns: (int) 1 if the trace is not valid, otherwise the simulation exits when it ends
+*/
+int simRun()
+{
+	struct termios rawTerminal;
+	cookie_io_functions_t outputFunctions = {NULL, simOutputWrite, NULL, NULL};
+
+	if(simReplayFile != NULL)
+	{
+		char magic[4];
+		unsigned char baud[4];
+
+		if(fread(magic, 1, 4, simReplayFile) != 4 || memcmp(magic, TRACE_MAGIC, 4) != 0 || fread(baud, 1, 4, simReplayFile) != 4)
+		{
+			fprintf(stderr, "Not a trace file\n");
+			return 1;
+		}
+
+		simBaud = ((unsigned long) baud[0] << 24) | ((unsigned long) baud[1] << 16) | ((unsigned long) baud[2] << 8) | baud[3];
+		simFast = 1;
+		simReplayNext();
+	}
+
+	if(simBaud == 0)
+	{
+		simBaud = 9600;
+	}
+
+	if(simRecordFile != NULL)
+	{
+		fwrite(TRACE_MAGIC, 1, 4, simRecordFile);
+		fputc((int) (simBaud >> 24) & 0xFF, simRecordFile);
+		fputc((int) (simBaud >> 16) & 0xFF, simRecordFile);
+		fputc((int) (simBaud >> 8) & 0xFF, simRecordFile);
+		fputc((int) simBaud & 0xFF, simRecordFile);
+	}
+
+	simCyclesPerByte = (E_CLOCK_HZ * 10ULL) / simBaud; /*Start, 8 data and stop bit*/
+
+	/*Everything the firmware prints goes through simOutputWrite to the transmit lanes*/
+	stdout = fopencookie(NULL, "w", outputFunctions);
+	setvbuf(stdout, NULL, _IONBF, 0);
+
+	/*The firmware does its own echo and expects a carriage return for enter, output processing is left alone*/
+	if(simReplayFile == NULL && isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &simSavedTerminal) == 0)
+	{
+		simTerminalSaved = 1;
+		rawTerminal = simSavedTerminal;
+		rawTerminal.c_lflag &= ~(ICANON | ECHO);
+		rawTerminal.c_iflag &= ~(ICRNL | INLCR);
+		rawTerminal.c_cc[VMIN] = 1;
+		rawTerminal.c_cc[VTIME] = 0;
+		tcsetattr(STDIN_FILENO, TCSANOW, &rawTerminal);
+	}
+
+	signal(SIGUSR1, simSignal);
+	signal(SIGUSR2, simSignal);
+	signal(SIGINT, simSignal);
+	signal(SIGTERM, simSignal);
+
+	*REGISTER(SIM_SCSR) = 0xC0; /*Transmitter empty and idle out of reset*/
+
+	if(simEepromFile == NULL)
+	{
+		memset(simEepromCells, 0xFF, sizeof(simEepromCells));
+	}
+
+	memcpy((void *) simEeprom, simEepromCells, sizeof(simEepromCells));
+
+	simStageStart(SIM_STAGE_TERMINAL, "terminal", simTerminalWrite, 1, SIM_TERMINAL_RING);
+
+	if(simShare != NULL)
+	{
+		simStageStart(SIM_STAGE_SHARE, "live state", simShareStore, sizeof(struct liveSnapshot), SIM_SHARE_RING * sizeof(struct liveSnapshot));
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &simWallStart);
+
+	firmwareMain();
+	simExit();
+
+	return 0;
+}
+
+/* Function Name: simExit
+	Purpose: Restores the terminal and ends the simulation
+	Params: none
+	Returns: (void)
+*/
+void simExit()
+{
+	unsigned long long total = simActiveCycles + simIdleCycles;
+	struct timespec now;
+	unsigned long mostWorn = 0;
+	int i;
+
+	simExiting = 1;
+	simFlushOutput();
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if(simRecordFile != NULL)
+	{
+		simTraceWrite(TRACE_END, 0);
+		fclose(simRecordFile);
+	}
+
+	if(simTimelineFile != NULL)
+	{
+		simTimelineWrite();
+	}
+
+	if(simShare != NULL)
+	{
+		simSharePublish(0);
+	}
+
+	simStageStop();
+
+	if(simShare != NULL)
+	{
+		shm_unlink(simShareName); /*Readers keep their mapping and see the run has stopped*/
+	}
+
+	if(simScenarioName[0] != '\0')
+	{
+		simScenarioReport();
+	}
+
+	if(simDosesDue > 0 || simLatencyCount[LATENCY_BOOST] > 0)
+	{
+		simLatencyReport();
+	}
+
+	simStageReport();
+
+	if(simEepromCycles > 0)
+	{
+		for(i = 0; i < SIM_EEPROM_SIZE; i++)
+		{
+			mostWorn = (simEepromWear[i] > mostWorn) ? simEepromWear[i] : mostWorn;
+		}
+
+		fprintf(stderr, "\nEEPROM: %lu erase and program cycles, most worn byte erased %lu of %lu times\n",
+			simEepromCycles, mostWorn, EEPROM_ENDURANCE);
+	}
+
+	if(total > 0)
+	{
+		fprintf(stderr, "\nVirtual time %.1fs in %.3fs, %llu bytes sent, processor active %.2f%% waiting %.2f%%, projected battery life %ld hours\n",
+			(double) simCycles / E_CLOCK_HZ, (double) (now.tv_sec - simWallStart.tv_sec) + (now.tv_nsec - simWallStart.tv_nsec) / 1e9,
+			simOutputBytes, simActiveCycles * 100.0 / total, simIdleCycles * 100.0 / total,
+			projectBatteryLife((unsigned long) (simActiveCycles / RTI_PERIOD), (unsigned long) (simIdleCycles / RTI_PERIOD)));
+	}
+
+	if(simTerminalSaved)
+	{
+		tcsetattr(STDIN_FILENO, TCSANOW, &simSavedTerminal);
+	}
+
+	exit(0);
+}
+
+/* Function Name: simSignal
+	Purpose: Records switch and stop requests, which are applied the next time the firmware idles
+	Params: (int) signalNumber - Signal received
+	Returns: (void)
+*/
+void simSignal(int signalNumber)
+{
+	if(signalNumber == SIGUSR1)
+	{
+		simBoostRequest = 1;
+	}
+	else if(signalNumber == SIGUSR2)
+	{
+		simEmergencyRequest = 1;
+	}
+	else
+	{
+		simStopRequest = 1;
+	}
+}
+
+/* Function Name: simIdle
+	Purpose: Called while the firmware is waiting on the hardware. Delivers the next serial input byte if one
+			 has arrived before the next interrupt is due, otherwise advances virtual time to that interrupt
+	Params: none
+	Returns: (void)
+*/
+void simIdle()
+{
+	unsigned long long nextEvent;
+
+	if(simReplayFile != NULL)
+	{
+		simReplayEvents();
+		simScenarioProgress();
+	}
+
+	/*A run which reaches its limit stops once the firmware has nothing left to send*/
+	if(simStopRequest || (simRunLimit > 0 && simCycles >= simRunLimit && (*REGISTER(SIM_SCSR) & 0x80)))
+	{
+		simExit();
+	}
+
+	simSwitchRequests();
+	simApplySwitches();
+	nextEvent = simNextEvent();
+
+	/*A replay waits for the firmware to finish sending before it types on, so a trace or scenario does not
+		overrun the receive buffer while the firmware waits for the line to queue more output*/
+	if(!(*REGISTER(SIM_SCSR) & 0x20) && (simReplayFile == NULL || (*REGISTER(SIM_SCSR) & 0x80)))
+	{
+		if(simReplayFile != NULL ? simReplayInput() : simPollInput(nextEvent))
+		{
+			return;
+		}
+	}
+
+	simIdleCycles += nextEvent - simCycles;
+	simRunUntil(nextEvent);
+}
+
+/* Function Name: simSwitchRequests
+	Purpose: Presses the boost switch or toggles the emergency override switch if asked to by a signal or the
+			 trace being replayed
+	Params: none
+	Returns: (void)
+*/
+void simSwitchRequests()
+{
+	if(simBoostRequest)
+	{
+		simBoostRequest = 0;
+		simSwitches |= 0x01;
+		simBoostRelease = simCycles + BOOST_PRESS_CYCLES;
+		simBoostPressed = simCycles;
+		simTraceWrite(TRACE_BOOST, 0);
+	}
+
+	if(simEmergencyRequest)
+	{
+		simEmergencyRequest = 0;
+		simSwitches ^= 0x04;
+		simTraceWrite(TRACE_EMERGENCY, 0);
+	}
+}
+
+/* Function Name: simSerialRead
+	Purpose: Clears the receive flag, as reading SCSR then SCDR does on the 68HC11
+	Params: none
+	Returns: (void)
+*/
+void simSerialRead()
+{
+	*REGISTER(SIM_SCSR) &= ~0x20;
+}
+
+/* Function Name: simSerialWrite
+	Purpose: Starts sending the byte just written to SCDR. The transmitter is busy until the byte has had time
+			 to go out at the baud rate
+	Params: none
+	Returns: (void)
+*/
+void simSerialWrite()
+{
+	if(simOutputLength == sizeof(simOutputBuffer))
+	{
+		simFlushOutput();
+	}
+
+	simOutputBuffer[simOutputLength++] = (char) *REGISTER(SIM_SCDR);
+	simOutputBytes++;
+	*REGISTER(SIM_SCSR) &= ~0xC0;
+	simTransmitDone = simCycles + simCyclesPerByte;
+
+	if(simTransmitBytes == 0)
+	{
+		simTransmitStart = simCycles;
+	}
+
+	simTransmitBytes++;
+}
+
+/* Function Name: simSerialTransmit
+	Purpose: Raises the SCI interrupt when the firmware enables the transmit interrupt with the transmitter idle
+	Params: none
+	Returns: (void)
+*/
+void simSerialTransmit()
+{
+	if((*REGISTER(SIM_SCSR) & 0x80) && (*REGISTER(SIM_SCCR2) & 0x80))
+	{
+		serialInterrupt();
+	}
+}
+
+/* Function Name: simSerialTransmitted
+	Purpose: Frees the transmitter once a byte has gone out and raises the SCI interrupt for the next one if it
+			 is enabled. A run of bytes sent back to back is one transmit span on the timeline
+	Params: none
+	Returns: (void)
+*/
+void simSerialTransmitted()
+{
+	*REGISTER(SIM_SCSR) |= 0xC0;
+
+	if(*REGISTER(SIM_SCCR2) & 0x80)
+	{
+		serialInterrupt();
+	}
+
+	if(*REGISTER(SIM_SCSR) & 0x80)
+	{
+		simTimelineSpan(SIM_EVENT_TRANSMIT, simTransmitStart, simTransmitBytes);
+		simTransmitBytes = 0;
+	}
+}
+
+/* Function Name: simOutputWrite
+	Purpose: Replaces the write function of stdout, handing everything the firmware prints to serialPutchar as
+			 the library putchar does on the board
+	Params: (void *) cookie - Unused
+			(const char *) buffer - Bytes written
+			(size_t) size - Number of bytes
+	Returns: (ssize_t) Number of bytes accepted
+*/
+ssize_t simOutputWrite(void * cookie, const char * buffer, size_t size)
+{
+	size_t i;
+
+	(void) cookie;
+
+	if(simExiting)
+	{
+		return (ssize_t) size; /*Anything stdio still holds when the run stops is dropped, the firmware has stopped*/
+	}
+
+	for(i = 0; i < size; i++)
+	{
+		serialPutchar((unsigned char) buffer[i]);
+	}
+
+	return (ssize_t) size;
+}
+
+/* Function Name: simFlushOutput
+	Purpose: Hands the buffered output to the terminal stage
+	Params: none
+	Returns: (void)
+*/
+void simFlushOutput()
+{
+	simStagePush(SIM_STAGE_TERMINAL, simOutputBuffer, simOutputLength);
+	simOutputLength = 0;
+}
+
+/* Function Name: simTerminalWrite
+	Purpose: Terminal stage, writes serial output to the real stdout
+	Params: (const unsigned char *) buffer - Output
+			(size_t) size - Number of bytes
+	Returns: (void)
+*/
+void simTerminalWrite(const unsigned char * buffer, size_t size)
+{
+	size_t position = 0;
+	ssize_t length;
+
+	while(position < size)
+	{
+		length = write(STDOUT_FILENO, buffer + position, size - position);
+
+		if(length <= 0)
+		{
+			break; /*Nobody is listening, drop the output*/
+		}
+
+		position += (size_t) length;
+	}
+}
+
+/* Function Name: simBusy
+	Purpose: Advances virtual time while the firmware is busy, running the interrupts which fall due meanwhile
+	Params: (unsigned long long) cycles - Time taken
+	Returns: (void)
+*/
+void simBusy(unsigned long long cycles)
+{
+	unsigned long long finish = simCycles + cycles;
+	unsigned long long nextEvent;
+
+	simActiveCycles += cycles;
+
+	for(nextEvent = simNextEvent(); nextEvent <= finish; nextEvent = simNextEvent())
+	{
+		simRunUntil(nextEvent);
+	}
+
+	simCycles = finish;
+	simRegisters[SIM_TCNT] = (unsigned int) (simCycles & 0xFFFF);
+}
+
+/* Function Name: simApplySwitches
+	Purpose: Drives the port A input pins from the simulated switches, leaving the firmware's output pins alone
+	Params: none
+	Returns: (void)
+*/
+void simApplySwitches()
+{
+	unsigned char outputs = *REGISTER(SIM_PADDR);
+
+	*REGISTER(SIM_PADR) = (*REGISTER(SIM_PADR) & outputs) | (simSwitches & ~outputs);
+}
+
+/* Function Name: simCompareTime
+	Purpose: Works out when the free running counter will next match an output compare register
+	Params: (unsigned int) compare - Output compare register value
+	Returns: (unsigned long long) Virtual time of the match
+*/
+unsigned long long simCompareTime(unsigned int compare)
+{
+	unsigned long long delta = (compare - simCycles) & 0xFFFF;
+
+	if(delta == 0)
+	{
+		delta = 0x10000;
+	}
+
+	return simCycles + delta;
+}
+
+/* Function Name: simCompareWritten
+	Purpose: Schedules TOC2's new match after the firmware changes the width of the coming motor pulse outside
+			 turnMotor, whose deliveries are then sent in that frame
+	Params: none
+	Returns: (void)
+*/
+void simCompareWritten()
+{
+	if(simToc2Armed)
+	{
+		simNextToc2 = simCompareTime(simRegisters[SIM_TOC2]);
+	}
+
+	simLatencyFramed = simLatencyWaiting;
+}
+
+/* Function Name: simNextEvent
+	Purpose: Finds the virtual time of the next interrupt or switch change
+	Params: none
+	Returns: (unsigned long long) Virtual time of the next event
+*/
+unsigned long long simNextEvent()
+{
+	unsigned long long nextEvent = simNextRti;
+
+	if(*REGISTER(SIM_OC1M) & 0x40)
+	{
+		if(simToc1Armed == 0)
+		{
+			simNextToc1 = simCompareTime(simRegisters[SIM_TOC1]);
+			simToc1Armed = 1;
+		}
+
+		if(simNextToc1 < nextEvent)
+		{
+			nextEvent = simNextToc1;
+		}
+	}
+
+	if(*REGISTER(SIM_TMSK1) & 0x40)
+	{
+		if(simToc2Armed == 0)
+		{
+			simNextToc2 = simCompareTime(simRegisters[SIM_TOC2]);
+			simToc2Armed = 1;
+		}
+
+		if(simNextToc2 < nextEvent)
+		{
+			nextEvent = simNextToc2;
+		}
+	}
+
+	if(!(*REGISTER(SIM_SCSR) & 0x80) && simTransmitDone < nextEvent)
+	{
+		nextEvent = simTransmitDone;
+	}
+
+	if(simBoostRelease > simCycles && simBoostRelease < nextEvent)
+	{
+		nextEvent = simBoostRelease;
+	}
+
+	if(simReplayFile != NULL && simReplayTime > simCycles && simReplayTime < nextEvent)
+	{
+		nextEvent = simReplayTime;
+	}
+
+	return nextEvent;
+}
+
+/* Function Name: simRunUntil
+	Purpose: Advances virtual time and runs the interrupt handlers which fall due
+	Params: (unsigned long long) eventTime - Virtual time to advance to
+	Returns: (void)
+*/
+void simRunUntil(unsigned long long eventTime)
+{
+	simCycles = eventTime;
+	simRegisters[SIM_TCNT] = (unsigned int) (simCycles & 0xFFFF);
+
+	if(simCycles == simBoostRelease)
+	{
+		simSwitches &= ~0x01;
+	}
+
+	if(simReplayFile != NULL)
+	{
+		simReplayEvents(); /*Switches are pressed on time even while the firmware is busy*/
+		simSwitchRequests();
+	}
+
+	if(simCycles == simNextRti)
+	{
+		simNextRti += RTI_PERIOD;
+		*REGISTER(SIM_TFLG2) |= 0x40;
+
+		if(*REGISTER(SIM_TMSK2) & 0x40)
+		{
+			timer();
+			simTimelineSpan(SIM_EVENT_TIMER, eventTime, 0);
+			simLatencySecond(eventTime);
+		}
+
+		if(simShare != NULL)
+		{
+			simSharePublish(1);
+		}
+	}
+
+	if(!(*REGISTER(SIM_SCSR) & 0x80) && simCycles == simTransmitDone)
+	{
+		simSerialTransmitted();
+	}
+
+	if(simToc1Armed && simCycles == simNextToc1)
+	{
+		*REGISTER(SIM_TFLG1) |= 0x80;
+		simNextToc1 = simCompareTime(simRegisters[SIM_TOC1]);
+
+		if(*REGISTER(SIM_OC1M) & 0x40)
+		{
+			simMotorPin = (*REGISTER(SIM_OC1D) & 0x40) ? 1 : 0;
+			simLatencyMotorPulse();
+		}
+		else
+		{
+			simToc1Armed = 0;
+		}
+	}
+
+	if(simToc2Armed && simCycles == simNextToc2)
+	{
+		*REGISTER(SIM_TFLG1) |= 0x40;
+
+		switch(*REGISTER(SIM_TCTL1) & 0xC0)
+		{
+			case 0x40:
+			simMotorPin = !simMotorPin;
+			break;
+
+			case 0x80:
+			simMotorPin = 0;
+			break;
+
+			case 0xC0:
+			simMotorPin = 1;
+			break;
+		}
+
+		if(*REGISTER(SIM_TMSK1) & 0x40)
+		{
+			turnMotor();
+			simTimelineSpan(SIM_EVENT_MOTOR, eventTime, 0);
+			simLatencyFramed = simLatencyWaiting;
+			simNextToc1 = simCompareTime(simRegisters[SIM_TOC1]);
+			simNextToc2 = simCompareTime(simRegisters[SIM_TOC2]);
+		}
+		else
+		{
+			simToc2Armed = 0;
+		}
+	}
+
+	simApplySwitches();
+}
+
+/* Function Name: simWallDelayMs
+	Purpose: Works out how long to wait on the wall clock until the given virtual time
+	Params: (unsigned long long) eventTime - Virtual time
+	Returns: (long) Milliseconds until that time, 0 if already passed
+*/
+long simWallDelayMs(unsigned long long eventTime)
+{
+	struct timespec now;
+	long long elapsedUs;
+	long long targetUs;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsedUs = (long long) (now.tv_sec - simWallStart.tv_sec) * 1000000LL + (now.tv_nsec - simWallStart.tv_nsec) / 1000;
+	targetUs = (long long) (eventTime * 1000000ULL / E_CLOCK_HZ);
+
+	if(targetUs <= elapsedUs)
+	{
+		return 0;
+	}
+
+	return (long) ((targetUs - elapsedUs + 999) / 1000);
+}
+
+/* Function Name: simPollInput
+	Purpose: Waits for serial input until the next event is due (or not at all in fast mode),
+			 loading the receive data register if a byte arrives
+	Params: (unsigned long long) nextEvent - Virtual time of the next event
+	Returns: (int) 1 if a byte was received, 0 otherwise
+*/
+int simPollInput(unsigned long long nextEvent)
+{
+	struct pollfd input;
+	long timeout = 0;
+	ssize_t length;
+
+	if(simInputCount == 0 && !(simFast && simInputClosed))
+	{
+		if(simFast == 0)
+		{
+			timeout = simWallDelayMs(nextEvent);
+			simFlushOutput();
+		}
+
+		input.fd = STDIN_FILENO;
+		input.events = POLLIN;
+
+		if(poll(&input, simInputClosed ? 0 : 1, (int) timeout) > 0)
+		{
+			length = read(STDIN_FILENO, simInputBuffer, sizeof(simInputBuffer));
+
+			if(length > 0)
+			{
+				simInputHead = 0;
+				simInputCount = (int) length;
+			}
+			else
+			{
+				simInputClosed = 1;
+
+				if(simRunLimit == 0)
+				{
+					simExit();
+				}
+			}
+		}
+		else if(simFast == 0 && simWallDelayMs(nextEvent) > 0)
+		{
+			return 1; /*Interrupted by a signal, let the idle loop pick it up*/
+		}
+	}
+
+	if(simInputCount == 0)
+	{
+		return 0;
+	}
+
+	simInputCount--;
+	simDeliverInput(simInputBuffer[simInputHead++]);
+
+	return 1;
+}
+
+/* Function Name: simDeliverInput
+	Purpose: Loads a received byte into the receive data register, records it if a trace is being written,
+			 and raises the SCI interrupt if it is enabled
+	Params: (unsigned char) value - Byte received
+	Returns: (void)
+*/
+void simDeliverInput(unsigned char value)
+{
+	*REGISTER(SIM_SCDR) = value;
+	*REGISTER(SIM_SCSR) |= 0x20;
+	simInputDelivered++;
+	simTraceWrite(TRACE_INPUT, value);
+
+	/*A command's latency starts when its first character is actually delivered, which is later than it was typed
+		if the firmware was still busy with the command before*/
+	if(simScenarioStarted < simScenarioCommands
+		&& simInputDelivered > (simScenarioStarted > 0 ? simScenarioLastByte[simScenarioStarted - 1] : 0))
+	{
+		simScenarioStart[simScenarioStarted++] = simCycles;
+	}
+
+	if(*REGISTER(SIM_SCCR2) & 0x20)
+	{
+		serialInterrupt();
+		simTimelineSpan(SIM_EVENT_RECEIVE, simCycles, value);
+	}
+}
+
+/* Function Name: simTraceWrite
+	Purpose: Appends a record to the trace file, if one is being written
+	Params: (int) type - Record type
+			(int) value - Byte received, for TRACE_INPUT records
+	Returns: (void)
+*/
+void simTraceWrite(int type, int value)
+{
+	if(simRecordFile == NULL)
+	{
+		return;
+	}
+
+	simTraceEncode(simRecordFile, simCycles - simTraceTime, type, value);
+	simTraceTime = simCycles;
+}
+
+/* Function Name: simTraceEncode
+	Purpose: Writes one trace record
+	Params: (FILE *) trace - Trace file
+			(unsigned long long) delta - Virtual time since the previous record
+			(int) type - Record type
+			(int) value - Byte received, for TRACE_INPUT records
+	Returns: (void)
+*/
+void simTraceEncode(FILE * trace, unsigned long long delta, int type, int value)
+{
+	while(delta >= 0x80)
+	{
+		fputc((int) (delta & 0x7F) | 0x80, trace);
+		delta >>= 7;
+	}
+
+	fputc((int) delta, trace);
+	fputc(type, trace);
+
+	if(type == TRACE_INPUT)
+	{
+		fputc(value, trace);
+	}
+}
+
+/* Function Name: simTimeline
+	Purpose: Adds an event to the timeline, if one is being written. Records are kept in a fixed buffer and
+			 spooled to a temporary file a buffer at a time, so a long run costs a copy per event
+	Params: (int) event - SIM_EVENT_ number
+			(int) phase - 'B' to begin a span, 'E' to end it, 'X' for a span which ended now
+			(unsigned long) value - Value shown with the event
+			(unsigned long) duration - Length in cycles of an 'X' span
+	Returns: (void)
+*/
+void simTimeline(int event, int phase, unsigned long value, unsigned long duration)
+{
+	struct simTimelineRecord * record;
+
+	if(event == SIM_EVENT_DELIVERY && phase == 'B')
+	{
+		simLatencyDelivery(value);
+	}
+
+	if(simTimelineFile == NULL)
+	{
+		return;
+	}
+
+	record = &simTimelineBuffer[simTimelineCount++];
+	record->cycles = simCycles - duration;
+	record->value = value;
+	record->duration = duration;
+	record->event = (unsigned char) event;
+	record->phase = (unsigned char) phase;
+
+	if(simTimelineCount == TIMELINE_BUFFER_RECORDS)
+	{
+		fwrite(simTimelineBuffer, sizeof(struct simTimelineRecord), (size_t) simTimelineCount, simTimelineSpool);
+		simTimelineCount = 0;
+	}
+}
+
+/* Function Name: simTimelineSpan
+	Purpose: Adds a span which the simulator ran itself, such as an interrupt handler, now it has finished
+	Params: (int) event - SIM_EVENT_ number
+			(unsigned long long) start - Virtual time the span began
+			(unsigned long) value - Value shown with the event
+	Returns: (void)
+*/
+void simTimelineSpan(int event, unsigned long long start, unsigned long value)
+{
+	simTimeline(event, 'X', value, (unsigned long) (simCycles - start));
+}
+
+/* Function Name: simTimelineWrite
+	Purpose: Converts the spooled timeline to a Chrome trace, with times in microseconds of virtual time.
+			 Spans of the same event do not nest, so a begin while one is open ends it first, an end with
+			 none open is dropped and spans still open at the end of the run are closed there
+	Params: none
+	Returns: (void)
+*/
+void simTimelineWrite()
+{
+	struct simTimelineRecord record;
+	const struct simTimelineEvent * event;
+	int open[SIM_EVENT_COUNT];
+	int i;
+
+	fwrite(simTimelineBuffer, sizeof(struct simTimelineRecord), (size_t) simTimelineCount, simTimelineSpool);
+	rewind(simTimelineSpool);
+	memset(open, 0, sizeof(open));
+
+	fprintf(simTimelineFile, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+		"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"scheduleDose\"}}");
+
+	for(i = 1; i < (int) (sizeof(simTimelineThreads) / sizeof(simTimelineThreads[0])); i++)
+	{
+		fprintf(simTimelineFile, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+			i, simTimelineThreads[i]);
+	}
+
+	while(fread(&record, sizeof(record), 1, simTimelineSpool) == 1)
+	{
+		event = &simTimelineEvents[record.event];
+
+		if(record.phase == 'E' && !open[record.event])
+		{
+			continue;
+		}
+
+		if(record.phase == 'B' && open[record.event])
+		{
+			fprintf(simTimelineFile, ",\n{\"name\":\"%s\",\"ph\":\"E\",\"ts\":%.1f,\"pid\":1,\"tid\":%d}",
+				event->name, record.cycles * 1e6 / E_CLOCK_HZ, event->thread);
+		}
+
+		open[record.event] = record.phase == 'B';
+		fprintf(simTimelineFile, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.1f,\"pid\":1,\"tid\":%d",
+			event->name, record.phase, record.cycles * 1e6 / E_CLOCK_HZ, event->thread);
+
+		if(record.phase == 'X')
+		{
+			fprintf(simTimelineFile, ",\"dur\":%.1f", record.duration * 1e6 / E_CLOCK_HZ);
+		}
+
+		if(event->argument != NULL && record.phase != 'E')
+		{
+			fprintf(simTimelineFile, ",\"args\":{\"%s\":%lu}", event->argument, record.value);
+		}
+
+		fputc('}', simTimelineFile);
+	}
+
+	for(i = 0; i < SIM_EVENT_COUNT; i++)
+	{
+		if(open[i])
+		{
+			fprintf(simTimelineFile, ",\n{\"name\":\"%s\",\"ph\":\"E\",\"ts\":%.1f,\"pid\":1,\"tid\":%d}",
+				simTimelineEvents[i].name, simCycles * 1e6 / E_CLOCK_HZ, simTimelineEvents[i].thread);
+		}
+	}
+
+	fprintf(simTimelineFile, "\n]}\n");
+	fclose(simTimelineFile);
+	fclose(simTimelineSpool);
+	simTimelineFile = NULL;
+}
+
+/* Function Name: simEepromOpen
+	Purpose: Loads the EEPROM and its wear from a file, or starts a new file with the EEPROM erased
+	Params: (const char *) path - File name
+	Returns: (int) 1 on success, 0 if the file could not be opened
+*/
+int simEepromOpen(const char * path)
+{
+	simEepromFile = fopen(path, "r+b");
+	memset(simEepromCells, 0xFF, sizeof(simEepromCells));
+	memset(simEepromWear, 0, sizeof(simEepromWear));
+
+	if(simEepromFile != NULL)
+	{
+		if(fread(simEepromCells, 1, sizeof(simEepromCells), simEepromFile) != sizeof(simEepromCells)
+			|| fread(simEepromWear, 1, sizeof(simEepromWear), simEepromFile) != sizeof(simEepromWear))
+		{
+			fprintf(stderr, "%s is not an EEPROM file\n", path);
+			return 0;
+		}
+
+		return 1;
+	}
+
+	simEepromFile = fopen(path, "w+b");
+
+	if(simEepromFile == NULL)
+	{
+		perror(path);
+		return 0;
+	}
+
+	simEepromSave(0, SIM_EEPROM_SIZE);
+	return 1;
+}
+
+/* Function Name: simEepromSave
+	Purpose: Writes part of the EEPROM and its wear through to the file, so it is kept if the run is killed
+	Params: (int) first - First byte
+			(int) count - Number of bytes
+	Returns: (void)
+*/
+void simEepromSave(int first, int count)
+{
+	if(simEepromFile == NULL)
+	{
+		return;
+	}
+
+	fseek(simEepromFile, first, SEEK_SET);
+	fwrite(&simEepromCells[first], 1, (size_t) count, simEepromFile);
+	fseek(simEepromFile, (long) (sizeof(simEepromCells) + first * sizeof(simEepromWear[0])), SEEK_SET);
+	fwrite(&simEepromWear[first], sizeof(simEepromWear[0]), (size_t) count, simEepromFile);
+	fflush(simEepromFile);
+}
+
+/* Function Name: simEepromProgram
+	Purpose: Carries out the erase or program cycle set up in PPROG, with the data the firmware latched by writing
+			 to the EEPROM, then keeps the processor busy for the 10 ms it takes
+	Params: (int) offset - Offset latched
+	Returns: (void)
+*/
+void simEepromProgram(int offset)
+{
+	unsigned char mode = *REGISTER(SIM_PPROG);
+	unsigned long long start = simCycles;
+	int first = offset;
+	int count = 1;
+	int i;
+
+	if((mode & 0x03) != 0x03) /*EELAT and EPGM*/
+	{
+		return;
+	}
+
+	if(mode & 0x04) /*ERASE*/
+	{
+		if(!(mode & 0x10)) /*Not BYTE*/
+		{
+			first = (mode & 0x08) ? (offset & ~15) : 0; /*ROW, otherwise bulk*/
+			count = (mode & 0x08) ? 16 : SIM_EEPROM_SIZE;
+		}
+
+		for(i = first; i < first + count; i++)
+		{
+			simEepromWear[i]++;
+			simEepromCells[i] = (simEepromWear[i] > EEPROM_ENDURANCE) ? (unsigned char) (0xFF ^ (1 << (i & 7))) : 0xFF;
+		}
+	}
+	else
+	{
+		simEepromCells[offset] &= simEeprom[offset]; /*Programming only clears bits*/
+	}
+
+	for(i = first; i < first + count; i++)
+	{
+		simEeprom[i] = simEepromCells[i];
+	}
+
+	simEepromCycles++;
+	simEepromSave(first, count);
+	simBusy(EEPROM_PROGRAM_CYCLES);
+	simTimelineSpan(SIM_EVENT_EEPROM, start, (unsigned long) offset);
+}
+
+/* Function Name: simShareOpen
+	Purpose: Creates the shared memory region the live state is published in
+	Params: (const char *) name - Region name, without the leading /
+	Returns: (int) 1 on success, 0 if the region could not be created
+*/
+int simShareOpen(const char * name)
+{
+	int descriptor;
+
+	snprintf(simShareName, sizeof(simShareName), "/%s", name);
+	descriptor = shm_open(simShareName, O_CREAT | O_RDWR, 0644);
+
+	if(descriptor < 0 || ftruncate(descriptor, sizeof(struct liveState)) != 0)
+	{
+		perror(simShareName);
+		return 0;
+	}
+
+	simShare = mmap(NULL, sizeof(struct liveState), PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+	close(descriptor);
+
+	if(simShare == MAP_FAILED)
+	{
+		perror(simShareName);
+		simShare = NULL;
+		return 0;
+	}
+
+	memset(simShare, 0, sizeof(struct liveState));
+	simShare->size = sizeof(struct liveState);
+	simShare->layoutVersion = LIVE_STATE_VERSION;
+	__atomic_store_n(&simShare->magic, LIVE_STATE_MAGIC, __ATOMIC_RELEASE); /*Set last, so a reader never sees a valid header on a region being set up*/
+
+	return 1;
+}
+
+/* Function Name: simSharePublish
+	Purpose: Takes a snapshot of the current state for the share stage to publish. Only host memory is touched,
+			 so virtual time and the interrupt timing are unaffected
+	Params: (int) running - 0 for the last snapshot, when the simulation ends
+	Returns: (void)
+*/
+void simSharePublish(int running)
+{
+	struct liveSnapshot snapshot;
+
+	simShareCapture(&snapshot, running);
+	simStagePush(SIM_STAGE_SHARE, &snapshot, sizeof(snapshot));
+}
+
+/* Function Name: simShareCapture
+	Purpose: Copies the firmware state readers are shown into a snapshot
+	Params: (struct liveSnapshot *) snapshot - Filled in, apart from its sequence
+			(int) running - 0 for the last snapshot, when the simulation ends
+	Returns: (void)
+*/
+void simShareCapture(struct liveSnapshot * snapshot, int running)
+{
+	struct clockTime now;
+	int i;
+
+	memset(snapshot, 0, sizeof(*snapshot));
+	now.days = days;
+	now.hours = hours;
+	now.mins = mins;
+	now.secs = secs;
+	now.upTime = (long) upTime;
+	snapshot->flags = (running ? 0x01 : 0) | (suspended ? 0x02 : 0) | (doseState.boostError ? 0x04 : 0)
+		| (motorRunning ? 0x08 : 0);
+	snapshot->cycles = simCycles;
+	snapshot->days = now.days;
+	snapshot->clock = (int32_t) doseCoreSecondsOfDay(now.hours, now.mins, now.secs);
+	snapshot->scheduledDoses = doseState.schedule->scheduledDoses;
+	snapshot->nextDoseIndex = doseState.nextDoseIndex;
+	snapshot->nextDoseTime = (int32_t) doseState.nextDoseTime;
+	snapshot->statusCount[0] = doseState.statusCount[0];
+	snapshot->statusCount[1] = doseState.statusCount[1];
+	snapshot->statusCount[2] = doseState.statusCount[2];
+	snapshot->deliveryEvents = doseState.deliveryEvents;
+	snapshot->budgetWithheld = doseState.budgetWithheld;
+	snapshot->boostsGiven = doseState.boostsGiven;
+	snapshot->boostIntensity = doseState.boostIntensity;
+	snapshot->sinceBoost = (int32_t) doseCoreSinceBoost(&doseState, &now);
+	snapshot->pulseDelay = pulseDelay;
+
+	for(i = 0; i < doseState.schedule->scheduledDoses && i < LIVE_STATE_DOSES; i++)
+	{
+		snapshot->doses[i].time = (int32_t) doseCoreSecondsOfDay(doseState.schedule->doses[i].hours, doseState.schedule->doses[i].mins, doseState.schedule->doses[i].secs);
+		snapshot->doses[i].status = doseState.status[i];
+		snapshot->doses[i].intensity = doseState.schedule->doses[i].intensity;
+		snapshot->doses[i].repeatDays = doseState.schedule->doses[i].repeatDays;
+		snapshot->doses[i].startDay = doseState.schedule->doses[i].startDay;
+	}
+}
+
+/* Function Name: simShareStore
+	Purpose: Share stage, writes each snapshot into the region's snapshot readers are not using and publishes it
+	Params: (const unsigned char *) buffer - Whole struct liveSnapshot records
+			(size_t) size - Number of bytes
+	Returns: (void)
+*/
+void simShareStore(const unsigned char * buffer, size_t size)
+{
+	struct liveSnapshot written;
+	struct liveSnapshot * snapshot;
+	int index;
+
+	for(; size >= sizeof(written); buffer += sizeof(written), size -= sizeof(written))
+	{
+		index = (int) (simShare->latest ^ 1);
+		snapshot = &simShare->snapshots[index];
+		memcpy(&written, buffer, sizeof(written));
+		written.sequence = snapshot->sequence + 1; /*Odd for as long as the copy takes*/
+
+		snapshot->sequence = written.sequence;
+		__sync_synchronize();
+		memcpy((void *) snapshot, &written, sizeof(written));
+		__atomic_store_n(&snapshot->sequence, written.sequence + 1, __ATOMIC_RELEASE);
+		__atomic_store_n(&simShare->latest, (uint32_t) index, __ATOMIC_RELEASE); /*Readers see the snapshot whole once they see this*/
+	}
+}
+
+/* Function Name: simElapsedNs
+	Purpose: Works out the wall time since a given time
+	Params: (struct timespec *) since - Start
+	Returns: (unsigned long long) Nanoseconds since then
+*/
+unsigned long long simElapsedNs(struct timespec * since)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (unsigned long long) ((long long) (now.tv_sec - since->tv_sec) * 1000000000LL + (now.tv_nsec - since->tv_nsec));
+}
+
+/* Function Name: simStageStart
+	Purpose: Sets up a pipeline stage, on a thread of its own unless every stage runs on the firmware's thread
+	Params: (int) stage - SIM_STAGE_ index
+			(const char *) name - Name in the report
+			(void (*)(const unsigned char *, size_t)) consume - Does the stage's work on bytes pushed to it
+			(size_t) record - Bytes are pushed and consumed in multiples of this
+			(size_t) size - Ring size in bytes, a multiple of record
+	Returns: (void)
+*/
+void simStageStart(int stage, const char * name, void (*consume)(const unsigned char *, size_t), size_t record, size_t size)
+{
+	struct simStage * current = &simStages[stage];
+
+	current->name = name;
+	current->consume = consume;
+	current->record = record;
+
+	if(simPipelined)
+	{
+		current->ring.data = malloc(size);
+		current->ring.size = size;
+
+		if(current->ring.data != NULL && pthread_create(&current->thread, NULL, simStageRun, current) == 0)
+		{
+			current->threaded = 1;
+		}
+		else
+		{
+			free(current->ring.data); /*Run the stage inline instead*/
+			current->ring.data = NULL;
+		}
+	}
+}
+
+/* Function Name: simStagePush
+	Purpose: Hands bytes to a stage from the firmware's thread, waiting while its ring is full. A stage without
+			 a thread does the work there and then
+	Params: (int) stage - SIM_STAGE_ index
+			(const void *) data - Whole records
+			(size_t) size - Number of bytes
+	Returns: (void)
+*/
+void simStagePush(int stage, const void * data, size_t size)
+{
+	struct simStage * current = &simStages[stage];
+	struct simRing * ring = &current->ring;
+	const unsigned char * bytes = data;
+	struct timespec waitStart;
+	struct timespec pause = {0, SIM_STAGE_WAIT_NS};
+	size_t head;
+	size_t space;
+	size_t chunk;
+
+	if(!current->threaded)
+	{
+		simStageConsume(current, bytes, size);
+		return;
+	}
+
+	head = ring->head;
+
+	while(size > 0)
+	{
+		space = ring->size - (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE));
+
+		if(space < current->record)
+		{
+			current->stalls++;
+			clock_gettime(CLOCK_MONOTONIC, &waitStart);
+
+			while(ring->size - (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) < current->record)
+			{
+				nanosleep(&pause, NULL);
+			}
+
+			current->stallNs += simElapsedNs(&waitStart);
+			continue;
+		}
+
+		chunk = ring->size - head % ring->size;
+		chunk = (chunk < space) ? chunk : space;
+		chunk = (chunk < size) ? chunk : size;
+		memcpy(ring->data + head % ring->size, bytes, chunk);
+		head += chunk;
+		bytes += chunk;
+		size -= chunk;
+		__atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+	}
+}
+
+/* Function Name: simStageRun
+	Purpose: Thread of a pipeline stage, consumes its ring until the firmware's thread closes it
+	Params: (void *) argument - struct simStage of the stage
+	Returns: (void *) NULL
+*/
+void * simStageRun(void * argument)
+{
+	struct simStage * stage = argument;
+	struct simRing * ring = &stage->ring;
+	struct timespec pause = {0, SIM_STAGE_WAIT_NS};
+	size_t tail = 0;
+	size_t available;
+	size_t chunk;
+	int closed;
+	int idle = 0;
+
+	for(;;)
+	{
+		closed = __atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE); /*Before head, so nothing pushed is missed*/
+		available = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - tail;
+
+		if(available == 0)
+		{
+			if(closed)
+			{
+				return NULL;
+			}
+
+			if(idle++ < SIM_STAGE_SPINS)
+			{
+				sched_yield();
+			}
+			else
+			{
+				stage->waits++;
+				nanosleep(&pause, NULL);
+			}
+
+			continue;
+		}
+
+		idle = 0;
+
+		chunk = ring->size - tail % ring->size;
+		chunk = (chunk < available) ? chunk : available;
+		simStageConsume(stage, ring->data + tail % ring->size, chunk);
+		tail += chunk;
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+	}
+}
+
+/* Function Name: simStageConsume
+	Purpose: Runs a stage's work on some bytes, timing it
+	Params: (struct simStage *) stage - Stage
+			(const unsigned char *) bytes - Whole records
+			(size_t) size - Number of bytes
+	Returns: (void)
+*/
+void simStageConsume(struct simStage * stage, const unsigned char * bytes, size_t size)
+{
+	struct timespec start;
+
+	if(size == 0)
+	{
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	stage->consume(bytes, size);
+	stage->busyNs += simElapsedNs(&start);
+	stage->bytes += size;
+}
+
+/* Function Name: simStageStop
+	Purpose: Closes each stage's ring and waits for its thread to finish what is left
+	Params: none
+	Returns: (void)
+*/
+void simStageStop()
+{
+	int i;
+
+	for(i = 0; i < SIM_STAGES; i++)
+	{
+		if(simStages[i].threaded)
+		{
+			__atomic_store_n(&simStages[i].ring.closed, 1, __ATOMIC_RELEASE);
+			pthread_join(simStages[i].thread, NULL);
+			free(simStages[i].ring.data);
+			simStages[i].ring.data = NULL;
+			simStages[i].threaded = 0;
+		}
+	}
+}
+
+/* Function Name: simStageReport
+	Purpose: Prints the throughput of each stage on stderr
+	Params: none
+	Returns: (void)
+*/
+void simStageReport()
+{
+	struct simStage * stage;
+	double busy;
+	int i;
+
+	fprintf(stderr, "\nPipeline: %s\n", simPipelined ? "a thread per stage" : "every stage on the firmware's thread");
+
+	for(i = 0; i < SIM_STAGES; i++)
+	{
+		stage = &simStages[i];
+
+		if(stage->name == NULL)
+		{
+			continue;
+		}
+
+		busy = stage->busyNs / 1e9;
+		fprintf(stderr, "  %-10s %llu %s in %.3fs busy (%.1f MB/s), %llu sleeps, firmware stalled %llu times for %.3fs\n",
+			stage->name, stage->bytes / stage->record, (stage->record == 1) ? "bytes" : "snapshots", busy,
+			(busy > 0) ? stage->bytes / busy / 1e6 : 0.0, stage->waits, stage->stalls, stage->stallNs / 1e9);
+	}
+}
+
+/* Function Name: simReplayNext
+	Purpose: Reads the next record from the trace being replayed. A truncated trace ends where it was cut off
+	Params: none
+	Returns: (void)
+*/
+void simReplayNext()
+{
+	unsigned long long delta = 0;
+	int shift = 0;
+	int value;
+
+	do
+	{
+		value = fgetc(simReplayFile);
+
+		if(value == EOF)
+		{
+			simReplayType = TRACE_END;
+			simRunLimit = simReplayTime;
+			return;
+		}
+
+		delta |= (unsigned long long) (value & 0x7F) << shift;
+		shift += 7;
+	}
+	while(value & 0x80);
+
+	simReplayTime += delta;
+	simReplayType = fgetc(simReplayFile);
+
+	if(simReplayType == TRACE_INPUT)
+	{
+		simReplayValue = fgetc(simReplayFile);
+	}
+	else if(simReplayType == TRACE_END || simReplayType == EOF)
+	{
+		simReplayType = TRACE_END;
+		simRunLimit = simReplayTime;
+	}
+}
+
+/* Function Name: simReplayEvents
+	Purpose: Applies the switch presses and budget clears in the trace which are due. Only called while the
+			 firmware waits, so the budget is never cleared part way through a tick
+	Params: none
+	Returns: (void)
+*/
+void simReplayEvents()
+{
+	while(simReplayTime <= simCycles && (simReplayType == TRACE_BOOST || simReplayType == TRACE_EMERGENCY
+		|| simReplayType == TRACE_CLEAR_BUDGET))
+	{
+		if(simReplayType == TRACE_BOOST)
+		{
+			simBoostRequest = 1;
+		}
+		else if(simReplayType == TRACE_EMERGENCY)
+		{
+			simEmergencyRequest = 1;
+		}
+		else
+		{
+			doseCoreClearBudget(&doseState);
+		}
+
+		simReplayNext();
+	}
+}
+
+/* Function Name: simReplayInput
+	Purpose: Delivers the next byte of the trace if it is due by now. A byte falling due later is delivered at
+			 the first idle after its time
+	Params: none
+	Returns: (int) 1 if a byte was delivered, 0 otherwise
+*/
+int simReplayInput()
+{
+	if(simReplayType != TRACE_INPUT || simReplayTime > simCycles)
+	{
+		return 0;
+	}
+
+	simDeliverInput((unsigned char) simReplayValue);
+	simReplayNext();
+
+	return 1;
+}
+
+/* Function Name: simLoadScenario
+	Purpose: Turns a scenario file into a trace which is then replayed. Commands are sorted by time and typed
+			 one after another at the line rate, and switch events are merged in at their own times
+	Params: (FILE *) scenario - Scenario to read
+			(const char *) path - Scenario name used in messages and the report, until it names itself
+	Returns: (FILE *) Trace ready to replay, NULL if the scenario is not valid
+*/
+FILE * simLoadScenario(FILE * scenario, const char * path)
+{
+	FILE * trace;
+	char line[SCENARIO_LINE_LENGTH];
+	char keyword[16];
+	char * rest;
+	char * every;
+	static unsigned char input[SCENARIO_MAX_INPUT];
+	static unsigned char sorted[SCENARIO_MAX_INPUT];
+	static unsigned long long inputTime[SCENARIO_MAX_INPUT];
+	static unsigned long commandFirst[SCENARIO_MAX_EVENTS];
+	static unsigned long long switchTime[SCENARIO_MAX_EVENTS];
+	static int switchType[SCENARIO_MAX_EVENTS];
+	int inputCount = 0;
+	int switchCount = 0;
+	int lineNumber = 0;
+	int length;
+	int repeat;
+	int i, j;
+	unsigned long first, last;
+	unsigned long long start, step, eventTime, endTime = 0, lastTime = 0, charTime, previous;
+	long count;
+	double stepSecs;
+
+	strncpy(simScenarioName, path, sizeof(simScenarioName) - 1);
+
+	while(fgets(line, sizeof(line), scenario) != NULL)
+	{
+		lineNumber++;
+		keyword[0] = '\0';
+
+		if(sscanf(line, "%15s", keyword) != 1 || keyword[0] == '#')
+		{
+			continue;
+		}
+
+		rest = strstr(line, keyword) + strlen(keyword);
+
+		while(isspace((unsigned char) *rest))
+		{
+			rest++;
+		}
+
+		if(strcmp(keyword, "name") == 0)
+		{
+			length = strcspn(rest, "\r\n");
+
+			if(length >= (int) sizeof(simScenarioName))
+			{
+				length = sizeof(simScenarioName) - 1;
+			}
+
+			memcpy(simScenarioName, rest, length);
+			simScenarioName[length] = '\0';
+			continue;
+		}
+
+		if(strcmp(keyword, "baud") == 0)
+		{
+			simBaud = strtoul(rest, NULL, 10);
+			continue;
+		}
+
+		start = simScenarioTime(rest);
+		step = 0;
+		count = 1;
+		every = strstr(strrchr(rest, '"') != NULL ? strrchr(rest, '"') : rest, "every");
+
+		if(every != NULL && sscanf(every + 5, "%lf %ld", &stepSecs, &count) == 2 && stepSecs >= 0)
+		{
+			step = (unsigned long long) (stepSecs * E_CLOCK_HZ + 0.5);
+		}
+		else if(every != NULL)
+		{
+			count = 0;
+		}
+
+		if(count < 1 || start == (unsigned long long) -1)
+		{
+			fprintf(stderr, "%s:%d: bad time or repeat\n", path, lineNumber);
+			return NULL;
+		}
+
+		if(strcmp(keyword, "end") == 0)
+		{
+			endTime = start;
+			continue;
+		}
+
+		for(repeat = 0; repeat < count; repeat++)
+		{
+			eventTime = start + step * repeat;
+
+			if(eventTime > lastTime)
+			{
+				lastTime = eventTime;
+			}
+
+			if(strcmp(keyword, "send") == 0)
+			{
+				if(simScenarioCommands >= SCENARIO_MAX_EVENTS)
+				{
+					fprintf(stderr, "%s:%d: too many commands\n", path, lineNumber);
+					return NULL;
+				}
+
+				length = simScenarioText(rest, input + inputCount, SCENARIO_MAX_INPUT - inputCount, repeat);
+
+				if(length <= 0)
+				{
+					fprintf(stderr, "%s:%d: bad or missing text\n", path, lineNumber);
+					return NULL;
+				}
+
+				for(i = 0; i < length; i++)
+				{
+					inputTime[inputCount + i] = eventTime;
+				}
+
+				inputCount += length;
+				simScenarioStart[simScenarioCommands] = eventTime;
+				simScenarioLastByte[simScenarioCommands] = inputCount;
+				simScenarioCommands++;
+			}
+			else if(strcmp(keyword, "boost") == 0 || strcmp(keyword, "emergency") == 0 || strcmp(keyword, "clearbudget") == 0)
+			{
+				if(switchCount >= SCENARIO_MAX_EVENTS)
+				{
+					fprintf(stderr, "%s:%d: too many switch events\n", path, lineNumber);
+					return NULL;
+				}
+
+				switchTime[switchCount] = eventTime;
+				switchType[switchCount] = keyword[0] == 'b' ? TRACE_BOOST : keyword[0] == 'e' ? TRACE_EMERGENCY : TRACE_CLEAR_BUDGET;
+				switchCount++;
+			}
+			else
+			{
+				fprintf(stderr, "%s:%d: unknown directive %s\n", path, lineNumber, keyword);
+				return NULL;
+			}
+		}
+	}
+
+	if(simBaud == 0)
+	{
+		simBaud = 9600;
+	}
+
+	/*Commands are sorted by time with an insertion sort, which keeps those due together in the order they were
+		written, and their text is copied out in that order. Repeats from different lines then interleave*/
+	for(i = 0; i < simScenarioCommands; i++)
+	{
+		commandFirst[i] = i > 0 ? simScenarioLastByte[i - 1] : 0;
+	}
+
+	for(i = 1; i < simScenarioCommands; i++)
+	{
+		for(j = i; j > 0 && simScenarioStart[j - 1] > simScenarioStart[j]; j--)
+		{
+			eventTime = simScenarioStart[j];
+			simScenarioStart[j] = simScenarioStart[j - 1];
+			simScenarioStart[j - 1] = eventTime;
+			first = commandFirst[j];
+			commandFirst[j] = commandFirst[j - 1];
+			commandFirst[j - 1] = first;
+			last = simScenarioLastByte[j];
+			simScenarioLastByte[j] = simScenarioLastByte[j - 1];
+			simScenarioLastByte[j - 1] = last;
+		}
+	}
+
+	last = 0;
+
+	for(i = 0; i < simScenarioCommands; i++)
+	{
+		memcpy(sorted + last, input + commandFirst[i], simScenarioLastByte[i] - commandFirst[i]);
+		last += simScenarioLastByte[i] - commandFirst[i];
+		simScenarioLastByte[i] = last;
+	}
+
+	memcpy(input, sorted, inputCount);
+
+	/*Each command is typed no earlier than its own time and no earlier than the end of the one before. Every
+		character then takes one character time on the line*/
+	charTime = (E_CLOCK_HZ * 10ULL) / simBaud;
+	previous = 0;
+	j = 0;
+
+	for(i = 0; i < simScenarioCommands; i++)
+	{
+		if(simScenarioStart[i] < previous)
+		{
+			simScenarioStart[i] = previous;
+		}
+
+		previous = simScenarioStart[i];
+
+		for(; j < (int) simScenarioLastByte[i]; j++)
+		{
+			inputTime[j] = previous;
+			previous += charTime;
+		}
+	}
+
+	if(previous > lastTime)
+	{
+		lastTime = previous;
+	}
+
+	if(endTime == 0)
+	{
+		endTime = lastTime + 60 * E_CLOCK_HZ;
+	}
+
+	/*Switch events are sorted by time with an insertion sort, scenarios only hold a handful*/
+	for(i = 1; i < switchCount; i++)
+	{
+		for(j = i; j > 0 && switchTime[j - 1] > switchTime[j]; j--)
+		{
+			eventTime = switchTime[j];
+			switchTime[j] = switchTime[j - 1];
+			switchTime[j - 1] = eventTime;
+			repeat = switchType[j];
+			switchType[j] = switchType[j - 1];
+			switchType[j - 1] = repeat;
+		}
+	}
+
+	trace = tmpfile();
+
+	if(trace == NULL)
+	{
+		perror("tmpfile");
+		return NULL;
+	}
+
+	fwrite(TRACE_MAGIC, 1, 4, trace);
+	fputc((int) (simBaud >> 24) & 0xFF, trace);
+	fputc((int) (simBaud >> 16) & 0xFF, trace);
+	fputc((int) (simBaud >> 8) & 0xFF, trace);
+	fputc((int) simBaud & 0xFF, trace);
+
+	previous = 0;
+	i = 0;
+	j = 0;
+
+	while(i < inputCount || j < switchCount)
+	{
+		if(j >= switchCount || (i < inputCount && inputTime[i] <= switchTime[j]))
+		{
+			simTraceEncode(trace, inputTime[i] - previous, TRACE_INPUT, input[i]);
+			previous = inputTime[i++];
+		}
+		else
+		{
+			simTraceEncode(trace, switchTime[j] - previous, switchType[j], 0);
+			previous = switchTime[j++];
+		}
+	}
+
+	simTraceEncode(trace, endTime > previous ? endTime - previous : 0, TRACE_END, 0);
+	rewind(trace);
+
+	return trace;
+}
+
+/* Function Name: simScenarioTime
+	Purpose: Reads a time in seconds, which may have a fractional part, from a scenario line
+	Params: (const char *) text - Text starting with the time
+	Returns: (unsigned long long) Time in E clock cycles, or -1 if it is not a valid time
+*/
+unsigned long long simScenarioTime(const char * text)
+{
+	char * end;
+	double value;
+
+	value = strtod(text, &end);
+
+	if(end == text || value < 0)
+	{
+		return (unsigned long long) -1;
+	}
+
+	return (unsigned long long) (value * E_CLOCK_HZ + 0.5);
+}
+
+/* Function Name: simScenarioText
+	Purpose: Expands the quoted text of a send directive
+	Params: (char *) line - Rest of the directive, the text is the first quoted string in it
+			(unsigned char *) output - Destination for the expanded text
+			(int) space - Size of the destination
+			(int) repeat - Repeat number substituted for %n and %N
+	Returns: (int) Length of the expanded text, -1 if it is missing or does not fit
+*/
+int simScenarioText(char * line, unsigned char * output, int space, int repeat)
+{
+	char * text;
+	char number[8];
+	int length = 0;
+	int extra;
+
+	text = strchr(line, '"');
+
+	if(text == NULL)
+	{
+		return -1;
+	}
+
+	for(text++; *text != '"'; text++)
+	{
+		if(*text == '\0' || *text == '\n' || length + 2 >= space)
+		{
+			return -1;
+		}
+
+		if(*text == '\\')
+		{
+			text++;
+
+			if(*text == 'r')
+			{
+				output[length++] = '\r';
+			}
+			else if(*text == 'n')
+			{
+				output[length++] = '\n';
+			}
+			else if(*text == 'e')
+			{
+				output[length++] = 0x1B;
+			}
+			else if(*text == '\\' || *text == '"')
+			{
+				output[length++] = *text;
+			}
+			else
+			{
+				return -1;
+			}
+		}
+		else if(*text == '%' && (text[1] == 'n' || text[1] == 'N'))
+		{
+			text++;
+			extra = sprintf(number, "%02d", *text == 'n' ? repeat : repeat + 1);
+
+			if(length + extra >= space)
+			{
+				return -1;
+			}
+
+			memcpy(output + length, number, extra);
+			length += extra;
+		}
+		else
+		{
+			output[length++] = *text;
+		}
+	}
+
+	return length;
+}
+
+/* Function Name: simScenarioProgress
+	Purpose: Notes the latency of each command the firmware has finished with. A command is finished once
+			 all of it has been delivered and read and the firmware is waiting again with nothing left to send
+	Params: none
+	Returns: (void)
+*/
+void simScenarioProgress()
+{
+	while(simScenarioCompleted < simScenarioCommands && simInputDelivered >= simScenarioLastByte[simScenarioCompleted]
+		&& rxHead == rxTail && (*REGISTER(SIM_SCSR) & 0xA0) == 0x80)
+	{
+		simScenarioLatency[simScenarioCompleted] = simCycles - simScenarioStart[simScenarioCompleted];
+		simScenarioCompleted++;
+	}
+}
+
+/* Function Name: simCompareCycles
+	Purpose: qsort comparison for cycle counts
+	Params: (const void *) a, (const void *) b - Cycle counts to compare
+	Returns: (int) Negative, zero or positive as a is less than, equal to or greater than b
+*/
+int simCompareCycles(const void * a, const void * b)
+{
+	unsigned long long first = *(const unsigned long long *) a;
+	unsigned long long second = *(const unsigned long long *) b;
+
+	return (first > second) - (first < second);
+}
+
+/* Function Name: simScenarioReport
+	Purpose: Prints the throughput and latency percentiles of the scenario that was run
+	Params: none
+	Returns: (void)
+*/
+void simScenarioReport()
+{
+	int n = simScenarioCompleted;
+	double seconds = (double) simCycles / E_CLOCK_HZ;
+
+	fprintf(stderr, "\nScenario %s: %d of %d commands completed, %lu characters typed, %d deliveries\n",
+		simScenarioName, n, simScenarioCommands, simInputDelivered, doseState.deliveryEvents);
+
+	if(n == 0 || seconds <= 0)
+	{
+		return;
+	}
+
+	fprintf(stderr, "Throughput %.2f commands/s %.1f characters/s, latency ms", n / seconds, simInputDelivered / seconds);
+	simPrintPercentiles(simScenarioLatency, n);
+	fprintf(stderr, "\n");
+}
+
+/* Function Name: simPrintPercentiles
+	Purpose: Sorts cycle counts and prints their p50, p90, p99 and maximum in milliseconds on stderr
+	Params: (unsigned long long *) samples - Cycle counts, sorted in place
+			(int) n - Number of samples, at least one
+	Returns: (void)
+*/
+void simPrintPercentiles(unsigned long long * samples, int n)
+{
+	qsort(samples, n, sizeof(samples[0]), simCompareCycles);
+
+	fprintf(stderr, " p50 %.1f p90 %.1f p99 %.1f max %.1f",
+		samples[(n - 1) / 2] * 1000.0 / E_CLOCK_HZ, samples[(n - 1) * 9 / 10] * 1000.0 / E_CLOCK_HZ,
+		samples[(n - 1) * 99 / 100] * 1000.0 / E_CLOCK_HZ, samples[n - 1] * 1000.0 / E_CLOCK_HZ);
+}
+
+/* Function Name: simLatencySecond
+	Purpose: Notes when the firmware clock enters a new second, after a real time interrupt, and counts the doses
+			 which fall due in it
+	Params: (unsigned long long) tickTime - Virtual time of the interrupt
+	Returns: (void)
+*/
+void simLatencySecond(unsigned long long tickTime)
+{
+	const struct dose * scheduled;
+	long now;
+	int i;
+
+	if(secs == simClockSecond)
+	{
+		return;
+	}
+
+	simClockSecond = secs;
+	simSecondStart = tickTime;
+	now = simSecondsOfDay(hours, mins, secs);
+
+	for(i = 0; i < doseState.schedule->scheduledDoses; i++)
+	{
+		scheduled = &doseState.schedule->doses[i];
+
+		/*Statuses are only reset for a new day by the firmware's next check*/
+		if((doseState.status[i] == 0 || doseState.scheduleDay != days) && doseCoreDueOnDay(scheduled, days)
+			&& simSecondsOfDay(scheduled->hours, scheduled->mins, scheduled->secs) == now)
+		{
+			simDosesDue++;
+		}
+	}
+}
+
+/* Function Name: simLatencyDelivery
+	Purpose: Starts timing a delivery when the firmware calls deliverMotorDose
+	Params: (unsigned long) doseIndex - Dose number from 1, MAX_DOSES + 1 for a boost
+	Returns: (void)
+*/
+void simLatencyDelivery(unsigned long doseIndex)
+{
+	int kind = (doseIndex > MAX_DOSES) ? LATENCY_BOOST : LATENCY_DOSE;
+
+	if(simLatencyWaiting == CORE_MAX_ACTIONS || (kind == LATENCY_BOOST && simBoostPressed == 0))
+	{
+		return;
+	}
+
+	simLatencyKind[simLatencyWaiting] = kind;
+	simLatencyStimulus[simLatencyWaiting] = (kind == LATENCY_BOOST) ? simBoostPressed : simSecondStart;
+	simLatencyStarted[simLatencyWaiting] = simCycles;
+	simLatencyWaiting++;
+
+	if(kind == LATENCY_BOOST)
+	{
+		simBoostPressed = 0;
+	}
+}
+
+/* Function Name: simLatencyMotorPulse
+	Purpose: Finishes timing the deliveries whose first frame has just started, if OC1 has just raised A6
+	Params: none
+	Returns: (void)
+*/
+void simLatencyMotorPulse()
+{
+	int i;
+	int kind;
+
+	if(simLatencyFramed == 0 || simMotorPin == 0)
+	{
+		return;
+	}
+
+	for(i = 0; i < simLatencyFramed; i++)
+	{
+		kind = simLatencyKind[i];
+
+		if(simLatencyCount[kind] < LATENCY_MAX_SAMPLES)
+		{
+			simLatencyPulse[kind][simLatencyCount[kind]] = simCycles - simLatencyStimulus[i];
+			simLatencyStart[kind][simLatencyCount[kind]] = simLatencyStarted[i] - simLatencyStimulus[i];
+			simLatencyCount[kind]++;
+		}
+	}
+
+	for(i = simLatencyFramed; i < simLatencyWaiting; i++) /*Started since the frame was set up, they wait for the next*/
+	{
+		simLatencyKind[i - simLatencyFramed] = simLatencyKind[i];
+		simLatencyStimulus[i - simLatencyFramed] = simLatencyStimulus[i];
+		simLatencyStarted[i - simLatencyFramed] = simLatencyStarted[i];
+	}
+
+	simLatencyWaiting -= simLatencyFramed;
+	simLatencyFramed = 0;
+}
+
+/* Function Name: simLatencyReport
+	Purpose: Prints the percentiles of the time from each dose falling due or boost press to the first motor pulse
+	Params: none
+	Returns: (void)
+*/
+void simLatencyReport()
+{
+	const char * names[2] = {"Doses", "Boosts"};
+	int kind;
+	int n;
+
+	fprintf(stderr, "\nDelivery latency: %lu doses due, %d delivered, %d boosts, %d withheld by the dose budget\n",
+		simDosesDue, simLatencyCount[LATENCY_DOSE], simLatencyCount[LATENCY_BOOST], doseState.budgetWithheld);
+
+	for(kind = LATENCY_DOSE; kind <= LATENCY_BOOST; kind++)
+	{
+		n = simLatencyCount[kind];
+
+		if(n > 0)
+		{
+			fprintf(stderr, "%s to first motor pulse ms", names[kind]);
+			simPrintPercentiles(simLatencyPulse[kind], n);
+			fprintf(stderr, ", to deliverMotorDose ms");
+			simPrintPercentiles(simLatencyStart[kind], n);
+			fprintf(stderr, "\n");
+		}
+	}
+}
+
+/* Function Name: simRandom
+	Purpose: Repeatable pseudo random numbers for the stress tests
+	Params: none
+	Returns: (unsigned long) Next number in the sequence
+*/
+unsigned long simRandom()
+{
+	simRandomState = simRandomState * 1103515245UL + 12345UL;
+
+	return (simRandomState >> 16) & 0x7FFF;
+}
+
+/* Function Name: simClockLoad
+	Purpose: Called between the loads of the clock fields. During the clock stress test, half of the time
+			 an RTI tick which completes a second is run at this point, as if the interrupt had landed there
+	Params: none
+	Returns: (void)
+*/
+void simClockLoad()
+{
+	if(simClockStress && (simRandom() & 1))
+	{
+		clockFraction = CLOCK_SECOND_UNITS - CLOCK_TICK_UNITS;
+		timer();
+		simInjectedTicks++;
+	}
+}
+
+/* Function Name: simSecondsOfDay
+	Purpose: Converts a time of day to seconds since midnight
+	Params: (int) clockHours, (int) clockMins, (int) clockSecs - Time of day
+	Returns: (long) Seconds since midnight
+*/
+long simSecondsOfDay(int clockHours, int clockMins, int clockSecs)
+{
+	return (long) clockHours * 3600L + (long) clockMins * 60L + clockSecs;
+}
+
+/* Function Name: simClockReadTorn
+	Purpose: Checks a clock read against the clock before and after it. The clock only moves forwards a second
+			 at a time, so any value it really held lies between the two
+	Params: (long) before - Clock before the read, in seconds since midnight
+			(long) value - Clock as read
+			(long) after - Clock after the read
+	Returns: (int) 1 if the value was never held by the clock, 0 otherwise
+*/
+int simClockReadTorn(long before, long value, long after)
+{
+	if(after < before)
+	{
+		after += 86400L; /*Passed midnight*/
+	}
+
+	if(value < before)
+	{
+		value += 86400L;
+	}
+
+	return value < before || value > after;
+}
+
+/* Function Name: simClockStressTest
+	Purpose: Reads the clock across second, minute, hour and day rollovers with ticks injected between the loads,
+			 both through readClock and by loading the three fields directly
+	Params: (unsigned long) reads - Number of reads of each kind
+	Returns: (int) 0 if readClock never returned a torn time, 1 otherwise
+*/
+int simClockStressTest(unsigned long reads)
+{
+	unsigned long i;
+	unsigned long readClockTorn = 0;
+	unsigned long plainTorn = 0;
+	unsigned long injected;
+	int startHours;
+	int startMins;
+	long before;
+	struct clockTime snapshot;
+
+	initialise(); /*timer() needs the register addresses*/
+	simClockStress = 1;
+
+	for(i = 0; i < reads; i++)
+	{
+		startHours = (int) (simRandom() % 24);
+		startMins = (simRandom() & 1) ? 59 : (int) (simRandom() % 60);
+
+		setClock(startHours, startMins, 59);
+		before = simSecondsOfDay(hours, mins, secs);
+		readClock(&snapshot);
+		readClockTorn += simClockReadTorn(before, simSecondsOfDay(snapshot.hours, snapshot.mins, snapshot.secs),
+			simSecondsOfDay(hours, mins, secs));
+
+		setClock(startHours, startMins, 59);
+		before = simSecondsOfDay(hours, mins, secs);
+		snapshot.hours = hours;
+		simClockLoad();
+		snapshot.mins = mins;
+		simClockLoad();
+		snapshot.secs = secs;
+		plainTorn += simClockReadTorn(before, simSecondsOfDay(snapshot.hours, snapshot.mins, snapshot.secs),
+			simSecondsOfDay(hours, mins, secs));
+	}
+
+	injected = simInjectedTicks;
+	simClockStress = 0;
+
+	fprintf(stderr, "Clock stress: %lu reads each, %lu ticks injected\n", reads, injected);
+	fprintf(stderr, "  readClock:    %lu torn\n", readClockTorn);
+	fprintf(stderr, "  direct loads: %lu torn\n", plainTorn);
+
+	return readClockTorn == 0 ? 0 : 1;
+}
+
+/* Function Name: simDoseBenchmark
+	Purpose: Times finding the doses due at every second of a day in a large schedule, with the loop over struct
+			 dose the dosing core checks its schedule with and with each doseTable kernel, and checks that they
+			 all find the same doses
+	Params: (int) count - Doses in the schedule
+	Returns: (int) 0 if every kernel found the same doses as the struct dose loop, 1 otherwise
+*/
+int simDoseBenchmark(int count)
+{
+	struct dose * doses = malloc((size_t) count * sizeof(struct dose));
+	int * status = calloc((size_t) count, sizeof(int));
+	int * matches = malloc((size_t) count * sizeof(int));
+	struct doseTable table;
+	struct timespec start;
+	unsigned long long found[DOSE_TABLE_KERNELS + 1]; /*Sum of the indices found plus one for each, as a check*/
+	double callNs[DOSE_TABLE_KERNELS + 1];
+	unsigned long due = 0;
+	unsigned int day = 1; /*Single doses on day 0 have passed*/
+	long now;
+	int kernel;
+	int failed = 0;
+	int dueNow;
+	int i;
+
+	if(doses == NULL || status == NULL || matches == NULL)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	for(i = 0; i < count; i++)
+	{
+		doses[i].hours = (int) (simRandom() % 24);
+		doses[i].mins = (int) (simRandom() % 60);
+		doses[i].secs = (int) (simRandom() % 60);
+		doses[i].intensity = (int) (simRandom() & 1);
+		doses[i].repeatDays = (int) (simRandom() % 4);
+		doses[i].startDay = (unsigned int) (simRandom() % 3);
+	}
+
+	/*As doseCoreCheckDoses compares each dose with the time*/
+	found[0] = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for(now = 0; now < 86400L; now++)
+	{
+		for(i = 0; i < count; i++)
+		{
+			if(status[i] == 0 && doseCoreDueOnDay(&doses[i], day)
+				&& doseCoreSecondsOfDay(doses[i].hours, doses[i].mins, doses[i].secs) == now)
+			{
+				found[0] += (unsigned long long) i + 1;
+				due++;
+			}
+		}
+	}
+
+	callNs[0] = simElapsedNs(&start) / 86400.0;
+
+	for(kernel = 0; kernel < DOSE_TABLE_KERNELS; kernel++)
+	{
+		if(doseTableInit(&table, count) == 0)
+		{
+			fprintf(stderr, "Out of memory\n");
+			return 1;
+		}
+
+		for(i = 0; i < count; i++)
+		{
+			doseTableAdd(&table, &doses[i], DOSE_TABLE_KEY(day, 0));
+		}
+
+		found[kernel + 1] = 0;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		for(now = 0; now < 86400L; now++)
+		{
+			dueNow = doseTableMatchWith(kernel, &table, DOSE_TABLE_KEY(day, now), matches);
+
+			for(i = 0; i < dueNow; i++)
+			{
+				found[kernel + 1] += (unsigned long long) matches[i] + 1;
+				doseTableAdvance(&table, matches[i]);
+			}
+		}
+
+		callNs[kernel + 1] = simElapsedNs(&start) / 86400.0;
+		doseTableFree(&table);
+	}
+
+	fprintf(stderr, "Dose table: %d doses checked at every second of a day, %lu due\n", count, due);
+	fprintf(stderr, "  struct dose loop %10.1f ns a second\n", callNs[0]);
+
+	for(kernel = 0; kernel < DOSE_TABLE_KERNELS; kernel++)
+	{
+		if(kernel > doseTableKernel())
+		{
+			fprintf(stderr, "  %-16s not supported by this processor\n", doseTableKernelName(kernel));
+			continue;
+		}
+
+		fprintf(stderr, "  %-16s %10.1f ns a second, %.1f times faster%s\n", doseTableKernelName(kernel), callNs[kernel + 1],
+			callNs[0] / callNs[kernel + 1], (found[kernel + 1] == found[0]) ? "" : ", DIFFERENT DOSES FOUND");
+		failed |= (found[kernel + 1] != found[0]);
+	}
+
+	free(doses);
+	free(status);
+	free(matches);
+
+	return failed;
+}
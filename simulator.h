@@ -0,0 +1,68 @@
+/*	File Name: simulator.h
+	Date: 18/10/2026
+	Purpose: Declarations shared between scheduleDose.c and the native simulator (simulator.c) when the
+			 program is built for the host with -DSIMULATOR
+	Required Headers: none
+*/
+
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#define SIM_REGISTER_COUNT 0x40
+#define SIM_EEPROM_SIZE 512
+
+/* Every register gets its own unsigned int slot so that 8 and 16 bit registers can share the offsets
+	used on the 68HC11 without overlapping or being misaligned on the host */
+#define REGISTER(offset) ((unsigned char*)&simRegisters[(offset)])
+#define INTERRUPT
+#define WAIT_FOR_INTERRUPT() simIdle()
+#define SIM_SERIAL_READ() simSerialRead()
+#define SIM_SERIAL_WRITE() simSerialWrite()
+#define SIM_SERIAL_TRANSMIT() simSerialTransmit()
+#define SIM_CLOCK_LOAD() simClockLoad()
+#define DISABLE_INTERRUPTS() /*Interrupts only run while the firmware waits or sends output*/
+#define ENABLE_INTERRUPTS()
+#define SIM_TIMELINE_BEGIN(event, value) simTimeline((event), 'B', (value), 0)
+#define SIM_TIMELINE_END(event) simTimeline((event), 'E', 0, 0)
+#define SIM_COMPARE_WRITTEN() simCompareWritten()
+#define SIM_EEPROM_PROGRAM(offset) simEepromProgram(offset)
+#define EEPROM(offset) (simEeprom[(offset)])
+
+/* Timeline events, see simTimelineEvents in simulator.c for their names and threads */
+#define SIM_EVENT_TIMER 0
+#define SIM_EVENT_MOTOR 1
+#define SIM_EVENT_RECEIVE 2
+#define SIM_EVENT_SERVICE 3
+#define SIM_EVENT_CLOCK 4
+#define SIM_EVENT_REDRAW 5
+#define SIM_EVENT_DELIVERY 6
+#define SIM_EVENT_TRANSMIT 7
+#define SIM_EVENT_EEPROM 8
+#define SIM_EVENT_COUNT 9
+
+struct clockTime;
+
+/* Simulator services used by the firmware */
+extern unsigned int simRegisters[SIM_REGISTER_COUNT];
+extern volatile unsigned char simEeprom[SIM_EEPROM_SIZE];
+void simIdle(void);
+void simSerialRead(void);
+void simSerialWrite(void);
+void simSerialTransmit(void);
+void simClockLoad(void);
+void simTimeline(int, int, unsigned long, unsigned long);
+void simEepromProgram(int);
+void simCompareWritten(void);
+
+/* Firmware entry points driven by the simulator */
+int firmwareMain(void);
+int initialise(void);
+void timer(void);
+void turnMotor(void);
+void serialInterrupt(void);
+int serialPutchar(int);
+long projectBatteryLife(unsigned long, unsigned long);
+void readClock(struct clockTime *);
+void setClock(int, int, int);
+
+#endif